@@ -0,0 +1,183 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Checks a harmonic.h clock against a reference table from ephem.c. Build
+ * and run it with 'make astrocheck TYPE=sundial' (or hightide).
+ *
+ * astrocheck [-e epoch] -p period [-k count] [-d days] [-t seconds] table
+ *
+ * The clock is started at several places in the table (count of them,
+ * default 4, spread evenly) with its start angle worked out from the epoch
+ * (the unix time at which the angle is 0) and period (in seconds) the same
+ * way 'make phase' does it. It's then run for days (default the rest of the
+ * table), and at every entry in the table, what the hands show is compared
+ * with what they should. It fails if they're ever off by more than seconds
+ * (default 4), which includes the second the hands move in whole steps.
+ *
+ * An equation of time table (two columns: unix time, seconds) says that the
+ * hands should have moved on by the time since the start plus the change in
+ * the equation of time. A tide table (two columns: high water number,
+ * seconds) says that they should have moved on by 12 hours for each high
+ * water since the start.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim.h"
+
+// harmonic.h reads this instead of the EEPROM.
+unsigned int harmonic_start;
+
+#define MAX_ROWS (100000)
+
+static double when[MAX_ROWS], value[MAX_ROWS];
+static unsigned int rows;
+static int tide_table;
+
+struct check {
+  unsigned int start, row; // where we started, and the next row to check
+  unsigned long long ticks;
+  double worst; // the biggest error, in seconds
+  double worst_at; // and when that was, in days since the start
+};
+
+static struct options {
+  double epoch, period, days, tolerance;
+  unsigned int count;
+} opt;
+
+// How many seconds the hands should have moved from the start to row.
+static double expected(unsigned int start, unsigned int row) {
+  if (tide_table) return (value[row] - value[start]) * 43200;
+  return when[row] - when[start] + value[row] - value[start];
+}
+
+static void check_until(struct check *c, unsigned long long slot) {
+  while(c->row < rows) {
+    double elapsed = when[c->row] - when[c->start];
+    if (elapsed * 10 >= slot) break;
+    double error = (double)c->ticks - expected(c->start, c->row);
+    if (fabs(error) > fabs(c->worst)) {
+      c->worst = error;
+      c->worst_at = elapsed / 86400;
+    }
+    c->row++;
+  }
+}
+
+static void tick(unsigned long long slot, void *arg) {
+  struct check *c = (struct check *)arg;
+  check_until(c, slot);
+  c->ticks++;
+}
+
+static void work(unsigned int i, void *out, void *arg) {
+  struct check *c = (struct check *)out;
+  struct sim_run run;
+  unsigned int span = rows - 1;
+
+  // Start the runs evenly through whatever part of the table leaves
+  // room for the whole run.
+  unsigned int length = (unsigned int)(opt.days * 86400 / ((when[span] - when[0]) / span));
+  if (length == 0 || length > span) length = span;
+  memset(c, 0, sizeof(*c));
+  c->start = (unsigned int)((unsigned long long)(span - length) * i / opt.count);
+  c->row = c->start + 1;
+
+  // Just like 'make phase'
+  double cycles = (when[c->start] - opt.epoch) / opt.period;
+  harmonic_start = (unsigned int)((long long)floor((cycles - floor(cycles)) * 65536 + 0.5) & 0xffff);
+
+  memset(&run, 0, sizeof(run));
+  run.slots = (unsigned long long)((when[c->start + length] - when[c->start]) * 10) + 1;
+  run.seed = 1;
+  run.tick = tick;
+  run.arg = c;
+  sim_run(&run);
+  check_until(c, run.slots);
+}
+
+static int failed;
+
+static void done(unsigned int i, void *out, void *arg) {
+  struct check *c = (struct check *)out;
+  int bad = fabs(c->worst) > opt.tolerance;
+  printf("start %.0f: worst %+.1f s at day %.1f%s\n", when[c->start], c->worst, c->worst_at,
+    bad ? "  TOO FAR OFF" : "");
+  failed |= bad;
+}
+
+int main(int argc, char **argv) {
+  char line[256];
+  int c;
+
+  opt.count = 4;
+  opt.tolerance = 4;
+  while((c = getopt(argc, argv, "e:p:k:d:t:")) != -1) {
+    switch(c) {
+      case 'e': opt.epoch = atof(optarg); break;
+      case 'p': opt.period = atof(optarg); break;
+      case 'k': opt.count = (unsigned int)strtoul(optarg, NULL, 0); break;
+      case 'd': opt.days = atof(optarg); break;
+      case 't': opt.tolerance = atof(optarg); break;
+      default:
+        goto usage;
+    }
+  }
+  if (optind != argc - 1 || opt.period <= 0 || opt.count == 0) goto usage;
+
+  FILE *f = fopen(argv[optind], "r");
+  if (f == NULL) {
+    perror(argv[optind]);
+    return 1;
+  }
+  while(fgets(line, sizeof(line), f) != NULL && rows < MAX_ROWS) {
+    if (line[0] == '#') {
+      if (strstr(line, "high water") != NULL) tide_table = 1;
+      continue;
+    }
+    double a, b;
+    if (sscanf(line, "%lf %lf", &a, &b) != 2) continue;
+    // Tide tables are number, time. Keep them as time, number.
+    when[rows] = tide_table ? b : a;
+    value[rows] = tide_table ? a : b;
+    rows++;
+  }
+  fclose(f);
+  if (rows < 2) {
+    fprintf(stderr, "%s is too short\n", argv[optind]);
+    return 1;
+  }
+
+  if (sim_parallel(opt.count, 0, sizeof(struct check), work, done, NULL)) {
+    fprintf(stderr, "simulation failed\n");
+    return 1;
+  }
+  return failed;
+
+usage:
+  fprintf(stderr, "usage: %s [-e epoch] -p period [-k count] [-d days] [-t seconds] table\n", argv[0]);
+  return 1;
+}
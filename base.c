@@ -30,27 +30,132 @@
  * It sets up a 10 Hz interrupt. The clock code(s) keep accurate time by calling
  * either doTick() or doSleep() repeatedly. Each method will put the CPU to sleep
  * until the next tenth-of-a-second interrupt (doTick() will tick the clock once first).
- * In addition, doTick() and doSleep(), will occasionally (SEED_UPDATE_INTERVAL)
- * write out the PRNG seed (if it's changed) to EEPROM. This will insure that the clock
+ * Each one also steps the timer wheel (see wheel.h), which runs any callbacks
+ * that are due. One of those, every SEED_UPDATE_INTERVAL, writes out the PRNG
+ * seed (if it's changed) to EEPROM. This will insure that the clock
  * doesn't repeat its previous behavior every time you change the battery.
  *
  * The clock code should insure that it doesn't do so much work that works through
  * a 10 Hz interrupt interval. Every time that happens, the clock loses a tenth of
  * a second. In particular, generating random numbers is a costly operation.
  *
+ * Built with DUAL_MOVEMENT, one controller runs two movements, each with its
+ * own clock code: loop() for the first and loop_second() for the second (see
+ * 'make dual'). PB3 and PB4 have the crystal and PB5 is reset, so there's only
+ * PB2 left over. The second coil goes between PB2 and PB1, which the two coils
+ * share. To pulse one coil, the far end of the other is driven to the same
+ * level as the shared pin, so no current flows through it.
+ *
+ * The two clocks take turns, each with its own stack. Each call to doTick() or
+ * doSleep() from the first hands over to the second, and each call from the
+ * second sleeps until the next interrupt and then hands back. So in every
+ * tenth-of-a-second, the first one goes, then the second, then the CPU sleeps.
+ * That also means the two tick pulses come one after the other and never
+ * draw current at the same time. But it also means that both of them, plus
+ * both clocks' work, have to fit in one tenth-of-a-second. 'make dualcheck'
+ * tests a pair against that budget.
+ *
+ * If the clock code ever gets so far behind that sleep_miss_counter wraps
+ * around, the tenths it was behind by are gone, and so are the ticks it would
+ * have made in them. So the ISR also counts every tenth in isr_slots, and once
+ * a day, reconcile() compares that with how many tenths the clock code has
+ * been through. Whatever is missing, at the rate the clock promises (see
+ * TICK_RATE in base.h), is owed as ticks. doSleep() pays them back one per
+ * second, in tenths that don't have a tick of their own.
+ *
+ * Built with BENCH_SPEEDUP set to some N, the clock runs N times faster than
+ * real time, which makes it possible to watch a day's worth of warpy or early
+ * on the bench in a couple of hours instead of a whole day. Only every Nth
+ * call to doSleep() actually waits for the interrupt, and only every Nth call
+ * to doTick() pulses the coil, so the clock code itself is none the wiser.
+ * The hands move once for every N seconds the clock thinks have gone by.
+ * The catch is that N tenths-of-a-second worth of the clock's work (and a
+ * tick pulse) all have to fit in one real one, so N can't be very large for
+ * the clocks that draw a lot of random numbers. A clock that can't keep up
+ * just runs as fast as it can ('make fast').
+ *
+ * Built with POWER_FAIL, it keeps its place through a battery change. The
+ * battery feeds the chip through a diode, with a hold-up capacitor after it,
+ * and PB2 watches the battery side (through a resistor). When the battery
+ * goes, PB2 falls and the INT0 interrupt writes a checkpoint record to the
+ * EEPROM: which way the next tick goes, and a few bytes of the clock's own
+ * state if it keeps any (see checkpointSave() in base.h). The record's
+ * bytes are erased at start-up, so that each one only needs a write, which
+ * takes half as long as an erase and write. The mark goes last, so a
+ * half-written record is never taken for a whole one. The worst case is
+ * checked against POWER_FAIL_HOLDUP_MS when it's built, and 'make
+ * powerfailcheck' measures it in emu. If the battery comes back before the
+ * capacitor gives out, the watchdog resets the chip, as if it had been
+ * changed. DUAL_MOVEMENT and DEBUG both need PB2, so neither goes with it.
+ *
+ * Built with TIME_CODE, the clock sets itself from a DCF77 receiver module
+ * whose output is on PB2 (see timecode.h), and that's only for a clock that
+ * keeps proper time, like normal.c. It keeps count of where the hands are,
+ * in seconds of the 12 hour dial, and every minute puts that in the EEPROM.
+ * That's a ring of records, in the EEPROM that nothing else uses, so each
+ * byte only gets written once every hour or so. After a battery change, it
+ * picks up from the last record, and which way the next tick goes follows
+ * from that too. Once two minutes in a row have come in and agree, the
+ * hands are put right: if they're behind, they're caught up with ticks in
+ * between the clock's own, TIME_CODE_GAP tenths apart; if they're ahead,
+ * the clock's own ticks are left out, whichever is over sooner. That also
+ * takes care of any drift, every minute. Each edge of the receiver's output
+ * wakes the chip up with the pin change interrupt - two a second, which are
+ * over in a few msec - and a tenth with more than TIME_CODE_EDGES of them is
+ * noise, so the interrupt is left off for the rest of it. The first time,
+ * put the hands at 12 before the battery goes in. The record is only once a
+ * minute, so after a battery change the hands can end up as much as a
+ * minute fast. DUAL_MOVEMENT, DEBUG and POWER_FAIL all need PB2, and
+ * BENCH_SPEEDUP doesn't keep real time, so none of them go with it. 'make
+ * timecode' builds one, and 'make timecodecheck' tries the decoder against
+ * a made-up signal on the host, then runs a build in emu with a signal.
+ *
+ * Built with PPS, the trim follows a GPS module's 1PPS output on PB2, for a
+ * clock that keeps proper time, like normal.c. Each rising edge raises
+ * INT0, which timestamps it against Timer0 to the count (and the tenth of
+ * our own second), and doSleep() hands that to a PI loop (see pps.h), whose
+ * answer is the trim from then on. That holds the clock's seconds steady
+ * against the edges to within a couple of msec, however the crystal's
+ * temperature or age has moved it. The trim changes every second, so the
+ * ISR nudges it out with a running total instead of the countdown the
+ * other builds use, which would lose part of a nudge every time it
+ * changed. What the loop has learned of the crystal is the trim when the
+ * edges stop (after PPS_HOLDOVER_AFTER tenths without one), and once a day,
+ * if the loop has been locked for PPS_SAVE_AFTER seconds, it's written
+ * back to the EEPROM, so that's where the next battery starts from too.
+ * DUAL_MOVEMENT, DEBUG, POWER_FAIL and TIME_CODE all need PB2, and
+ * BENCH_SPEEDUP doesn't keep real time, so none of them go with it. 'make
+ * pps' builds one, and 'make ppscheck' runs the loop against a made-up
+ * crystal on the host, then runs a build in emu with a PPS source.
+ *
  */
 
 #include <avr/io.h>
 #include <avr/sleep.h>
-#include <avr/power.h>
 #include <avr/eeprom.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include <avr/cpufunc.h>
 #include <util/delay.h>
 #include <util/atomic.h>
 #include <stdlib.h>
+#ifdef DUAL_MOVEMENT
+#include <setjmp.h>
+#endif
+#ifdef POWER_FAIL
+#include <avr/wdt.h>
+#endif
+#ifdef TIME_CODE
+#include "timecode.h"
+#endif
+#ifdef PPS
+#include "pps.h"
+#endif
 
 #include "base.h"
+#include "wheel.h"
+#include "buildid.h"
+#include "lowpower.h"
 
 // 32,768 divided by (64 * 10) yields a divisor of 51 1/5, which is 52 + 51*4
 #define CLOCK_CYCLES (5)
@@ -58,6 +163,12 @@
 #define CLOCK_BASIC_CYCLE (51 - 1)
 // a "long" cycle is CLOCK_BASIC_CYCLE + 1
 #define CLOCK_NUM_LONG_CYCLES (1)
+#ifdef PPS
+// A tenth is 51.2 counts, and trim is in units of 1e-7, so nudge every time
+// trim * 51.2 adds up to 1e7. Both times 5, to stay in whole numbers.
+#define TRIM_NUDGE (50000000UL)
+#define TRIM_COUNTS_PER_TENTH (256)
+#endif
 
 // One day in tenths-of-a-second
 #define SEED_UPDATE_INTERVAL 864000L
@@ -69,6 +180,122 @@
 #define P1 1
 #define P_UNUSED 2
 
+#ifdef DUAL_MOVEMENT
+#ifdef DEBUG
+#error DEBUG uses PB2, which the second movement needs.
+#endif
+// The second coil is between this and P1.
+#define P2 P_UNUSED
+
+// How much RAM the second clock gets for its stack. It has to hold that
+// clock's locals and an interrupt's worth of saved registers, the same as
+// the main stack, so the Makefile makes it STACK_RESERVE.
+#ifndef DUAL_STACK_SIZE
+#define DUAL_STACK_SIZE (48)
+#endif
+#endif
+
+#ifdef POWER_FAIL
+#ifdef DUAL_MOVEMENT
+#error POWER_FAIL needs PB2, which the second movement uses.
+#endif
+#ifdef DEBUG
+#error POWER_FAIL needs PB2, which DEBUG uses.
+#endif
+// The battery side of the supply diode.
+#define P_SENSE P_UNUSED
+
+// The next tick's direction, the clock's state, and then the mark.
+#define EE_CHECKPOINT_LOC (76)
+#define CHECKPOINT_RECORD (CHECKPOINT_SIZE + 2)
+#define CHECKPOINT_MARK (0x5a)
+
+// How long the hold-up capacitor keeps the chip going once the battery is gone.
+#ifndef POWER_FAIL_HOLDUP_MS
+#define POWER_FAIL_HOLDUP_MS (20)
+#endif
+// The worst case, in usec: one of our own writes that's only just started
+// (3.4 msec to erase and write), then 1.8 msec for each byte of the record,
+// and a millisecond for the CPU's part of it at 32 kHz. Those are the
+// datasheet's times, which don't depend on the system clock.
+#define POWER_FAIL_WORST_US (3400UL + CHECKPOINT_RECORD * 1800UL + 1000UL)
+#if POWER_FAIL_WORST_US > POWER_FAIL_HOLDUP_MS * 1000UL
+#error The checkpoint can take longer than POWER_FAIL_HOLDUP_MS.
+#endif
+#endif
+
+#ifdef TIME_CODE
+#ifdef DUAL_MOVEMENT
+#error TIME_CODE needs PB2, which the second movement uses.
+#endif
+#ifdef DEBUG
+#error TIME_CODE needs PB2, which DEBUG uses.
+#endif
+#ifdef POWER_FAIL
+#error TIME_CODE and POWER_FAIL both need PB2.
+#endif
+#ifdef BENCH_SPEEDUP
+#error TIME_CODE needs a clock that keeps real time.
+#endif
+// The receiver's output.
+#define P_CODE P_UNUSED
+
+// Records of where the hands are: the second of the dial, then a sequence
+// number, which goes up by one from each record to the next. The last one
+// written is the one before the sequence breaks.
+#define EE_HANDS_LOC (82)
+#define HANDS_RECORD (3)
+#define HANDS_COUNT ((E2END + 1 - EE_HANDS_LOC) / HANDS_RECORD)
+// One minute
+#define HANDS_SAVE_INTERVAL (600)
+
+// Tenths from one catch-up tick to the next. The movement has to be able
+// to keep up with that.
+#ifndef TIME_CODE_GAP
+#define TIME_CODE_GAP (2)
+#endif
+// How many catch-up ticks a second, at least, next to the clock's own.
+#define TIME_CODE_GAIN (IRQS_PER_SECOND / TIME_CODE_GAP - 1)
+// The most edges there can be in a tenth from a real signal is 2.
+#define TIME_CODE_EDGES (4)
+// For a receiver whose output is low while the carrier's cut back.
+#ifdef TIME_CODE_ACTIVE_LOW
+#define CODE_LEVEL_FLIP (1)
+#else
+#define CODE_LEVEL_FLIP (0)
+#endif
+#endif
+
+#ifdef PPS
+#ifdef DUAL_MOVEMENT
+#error PPS needs PB2, which the second movement uses.
+#endif
+#ifdef DEBUG
+#error PPS needs PB2, which DEBUG uses.
+#endif
+#ifdef POWER_FAIL
+#error PPS and POWER_FAIL both need PB2.
+#endif
+#ifdef TIME_CODE
+#error PPS and TIME_CODE both need PB2.
+#endif
+#ifdef BENCH_SPEEDUP
+#error PPS needs a clock that keeps real time.
+#endif
+// Tenths without an edge before the loop's frequency takes over.
+#define PPS_HOLDOVER_AFTER (25)
+// Seconds locked before what the loop has learned goes in the EEPROM. An hour.
+#define PPS_SAVE_AFTER (3600)
+#endif
+
+#ifdef BENCH_SPEEDUP
+#if BENCH_SPEEDUP < 1 || BENCH_SPEEDUP > 255
+#error BENCH_SPEEDUP has to be from 1 to 255.
+#endif
+// How many tenths have gone by since we last really slept.
+static unsigned char bench_slots;
+#endif
+
 // For a 32 kHz system clock speed, random() is too slow.
 // Found this at http://uzebox.org/forums/viewtopic.php?f=3&t=250
 static long seed;
@@ -80,7 +307,7 @@ unsigned long q_random() {
   return (unsigned long) seed;
 }
 
-static void updateSeed() {
+static void updateSeed(struct wheel_timer *t) {
   // Don't bother exercising the eeprom if the seed hasn't changed
   // since last time.
   eeprom_update_dword(EE_PRNG_SEED_LOC, seed);
@@ -88,17 +315,295 @@ static void updateSeed() {
 
 volatile static unsigned char sleep_miss_counter = 0;
 
+#ifdef PPS
+volatile unsigned long trim_step;
+#else
 volatile unsigned long trim_cycles;
+#endif
 volatile char trim_offset;
 
-static unsigned long seed_update_timer;
+// The trim, in tenths of a ppm, positive to slow down.
+static void setTrim(int trim_value) {
+#ifdef PPS
+  unsigned long step = (unsigned long)abs(trim_value) * TRIM_COUNTS_PER_TENTH;
+  char offset = (trim_value == 0) ? 0 : (trim_value < 0) ? -1 : 1;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    trim_step = step;
+    trim_offset = offset;
+  }
+#else
+  if (trim_value != 0) {
+    trim_cycles = 10000000 / abs(trim_value); // how often do we nudge by 1 unit?
+    trim_offset = (trim_value < 0)?-1:1; // signum - which direction?
+  } else
+    trim_offset = 0;
+#endif
+}
 
-void doSleep() {
+#ifdef PPS
+static struct pps pps; // only touched by doSleep()
+volatile static unsigned char pps_tenth; // of our own second, from the ISR
+volatile static unsigned char pps_ready; // set when there's a new pps_phase
+volatile static int pps_phase; // where in our second the last edge came (see pps.h)
+static unsigned char pps_quiet; // tenths since the last edge
+
+// Steer the trim from the last edge, if there's been one, or hold what the
+// loop has learned if they've stopped.
+static void ppsUpdate() {
+  unsigned char ready;
+  int phase;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    ready = pps_ready;
+    phase = pps_phase;
+    pps_ready = 0;
+  }
+  if (ready) {
+    pps_quiet = 0;
+    setTrim(pps_edge(&pps, phase));
+  } else if (pps_quiet < PPS_HOLDOVER_AFTER && ++pps_quiet == PPS_HOLDOVER_AFTER)
+    setTrim(pps_holdover(&pps));
+}
+
+static void savePps() {
+  if (pps.locked >= PPS_SAVE_AFTER) eeprom_update_word(EE_TRIM_LOC, pps_holdover(&pps));
+}
+#endif
 
-  if (--seed_update_timer == 0) {
-    updateSeed();
-    seed_update_timer = SEED_UPDATE_INTERVAL;
+static struct wheel_timer daily_timer;
+
+#ifdef DUAL_MOVEMENT
+#define MOVEMENTS (2)
+#else
+#define MOVEMENTS (1)
+#endif
+
+#ifndef BENCH_SPEEDUP
+// What each clock promises, unless it says otherwise (see base.h).
+const unsigned long tick_rate[2] PROGMEM __attribute__((weak)) = { 1, IRQS_PER_SECOND };
+#ifdef DUAL_MOVEMENT
+// 'make dual' renames the second clock's.
+const unsigned long tick_rate_second[2] PROGMEM __attribute__((weak)) = { 1, IRQS_PER_SECOND };
+#define TICK_RATE_OF(i) ((i) ? tick_rate_second : tick_rate)
+#else
+#define TICK_RATE_OF(i) (tick_rate)
+#endif
+
+volatile static unsigned long isr_slots; // every tenth there's been
+static unsigned int lost_wraps; // how many times sleep_miss_counter has been found to have wrapped
+static unsigned int owed[MOVEMENTS]; // ticks still to make up
+static unsigned long owed_part[MOVEMENTS]; // and the fraction of one, over the rate's denominator
+static unsigned char ticked; // which movements have ticked this tenth
+static unsigned char make_up_wait; // tenths until the next one can be made up
+#ifdef TIME_CODE
+#define MAKE_UP_GAP (TIME_CODE_GAP)
+#else
+#define MAKE_UP_GAP (IRQS_PER_SECOND)
+#endif
+
+static void reconcile() {
+  unsigned long slots;
+  unsigned char pending;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    slots = isr_slots;
+    pending = sleep_miss_counter;
+  }
+  // WHEEL_NOW has already counted this tenth, but sleep_miss_counter hasn't
+  // been taken down for it yet. Anything that's still pending is going to be
+  // caught up on. What's left over is a whole number of wraps.
+  long behind = (long)(slots - (WHEEL_NOW - 1)) - pending;
+  unsigned int wraps = (unsigned int)((behind + 128) >> 8);
+  while(lost_wraps != wraps) {
+    lost_wraps++;
+    for(unsigned char i = 0; i < MOVEMENTS; i++) {
+      unsigned long den = pgm_read_dword(TICK_RATE_OF(i) + 1);
+      owed_part[i] += 256 * pgm_read_dword(TICK_RATE_OF(i));
+      owed[i] += owed_part[i] / den;
+      owed_part[i] %= den;
+    }
   }
+}
+#endif
+
+static void everyDay(struct wheel_timer *t) {
+  updateSeed(t);
+#ifndef BENCH_SPEEDUP
+  reconcile();
+#endif
+#ifdef PPS
+  savePps();
+#endif
+}
+
+#ifdef DUAL_MOVEMENT
+static jmp_buf context[2];
+static unsigned char current; // which movement is running
+static unsigned char second_stack[DUAL_STACK_SIZE];
+
+static void yield() {
+  if (setjmp(context[current]) == 0) {
+    current ^= 1;
+    longjmp(context[current], 1);
+  }
+}
+
+extern void loop_second();
+
+static void __attribute__((noinline, noreturn)) startSecond() {
+  // Leave a place to come back to, and let the first one get going.
+  if (setjmp(context[1]) == 0) {
+    current = 0;
+    longjmp(context[0], 1);
+  }
+  while(1) loop_second();
+}
+#endif
+
+// How long is each tick pulse?
+#define TICK_LENGTH (35)
+
+#ifdef DUAL_MOVEMENT
+// Which pins to raise for each movement's two directions.
+static const unsigned char tick_pins[2][2] = {
+  { _BV(P0), _BV(P1) | _BV(P2) },
+  { _BV(P2), _BV(P1) | _BV(P0) },
+};
+
+static void pulse(unsigned char which) {
+  static unsigned char lastTick[2];
+  unsigned char pins = tick_pins[which][lastTick[which]];
+  lastTick[which] ^= 1;
+  PORTB |= pins;
+  _delay_ms(TICK_LENGTH);
+  PORTB &= ~pins;
+}
+#else
+// This will alternate the ticks
+#define TICK_PIN (lastTick == P0?P1:P0)
+static unsigned char lastTick = P0;
+#ifdef TIME_CODE
+static unsigned int hand_pos; // the second of the dial the hands are at
+#endif
+
+static void pulse(unsigned char which) {
+  PORTB |= _BV(TICK_PIN);
+  _delay_ms(TICK_LENGTH);
+  PORTB &= ~ _BV(TICK_PIN);
+  lastTick = TICK_PIN;
+#ifdef TIME_CODE
+  if (++hand_pos == TIMECODE_DIAL) hand_pos = 0;
+#endif
+}
+#endif
+
+#ifdef TIME_CODE
+static struct timecode code; // only touched by the pin change interrupt
+volatile static unsigned int code_time; // Timer0 counts, up to the start of this tenth
+volatile static unsigned char code_edges; // in this tenth
+volatile static unsigned char code_ready; // set when there's a new code_minute
+volatile static unsigned int code_minute; // the minute of 12 hours that started at the last edge
+static unsigned int held; // the clock's own ticks still to leave out
+static unsigned char hands_slot; // where the next record goes
+static unsigned char hands_seq; // and the sequence number of the last one
+static struct wheel_timer hands_timer;
+
+static void saveHands(struct wheel_timer *t) {
+  unsigned char address = EE_HANDS_LOC + hands_slot * HANDS_RECORD;
+  eeprom_update_word((uint16_t *)address, hand_pos);
+  // Last, so that a record that's half written is never taken for the latest.
+  eeprom_update_byte((uint8_t *)(address + 2), ++hands_seq);
+  if (++hands_slot == HANDS_COUNT) hands_slot = 0;
+}
+
+static void loadHands() {
+  unsigned char i = 0;
+  unsigned char seq = eeprom_read_byte((const uint8_t *)(EE_HANDS_LOC + 2));
+  while(i + 1 < HANDS_COUNT) {
+    unsigned char next = eeprom_read_byte((const uint8_t *)(EE_HANDS_LOC + (i + 1) * HANDS_RECORD + 2));
+    if (next != (unsigned char)(seq + 1)) break;
+    seq = next;
+    i++;
+  }
+  // An EEPROM that's never had a record in it reads all 0xff.
+  unsigned int pos = eeprom_read_word((const uint16_t *)(EE_HANDS_LOC + i * HANDS_RECORD));
+  hand_pos = (pos < TIMECODE_DIAL) ? pos : 0;
+  // Every tick changes direction, and there are an even number of them on
+  // the dial.
+  lastTick = (hand_pos & 1) ? P1 : P0;
+  hands_seq = seq;
+  hands_slot = (i + 1 == HANDS_COUNT) ? 0 : i + 1;
+}
+
+// If the time code has come in, put the hands right from here.
+static void timeCode() {
+  unsigned char ready;
+  unsigned int minute;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    ready = code_ready;
+    minute = code_minute;
+    code_ready = 0;
+  }
+  if (ready) timecode_correct(hand_pos, minute * 60, TIME_CODE_GAIN, &owed[0], &held);
+}
+#endif
+
+#if defined(TIME_CODE) || defined(PPS)
+// The edges on PB2 wake us up too, so go back to sleep until it's the
+// timer. The interrupts stay off from the test to the sleep, so
+// the timer can't go off in between and be slept through.
+static void sleepTimer() {
+  cli();
+  while(sleep_miss_counter == 0xff) {
+    sleep_enable();
+    sei(); // the instruction after this one still happens first
+    sleep_cpu();
+    sleep_disable();
+    cli();
+  }
+  sei();
+}
+#endif
+
+#ifndef BENCH_SPEEDUP
+// Make up an owed tick, if there is one, for a movement that hasn't ticked
+// in this tenth. No more than one every MAKE_UP_GAP tenths, so the
+// movement keeps up.
+static void makeUp() {
+  if (make_up_wait != 0)
+    make_up_wait--;
+  else
+    for(unsigned char i = 0; i < MOVEMENTS; i++) {
+      if (owed[i] == 0 || (ticked & _BV(i))) continue;
+      pulse(i);
+      owed[i]--;
+      make_up_wait = MAKE_UP_GAP - 1;
+    }
+  ticked = 0;
+}
+#endif
+
+#ifdef DUAL_MOVEMENT
+static void sleepSlot() {
+#else
+void doSleep() {
+#endif
+
+  wheel_tick();
+
+#ifndef BENCH_SPEEDUP
+  makeUp();
+#endif
+#ifdef TIME_CODE
+  timeCode();
+#endif
+#ifdef PPS
+  ppsUpdate();
+#endif
+
+#ifdef BENCH_SPEEDUP
+  // The other tenths go by without waiting.
+  if (++bench_slots < BENCH_SPEEDUP) return;
+  bench_slots = 0;
+#endif
 
   // If we missed a sleep, then try and catch up by *not* sleeping.
   // Note that the test-and-decrememnt must be atomic, so save a
@@ -109,7 +614,11 @@ void doSleep() {
     local_smc = sleep_miss_counter--;
   }
   if (local_smc == 0)
+#if defined(TIME_CODE) || defined(PPS)
+    sleepTimer();
+#else
     sleep_mode(); // this results in sleep_miss_counter being incremented.
+#endif
 #ifdef DEBUG
   else {
     // indicate an overflow
@@ -119,29 +628,77 @@ void doSleep() {
 #endif
 }
 
-// How long is each tick pulse?
-#define TICK_LENGTH (35)
+#ifdef DUAL_MOVEMENT
+// The first one goes, then the second, then we sleep.
+void doSleep() {
+  if (current == 1) sleepSlot();
+  yield();
+}
 
-// This will alternate the ticks
-#define TICK_PIN (lastTick == P0?P1:P0)
+void doTick() {
+#ifdef BENCH_SPEEDUP
+  static unsigned char skipped[2];
+  if (++skipped[current] < BENCH_SPEEDUP) {
+    doSleep();
+    return;
+  }
+  skipped[current] = 0;
+#else
+  ticked |= _BV(current);
+#endif
 
+  pulse(current);
+  doSleep(); // eat the rest of this tick
+}
+#else
 // Each call to doTick() will "eat" a single one of our interrupt "ticks"
 void doTick() {
-  static unsigned char lastTick = P0;
+#ifdef BENCH_SPEEDUP
+  static unsigned char skipped;
+  if (++skipped < BENCH_SPEEDUP) {
+    doSleep();
+    return;
+  }
+  skipped = 0;
+#else
+  ticked = 1;
+#endif
+#ifdef TIME_CODE
+  if (held != 0) {
+    held--;
+    doSleep();
+    return;
+  }
+#endif
 
-  PORTB |= _BV(TICK_PIN);
-  _delay_ms(TICK_LENGTH);
-  PORTB &= ~ _BV(TICK_PIN);
-  lastTick = TICK_PIN;
+  pulse(0);
   doSleep(); // eat the rest of this tick
 }
+#endif
 
 ISR(TIMER0_COMPA_vect) {
   static unsigned char cycle_pos = 0;
   static unsigned long trim_pos = 0;
 
+#ifdef TIME_CODE
+  // OCR0A is still what it was for the tenth that's just gone by.
+  code_time += OCR0A + 1;
+  code_edges = 0;
+  GIMSK |= _BV(PCIE);
+#endif
+#ifdef PPS
+  if (++pps_tenth == IRQS_PER_SECOND) pps_tenth = 0;
+#endif
+
   char offset = 0;
   if (trim_offset != 0) {
+#ifdef PPS
+    trim_pos += trim_step;
+    if (trim_pos >= TRIM_NUDGE) {
+      trim_pos -= TRIM_NUDGE;
+      offset = trim_offset;
+    }
+#else
     // This is how many crystal cycles we just went through.
     unsigned long crystal_cycles = OCR0A;
     if (trim_pos < crystal_cycles) {
@@ -149,6 +706,7 @@ ISR(TIMER0_COMPA_vect) {
       offset = trim_offset; // which direction?
     }
     trim_pos -= crystal_cycles;
+#endif
   }
 
   // This is the magic for fractional counting.
@@ -169,49 +727,194 @@ ISR(TIMER0_COMPA_vect) {
   // Every increment here *should* be matched by
   // a decrement in doSleep();
   sleep_miss_counter++;
+#ifndef BENCH_SPEEDUP
+  isr_slots++;
+#endif
+}
+
+#ifdef TIME_CODE
+ISR(PCINT0_vect) {
+  unsigned char count = TCNT0;
+  unsigned int now = code_time + count;
+  // A tenth that's only just ended, whose interrupt is still to come.
+  if ((TIFR & _BV(OCF0A)) && count < OCR0A / 2) now += OCR0A + 1;
+  if (++code_edges > TIME_CODE_EDGES) {
+    // That's noise, and it's not going to keep us awake.
+    GIMSK &= ~_BV(PCIE);
+    code.count = TIMECODE_BAD;
+    return;
+  }
+  int minute = timecode_edge(&code, ((PINB >> P_CODE) & 1) ^ CODE_LEVEL_FLIP, now);
+  if (minute >= 0) {
+    code_minute = minute;
+    code_ready = 1;
+  }
+}
+#endif
+
+#ifdef PPS
+// A 1PPS edge. Where is it in our own second?
+ISR(INT0_vect) {
+  unsigned char count = TCNT0;
+  unsigned char tenth = pps_tenth;
+  // A tenth that's only just ended, whose interrupt is still to come.
+  if ((TIFR & _BV(OCF0A)) && count < OCR0A / 2 && ++tenth == IRQS_PER_SECOND) tenth = 0;
+  pps_phase = tenth * (PPS_UNITS / IRQS_PER_SECOND) + count * 10;
+  pps_ready = 1;
+}
+#endif
+
+#ifdef POWER_FAIL
+// A clock that keeps nothing through a battery change doesn't define these.
+void __attribute__((weak)) checkpointSave(unsigned char *state) { }
+void __attribute__((weak)) checkpointLoad(const unsigned char *state) { }
+
+// With EECR's mode bits: write only, or erase only.
+static void eepromRaw(unsigned char mode, unsigned char address, unsigned char value) {
+  while(EECR & _BV(EEPE)) ; // wait out any write that's under way
+  EECR = mode;
+  EEAR = address;
+  EEDR = value;
+  EECR |= _BV(EEMPE);
+  EECR |= _BV(EEPE);
+}
+
+// The battery's gone. There's only what's in the capacitor left.
+ISR(INT0_vect) {
+  // A tick that's under way counts as made, and the coil can't have any more.
+  unsigned char last = lastTick;
+  if (PORTB & (_BV(P0) | _BV(P1))) last = TICK_PIN;
+  PORTB &= ~(_BV(P0) | _BV(P1));
+
+  unsigned char record[CHECKPOINT_RECORD];
+  for(unsigned char i = 0; i < CHECKPOINT_RECORD; i++) record[i] = 0xff;
+  record[0] = last;
+  checkpointSave(record + 1);
+  record[CHECKPOINT_RECORD - 1] = CHECKPOINT_MARK;
+  // It's all erased, so the bytes that are still 0xff can be skipped.
+  for(unsigned char i = 0; i < CHECKPOINT_RECORD; i++)
+    if (record[i] != 0xff) eepromRaw(_BV(EEPM1), EE_CHECKPOINT_LOC + i, record[i]);
+
+  // Either the capacitor gives out, or the battery was only out for a moment
+  // and it's back, in which case, start over just as if it had been changed.
+  while(!(PINB & _BV(P_SENSE))) ;
+  wdt_enable(WDTO_15MS);
+  while(1) ;
+}
+
+// Pick up where we were when the battery went, if it went while this same
+// build was running, and get the record ready for next time.
+static void restoreCheckpoint() {
+  const unsigned char *trailer = (const unsigned char *)(FLASHEND + 1 - BUILD_TRAILER_SIZE);
+  unsigned char record[CHECKPOINT_RECORD];
+  unsigned char erased = 1;
+  for(unsigned char i = 0; i < CHECKPOINT_RECORD; i++) {
+    record[i] = eeprom_read_byte((const uint8_t *)(EE_CHECKPOINT_LOC + i));
+    erased &= record[i] == 0xff;
+  }
+  if (erased) return;
+  if (record[CHECKPOINT_RECORD - 1] == CHECKPOINT_MARK
+      && pgm_read_dword(trailer) == eeprom_read_dword((uint32_t *)EE_BUILD_LOC)) {
+    lastTick = (record[0] == P1) ? P1 : P0;
+    checkpointLoad(record + 1);
+  }
+  for(unsigned char i = 0; i < CHECKPOINT_RECORD; i++)
+    if (record[i] != 0xff) eepromRaw(_BV(EEPM0), EE_CHECKPOINT_LOC + i, 0xff);
+}
+#endif
+
+// The first time a new build starts up, work out the CRC of what's actually
+// in the flash and put it in the EEPROM with the build ID, for 'make flash'
+// to check (see buildid.h). That takes a few seconds at 32 kHz, so it's only
+// done the once. Write the ID last, so a half-done report never looks done.
+static void checkBuild() {
+  const unsigned char *trailer = (const unsigned char *)(FLASHEND + 1 - BUILD_TRAILER_SIZE);
+  unsigned long id = pgm_read_dword(trailer);
+  if (id == eeprom_read_dword((uint32_t *)EE_BUILD_LOC)) return;
+  unsigned int length = pgm_read_word(trailer + 4);
+  unsigned int crc = 0xffff;
+  if (length <= FLASHEND + 1 - BUILD_TRAILER_SIZE)
+    for(unsigned int i = 0; i < length; i++)
+      crc = build_crc_update(crc, pgm_read_byte((const unsigned char *)i));
+  eeprom_update_word((uint16_t *)(EE_BUILD_LOC + 4), crc);
+  eeprom_update_dword((uint32_t *)EE_BUILD_LOC, id);
 }
 
 extern void loop();
 
 void main() {
-  ADCSRA = 0; // DIE, ADC!!! DIE!!!
-  ACSR = _BV(ACD); // Turn off analog comparator - but was it ever on anyway?
-  power_adc_disable();
-  power_usi_disable();
-  power_timer1_disable();
+#ifdef POWER_FAIL
+  // If the watchdog reset us, it's still on.
+  MCUSR = 0;
+  wdt_disable();
+#endif
+  lowPowerInit(); // everything off that can be, and all our pins low
   TCCR0A = _BV(WGM01); // mode 2 - CTC
   TCCR0B = _BV(CS01) | _BV(CS00); // prescale = 64
   TIMSK = _BV(OCIE0A); // OCR0A interrupt only.
   
   set_sleep_mode(SLEEP_MODE_IDLE);
 
-  DDRB = _BV(P0) | _BV(P1) | _BV(P_UNUSED); // all our pins are output.
-  PORTB = 0; // Initialize all pins low.
-
   // we pre-compute all of this stuff to save cycles later.
-  // These values never change after startup.
+  // These values never change after startup (except in a PPS build).
   // The uninitialized value of 0xffff is actually rather harmless.
   // It's the signed int -1, which speeds up the clock by 0.1 ppm.
   int trim_value = (int)eeprom_read_word(EE_TRIM_LOC);
-  if (trim_value != 0) {
-    trim_cycles = 10000000 / abs(trim_value); // how often do we nudge by 1 unit?
-    trim_offset = (trim_value < 0)?-1:1; // signum - which direction?
-  } else
-    trim_offset = 0;
+  setTrim(trim_value);
+#ifdef PPS
+  pps_init(&pps, trim_value); // and the loop starts from there
+#endif
 
   // Try and perturb the PRNG as best as we can
   seed = (long)eeprom_read_dword(EE_PRNG_SEED_LOC);
   // it can't be all 0 or all 1
   if (seed == 0 || ((seed & M) == M)) seed=0x12345678L;
   q_random(); // perturb it once...
-  updateSeed(); // and write it back out - a new seed every battery change.
+  updateSeed(NULL); // and write it back out - a new seed every battery change.
+
+#ifdef POWER_FAIL
+  // Before checkBuild(), which changes the build ID in the EEPROM for a new build.
+  restoreCheckpoint();
+  MCUCR |= _BV(ISC01); // INT0 on the falling edge
+  GIFR = _BV(INTF0);
+  GIMSK = _BV(INT0);
+#endif
+
+  checkBuild();
 
-  // initialize this so it doesn't have to be in the data segment.
-  seed_update_timer = SEED_UPDATE_INTERVAL;
+#ifdef TIME_CODE
+  loadHands();
+  hands_timer.fire = saveHands;
+  wheel_every(&hands_timer, HANDS_SAVE_INTERVAL);
+  PCMSK = _BV(P_CODE);
+  GIMSK = _BV(PCIE);
+#endif
+
+#ifdef PPS
+  MCUCR |= _BV(ISC01) | _BV(ISC00); // INT0 on the rising edge
+  GIFR = _BV(INTF0);
+  GIMSK = _BV(INT0);
+#endif
+
+  daily_timer.fire = everyDay;
+  wheel_every(&daily_timer, SEED_UPDATE_INTERVAL);
 
   // Set up the initial state of the timer.
   OCR0A = CLOCK_BASIC_CYCLE + 1;
   TCNT0 = 0;
+  // The timer's been running since TCCR0B was set, and with OCR0A still 0
+  // until just now, it's been matching all along. Forget that, or the first
+  // tenth-of-a-second goes by as soon as the interrupts are on.
+  TIFR = _BV(OCF0A);
+
+#ifdef DUAL_MOVEMENT
+  // Give the second clock its own stack and let it set itself up. It'll come
+  // right back here.
+  if (setjmp(context[0]) == 0) {
+    SP = (unsigned int)(second_stack + sizeof(second_stack) - 1);
+    startSecond();
+  }
+#endif
 
   // Don't forget to turn the interrupts on.
   sei();
@@ -38,3 +38,81 @@ void doTick();
 // higher math - just bit shifts.
 unsigned long q_random();
 
+// How many ticks a clock makes per tenth-of-a-second in the long run, as
+// num/den. If the clock code falls so far behind that tenths are lost,
+// base.c makes up the ticks that should have been in them at this rate.
+// A clock that doesn't keep proper time (see drift.h) says so with this,
+// once, at file scope. Otherwise it's 1/10.
+#ifdef __AVR__
+#define TICK_RATE(num, den) const unsigned long tick_rate[2] __attribute__((__progmem__)) = { (num), (den) }
+#else
+#define TICK_RATE(num, den) const unsigned long tick_rate[2] = { (num), (den) }
+#endif
+
+
+// Instead of counting tenths-of-a-second themselves, the clocks (and
+// base.c) can ask to be called back after so many of them. The callback
+// happens inside doSleep() or doTick(), at the end of that tenth. A timer
+// can't be cancelled, but its callback can set it again. Setting one is
+// quick no matter how many are running, and so is the time they take to
+// keep track of. slots has to be at least 1 and less than 2^20.
+struct wheel_timer {
+  struct wheel_timer *next;
+  unsigned long expires;
+  unsigned long period;
+  void (*fire)(struct wheel_timer *);
+};
+
+// Call t->fire(t) once, slots tenths from now.
+void wheel_after(struct wheel_timer *t, unsigned long slots);
+
+// Call t->fire(t) every slots tenths, starting slots tenths from now.
+void wheel_every(struct wheel_timer *t, unsigned long slots);
+
+// How many tenths until a timer goes off (0 once it has).
+unsigned long wheel_left(const struct wheel_timer *t);
+
+#ifdef POWER_FAIL
+// Built with POWER_FAIL (see base.c), a clock can keep up to CHECKPOINT_SIZE
+// bytes of its state through a battery change by defining both of these.
+// checkpointSave() is called from the interrupt when the battery goes, to
+// fill in state. It has to be quick, and can't count on loop() having
+// finished whatever it was doing. Next time, before loop() is first called,
+// checkpointLoad() gets back what it saved. That's only if this same build
+// was running when the battery went, but there's no telling how long it was
+// out for.
+#define CHECKPOINT_SIZE (4)
+void checkpointSave(unsigned char *state);
+void checkpointLoad(const unsigned char *state);
+#endif
+
+// The ATtiny45 has 256 bytes of RAM. base.c takes about 70 of them (175
+// with DUAL_MOVEMENT, which adds the second stack and two jmp_bufs), and
+// the stack needs about 48 (the Makefile's STACK_RESERVE). The clock code
+// gets what's left, and keeps what's in its overlay to this. The Makefile
+// checks the lot with avr-size as it builds each image.
+#ifndef CLOCK_RAM_BUDGET
+#define CLOCK_RAM_BUDGET (64)
+#endif
+
+// Fails to compile if cond is false, with an error about the array called
+// name having a negative size. C99 has no _Static_assert.
+#define RAM_ASSERT(cond, name) typedef char name[(cond) ? 1 : -1]
+
+// A clock's buffers go in its overlay, which is a union of a struct for
+// each phase (or personality) that it goes through. Buffers in different
+// phases share the same RAM, so only the biggest phase counts:
+//
+//   OVERLAY(
+//     struct { unsigned char scratch[40]; } boot;
+//     struct { unsigned char queue[16]; unsigned char pool[8]; } run;
+//   );
+//
+// That's a static union called overlay, and overlay.boot.scratch starts at
+// the same place as overlay.run.queue. Nothing clears it between phases, so
+// a phase can't count on what it holds when it starts. A file only gets one,
+// and it won't compile if it's over CLOCK_RAM_BUDGET. Keeping big buffers in
+// here rather than on the stack also means they're counted.
+#define OVERLAY(...) \
+  static union { __VA_ARGS__ } overlay; \
+  RAM_ASSERT(sizeof(overlay) <= CLOCK_RAM_BUDGET, overlay_over_CLOCK_RAM_BUDGET)
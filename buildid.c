@@ -0,0 +1,216 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Stamps .hex files with a build ID and CRC, and checks what a chip reports
+ * back against them (see buildid.h).
+ *
+ * buildid [-s flash_size] [-i id] [-a dir] in.hex out.hex
+ *   Copies in.hex to out.hex with the trailer added at the end of flash.
+ *   The build ID is a hash of the time and the image, unless -i gives one.
+ *   'make all' builds several images a second, so the time alone would
+ *   give different ones the same ID. With -a, it also keeps a copy as
+ *   dir/{build ID}.hex, so that reflash can tell later what a chip running
+ *   that build has in its flash. It won't replace a different image
+ *   that's already there under the same ID.
+ *
+ * buildid -v file.hex
+ *   Reads the output of avrdude's terminal mode 'dump eeprom 70 6' from
+ *   stdin, and fails unless it's file.hex's build ID and CRC.
+ *
+ * buildid -p file.hex
+ *   Prints file.hex's build ID, length and CRC.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "buildid.h"
+
+#define MAX_FLASH (65536)
+
+static uint8_t image[MAX_FLASH], archived[MAX_FLASH];
+
+// 32 bit FNV-1a, to make a build ID out of the time and the image.
+static uint32_t fnv(uint32_t hash, const uint8_t *data, long length) {
+  for(long i = 0; i < length; i++)
+    hash = (hash ^ data[i]) * 16777619UL;
+  return hash;
+}
+
+static void put_record(FILE *f, unsigned int address, const uint8_t *data, unsigned int count) {
+  uint8_t sum = count + (address >> 8) + (address & 0xff);
+  fprintf(f, ":%02X%04X00", count, address);
+  for(unsigned int i = 0; i < count; i++) {
+    fprintf(f, "%02X", data[i]);
+    sum += data[i];
+  }
+  fprintf(f, "%02X\n", (uint8_t)-sum);
+}
+
+static int stamp(const char *in, const char *out, long flash_size, const uint32_t *given,
+  const char *archive) {
+  memset(image, 0xff, sizeof(image));
+  long length = build_read_hex(in, image, NULL, flash_size);
+  if (length < 0) return 1;
+  long trailer = flash_size - BUILD_TRAILER_SIZE;
+  if (length > trailer) {
+    fprintf(stderr, "%s is %ld bytes, which leaves no room for the build ID\n", in, length);
+    return 1;
+  }
+  uint16_t crc = build_crc(image, length);
+  uint32_t id;
+  if (given != NULL)
+    id = *given;
+  else {
+    time_t now = time(NULL);
+    id = fnv(fnv(2166136261UL, (const uint8_t *)&now, sizeof(now)), image, length);
+  }
+  uint8_t data[BUILD_TRAILER_SIZE] = {
+    id, id >> 8, id >> 16, id >> 24, length, length >> 8, crc, crc >> 8
+  };
+
+  char copy_path[512];
+  int keep = archive != NULL;
+  if (keep) {
+    // An image that's already archived under this ID has to be this one.
+    mkdir(archive, 0777);
+    snprintf(copy_path, sizeof(copy_path), "%s/%08lx.hex", archive, (unsigned long)id);
+    if (access(copy_path, F_OK) == 0) {
+      memcpy(image + trailer, data, sizeof(data));
+      memset(archived, 0xff, sizeof(archived));
+      if (build_read_hex(copy_path, archived, NULL, flash_size) < 0
+          || memcmp(image, archived, flash_size) != 0) {
+        fprintf(stderr, "%s is a different image with build ID %08lx - not replacing it\n",
+          copy_path, (unsigned long)id);
+        return 1;
+      }
+      keep = 0;
+    }
+  }
+
+  // Copy the records over, and add the trailer just before the end.
+  FILE *src = fopen(in, "r");
+  FILE *dst = fopen(out, "w");
+  if (src == NULL || dst == NULL) {
+    perror(src == NULL ? in : out);
+    if (src != NULL) fclose(src);
+    return 1;
+  }
+  FILE *copy = NULL;
+  if (keep && (copy = fopen(copy_path, "w")) == NULL) perror(copy_path);
+  char line[600];
+  while(fgets(line, sizeof(line), src) != NULL) {
+    if (strncmp(line, ":00000001", 9) == 0) break;
+    fputs(line, dst);
+    if (copy != NULL) fputs(line, copy);
+  }
+  put_record(dst, trailer, data, sizeof(data));
+  fputs(":00000001FF\n", dst);
+  if (copy != NULL) {
+    put_record(copy, trailer, data, sizeof(data));
+    fputs(":00000001FF\n", copy);
+    fclose(copy);
+  }
+  fclose(src);
+  if (fclose(dst) != 0) {
+    perror(out);
+    return 1;
+  }
+  printf("%s: build %08lx, %ld bytes, CRC %04x\n", out, (unsigned long)id, length, crc);
+  return 0;
+}
+
+// Find the trailer in a stamped file. Returns its address, or -1.
+static long find_trailer(const char *path) {
+  memset(image, 0xff, sizeof(image));
+  long end = build_read_hex(path, image, NULL, MAX_FLASH);
+  if (end < BUILD_TRAILER_SIZE) {
+    if (end >= 0) fprintf(stderr, "%s has no build ID\n", path);
+    return -1;
+  }
+  long trailer = end - BUILD_TRAILER_SIZE;
+  if (build_get16(image + trailer + 4) > trailer
+      || build_crc(image, build_get16(image + trailer + 4)) != build_get16(image + trailer + 6)) {
+    fprintf(stderr, "%s has no build ID\n", path);
+    return -1;
+  }
+  return trailer;
+}
+
+static int print(const char *path) {
+  long trailer = find_trailer(path);
+  if (trailer < 0) return 1;
+  printf("build %08lx, %u bytes, CRC %04x\n", (unsigned long)build_get32(image + trailer),
+    build_get16(image + trailer + 4), build_get16(image + trailer + 6));
+  return 0;
+}
+
+static int check(const char *path) {
+  long trailer = find_trailer(path);
+  if (trailer < 0) return 1;
+  uint8_t report[EE_BUILD_SIZE];
+  if (!build_read_dump(stdin, EE_BUILD_LOC, EE_BUILD_SIZE, report)) {
+    fprintf(stderr, "didn't get the chip's build report\n");
+    return 1;
+  }
+  uint32_t want_id = build_get32(image + trailer), got_id = build_get32(report);
+  uint16_t want_crc = build_get16(image + trailer + 6), got_crc = build_get16(report + 4);
+  if (got_id != want_id) {
+    fprintf(stderr, "chip is running build %08lx, not %08lx (or hasn't finished starting up)\n",
+      (unsigned long)got_id, (unsigned long)want_id);
+    return 1;
+  }
+  if (got_crc != want_crc) {
+    fprintf(stderr, "flash CRC is %04x, not %04x - flash it again\n", got_crc, want_crc);
+    return 1;
+  }
+  printf("build %08lx verified, CRC %04x\n", (unsigned long)got_id, got_crc);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  long flash_size = 4096;
+  uint32_t id;
+  int given = 0;
+  const char *archive = NULL;
+  int c;
+
+  while((c = getopt(argc, argv, "s:i:a:v:p:")) != -1) {
+    switch(c) {
+      case 'a': archive = optarg; break;
+      case 's': flash_size = strtol(optarg, NULL, 0); break;
+      case 'i': id = (uint32_t)strtoul(optarg, NULL, 0); given = 1; break;
+      case 'v': return check(optarg);
+      case 'p': return print(optarg);
+      default: goto usage;
+    }
+  }
+  if (argc - optind != 2 || flash_size <= BUILD_TRAILER_SIZE || flash_size > MAX_FLASH) goto usage;
+  return stamp(argv[optind], argv[optind + 1], flash_size, given ? &id : NULL, archive);
+
+usage:
+  fprintf(stderr, "usage: %s [-s flash_size] [-i id] [-a dir] in.hex out.hex | -v file.hex | -p file.hex\n", argv[0]);
+  return 1;
+}
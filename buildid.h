@@ -0,0 +1,146 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Reading the whole flash back after writing it takes as long as writing
+ * it, at the SPI clock a 32 kHz chip can take. So instead, every .hex gets
+ * a trailer in the last BUILD_TRAILER_SIZE bytes of flash (see buildid.c):
+ *
+ *   0-3 build ID (a hash of the time it was built and the image)
+ *   4-5 how many bytes of flash the image takes, before the trailer
+ *   6-7 the CRC of those bytes
+ *
+ * All little-endian. The first time base.c starts up with a build ID that
+ * isn't the one in EEPROM_BUILD_LOC, it works out the CRC of what's really
+ * in its flash, and writes the build ID and that CRC there. 'make flash'
+ * waits for that, reads those six bytes back, and checks them against the
+ * .hex file.
+ *
+ * The CRC is the CCITT one from avr-libc's <util/crc16.h>, starting from
+ * 0xffff. This is the C equivalent it documents, for the host tools.
+ */
+
+#define BUILD_TRAILER_SIZE (8)
+#define EE_BUILD_LOC (70)
+#define EE_BUILD_SIZE (6)
+
+#ifdef __AVR__
+#include <util/crc16.h>
+#define build_crc_update _crc_ccitt_update
+#else
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static inline uint16_t build_crc_update(uint16_t crc, uint8_t data) {
+  data ^= (uint8_t)crc;
+  data ^= data << 4;
+  return ((((uint16_t)data << 8) | (crc >> 8)) ^ (uint8_t)(data >> 4) ^ ((uint16_t)data << 3));
+}
+
+// Read an Intel HEX file into image (which is size bytes, and which the
+// caller fills with 0xff first). If used isn't NULL, it's set to 1 for every
+// byte that's in the file. Returns one past the highest address written, or
+// -1 if the file is bad or doesn't fit.
+static inline long build_read_hex(const char *path, uint8_t *image, uint8_t *used, long size) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    perror(path);
+    return -1;
+  }
+  char line[600];
+  long end = 0;
+  int line_number = 0;
+  while(fgets(line, sizeof(line), f) != NULL) {
+    line_number++;
+    if (line[0] != ':') continue;
+    unsigned int count, address, type, byte;
+    uint8_t sum = 0;
+    if (sscanf(line + 1, "%2x%4x%2x", &count, &address, &type) != 3
+        || strlen(line) < 11 + 2 * count) {
+      fprintf(stderr, "%s:%d: bad record\n", path, line_number);
+      fclose(f);
+      return -1;
+    }
+    for(unsigned int i = 0; i < count + 5; i++) {
+      sscanf(line + 1 + 2 * i, "%2x", &byte);
+      sum += byte;
+      if (type == 0 && i >= 4 && i < count + 4) {
+        long at = address + i - 4;
+        if (at >= size) {
+          fprintf(stderr, "%s:%d: address %04lx doesn't fit\n", path, line_number, at);
+          fclose(f);
+          return -1;
+        }
+        image[at] = byte;
+        if (used != NULL) used[at] = 1;
+        if (at + 1 > end) end = at + 1;
+      }
+    }
+    if (sum != 0) {
+      fprintf(stderr, "%s:%d: bad checksum\n", path, line_number);
+      fclose(f);
+      return -1;
+    }
+    if (type == 1) break;
+    if ((type == 2 || type == 4) && (count != 2 || strncmp(line + 9, "0000", 4) != 0)) {
+      fprintf(stderr, "%s:%d: extended addresses aren't supported\n", path, line_number);
+      fclose(f);
+      return -1;
+    }
+  }
+  fclose(f);
+  return end;
+}
+
+// The CRC of the first length bytes of image.
+static inline uint16_t build_crc(const uint8_t *image, long length) {
+  uint16_t crc = 0xffff;
+  for(long i = 0; i < length; i++) crc = build_crc_update(crc, image[i]);
+  return crc;
+}
+
+// Pick out the bytes from address to address + length - 1 from the output of
+// avrdude's terminal mode 'dump', whose lines look like
+// 0046  12 34 56 78 9a bc                                 |.4Vx..          |
+// Returns whether it got all of them.
+static inline int build_read_dump(FILE *f, long address, int length, uint8_t *out) {
+  unsigned long have = 0;
+  char line[256];
+  while(fgets(line, sizeof(line), f) != NULL) {
+    unsigned int at, byte;
+    int used;
+    if (sscanf(line, "%4x%n", &at, &used) != 1 || used != 4 || line[4] != ' ') continue;
+    char *p = line + 4;
+    while(*p != '\0' && *p != '|' && sscanf(p, " %2x%n", &byte, &used) == 1) {
+      if (at >= address && at < address + length) {
+        out[at - address] = byte;
+        have |= 1UL << (at - address);
+      }
+      at++;
+      p += used;
+    }
+  }
+  return have == (1UL << length) - 1;
+}
+
+#define build_get16(p) ((uint16_t)((p)[0] | ((p)[1] << 8)))
+#define build_get32(p) ((uint32_t)build_get16(p) | ((uint32_t)build_get16((p) + 2) << 16))
+#endif
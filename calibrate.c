@@ -26,19 +26,14 @@
 
 #include <avr/io.h>
 #include <avr/cpufunc.h>
-#include <avr/power.h>
+
+#include "lowpower.h"
 
 void main() {
-  ADCSRA = 0; // DIE, ADC!!! DIE!!!
-  ACSR = _BV(ACD); // Turn off analog comparator - but was it ever on anyway?
-  power_adc_disable();
-  power_usi_disable();
-  power_timer1_disable();
+  lowPowerInit(); // everything off that can be, and all our pins low
   TCCR0A = _BV(COM0A0) | _BV(WGM01); // mode 2 - CTC, toggle OC0A
   TCCR0B = _BV(CS00); // prescale = 1 (none)
   OCR0A = 0; // as fast as possible
-  DDRB = _BV(DDB0) | _BV(DDB1) | _BV(DDB2); // all our pins are output.
-  PORTB = 0; // Initialize all pins low.
 
   // And we're done.
   while(1);
@@ -0,0 +1,111 @@
+# Crazy Clock for Arduino
+# Copyright 2014 Nicholas W. Sayer
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+"""
+Python access to the fast host simulator, through simlib.h.
+
+    import clocksim
+    crazy = clocksim.load("crazy", LIST_LENGTH=16)
+    ticks, phase = crazy.run(slots=10 * 365 * 864000, seed=1, trim=0)
+
+ticks is the slot (tenth-of-a-second) of every tick, and phase is how far
+ahead of true time the hands were just after each one, in ticks at the
+clock's own rate (seconds, for most of them). They're
+NumPy arrays (uint32 and float32) if NumPy is around, and memoryviews if not.
+Either way they're views straight onto the simulator's buffers - nothing is
+copied - and the buffers are let go when the last view of them is.
+
+load() builds libsim-{clock}.so (with 'make pysim') the first time each
+combination of clock and compile-time knobs is asked for.
+
+A run is one call into C, so it takes as long as the simulator does: about
+three seconds a simulated year on one core, a bit less from SIM_CACHE.
+"""
+
+import ctypes
+import hashlib
+import os
+import subprocess
+
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+
+class _Result(ctypes.Structure):
+    _fields_ = [
+        ("slots", ctypes.c_uint64),
+        ("ticks", ctypes.c_uint64),
+        ("tick_slot", ctypes.POINTER(ctypes.c_uint32)),
+        ("phase", ctypes.POINTER(ctypes.c_float)),
+        ("mapping", ctypes.c_void_p),
+        ("mapped", ctypes.c_size_t),
+    ]
+
+
+class _Buffers:
+    # Owns one simlib_result. The arrays handed out keep this alive.
+    def __init__(self, lib, result):
+        self.lib = lib
+        self.result = result
+
+    def __del__(self):
+        self.lib.simlib_free(ctypes.byref(self.result))
+
+
+def _view(buffers, pointer, ctype, code, count):
+    array = (ctype * count).from_address(ctypes.addressof(pointer.contents)) if count else (ctype * 0)()
+    array._buffers = buffers  # keep the mapping alive as long as the view is
+    if numpy is not None:
+        return numpy.ctypeslib.as_array(array)
+    # ctypes labels its buffers '<I' and so on, which memoryview won't index.
+    # Recasting through bytes gives it the native format code it understands.
+    return memoryview(array).cast("B").cast(code)
+
+
+class Clock:
+    def __init__(self, path):
+        self.lib = ctypes.CDLL(path)
+        self.lib.simlib_run.argtypes = [ctypes.c_uint64, ctypes.c_uint32, ctypes.c_int,
+                                        ctypes.POINTER(_Result)]
+        self.lib.simlib_run.restype = ctypes.c_int
+        self.lib.simlib_free.argtypes = [ctypes.POINTER(_Result)]
+        self.lib.simlib_free.restype = None
+
+    def run(self, slots, seed=1, trim=0):
+        result = _Result()
+        if self.lib.simlib_run(slots, seed, trim, ctypes.byref(result)) != 0:
+            raise RuntimeError("simulation failed")
+        buffers = _Buffers(self.lib, result)
+        count = result.ticks
+        return (_view(buffers, result.tick_slot, ctypes.c_uint32, "I", count),
+                _view(buffers, result.phase, ctypes.c_float, "f", count))
+
+
+def load(clock, **defines):
+    defs = " ".join("-D%s=%s" % (k, v) for k, v in sorted(defines.items()))
+    name = "libsim-" + clock
+    if defs:
+        name += "-" + hashlib.sha1(defs.encode()).hexdigest()[:8]
+    path = os.path.join(HERE, name + ".so")
+    if not os.path.exists(path):
+        subprocess.check_call(["make", "-s", "-C", HERE, "pysim", "TYPE=" + clock,
+                               "DEFS=" + defs, "PYSIM_LIB=" + name + ".so"])
+    return Clock(path)
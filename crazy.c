@@ -27,6 +27,22 @@
 #include <string.h>
 #include "base.h"
 
+// With PERMUTATION_BANK defined, rather than building and shuffling each
+// list from scratch, we pick one from a bank of precomputed lists in flash
+// (see permbank.c). That costs 2 random bytes instead of about 18, and
+// BANK_ENTRIES * BANK_ENTRY_BYTES of flash.
+#ifdef PERMUTATION_BANK
+#if defined(UNIT_TEST)
+// On *nix, there is no PROGMEM. Just make it go away and turn the
+// pgm_read operations into just pointer derefs.
+#define PROGMEM
+#define pgm_read_byte(x) *(x)
+#else
+#include <avr/pgmspace.h>
+#endif
+#include "crazy_bank.h"
+#endif
+
 // These are the values for the randomly constructed instruction list
 #define SLOW_SPEED 1
 #define NORMAL_SPEED 2
@@ -34,7 +50,18 @@
 
 // This *must* be even! It's also a bit of a balancing act between allowing
 // for whackiness, but not allowing the clock to drift too far.
+#ifndef LIST_LENGTH
 #define LIST_LENGTH 12
+#endif
+
+// Each step of the list lasts a random number of seconds: a multiple of 6
+// from STEP_MIN * 6 to (STEP_MIN + STEP_CHOICES - 1) * 6.
+#ifndef STEP_MIN
+#define STEP_MIN 2
+#endif
+#ifndef STEP_CHOICES
+#define STEP_CHOICES 5
+#endif
 
 // Picking random numbers takes so long (at our slow clock speed) that
 // we can only afford to pick one every tenth of a second. So we're going
@@ -47,9 +74,21 @@
 
 #define BUF_LEN (2 * LIST_LENGTH)
 
+#if defined(PERMUTATION_BANK) && BANK_LIST_LENGTH != LIST_LENGTH
+#error crazy_bank.h was made for a different LIST_LENGTH. Remake it with 'make crazy_bank.h'.
+#endif
+
 static unsigned char buf_ptr = 0;
-static unsigned char random_buf[BUF_LEN];
-static unsigned char instruction_list_stage[LIST_LENGTH];
+OVERLAY(
+  struct {
+    unsigned char random_buf[BUF_LEN];
+    unsigned char instruction_list_stage[LIST_LENGTH];
+    unsigned char instruction_list[LIST_LENGTH];
+  } run;
+);
+#define random_buf (overlay.run.random_buf)
+#define instruction_list_stage (overlay.run.instruction_list_stage)
+#define instruction_list (overlay.run.instruction_list)
 
 static unsigned char buf_random() {
   if (buf_ptr > BUF_LEN - 4) return 1; // buffer is full
@@ -76,6 +115,32 @@ static void our_tick() {
   doTick();
 }
 
+#ifdef PERMUTATION_BANK
+// Pick an entry, start it at a random place in the list and maybe swap
+// slow for fast. Neither of those changes the count of slow and fast
+// instructions, so the list still nets the right number of ticks.
+// q_random() is only 31 bits, so one byte in four out of the cache never
+// has its top bit set, and which one that is depends on where the cache
+// happens to be. So take a fresh one and use its bottom two bytes. That's
+// no more work than one buf_random().
+static void bank_list() {
+  unsigned long val = q_random();
+  unsigned char entry = (unsigned char)val & (BANK_ENTRIES - 1);
+  unsigned char spin = (unsigned char)(val >> 8);
+  unsigned char swap = (spin & 0x80)?(SLOW_SPEED ^ FAST_SPEED):0;
+  unsigned char pos = (spin & 0x7f) % LIST_LENGTH;
+  const unsigned char *entry_ptr = bank_table + entry * BANK_ENTRY_BYTES;
+  unsigned char bits = 0;
+  for(unsigned char i = 0; i < LIST_LENGTH; i++) {
+    if ((i & 3) == 0) bits = pgm_read_byte(entry_ptr++);
+    unsigned char op = bits & 3;
+    bits >>= 2;
+    if (op != NORMAL_SPEED) op ^= swap;
+    instruction_list_stage[pos] = op;
+    if (++pos >= LIST_LENGTH) pos = 0;
+  }
+}
+#else
 // gcc -Os turns these switch statements into data table initialization.
 // That makes a data segment, because AVR-GCC is too stupid to put that
 // constant data into flash. So for these two methods, back down the
@@ -133,9 +198,9 @@ static void shuffle_list(int which) {
   }
 }
 #pragma GCC pop_options
+#endif
 
 void loop() {
-  unsigned char instruction_list[LIST_LENGTH];
   unsigned char place_in_list = LIST_LENGTH; // force a reset.
   unsigned char time_per_step = 0; // This is moot - avoids an incorrect warning
   unsigned char time_in_step = 0; // This is also moot - avoids another incorrect warning
@@ -146,10 +211,14 @@ void loop() {
   while (!buf_random()) ;
 
   // build the initial list. The clock hasn't started yet, so it doesn't matter how long this takes. 
+#ifdef PERMUTATION_BANK
+  bank_list();
+#else
   build_list(0);
   build_list(1);
   shuffle_list(0);
   shuffle_list(1);
+#endif
 
   // Now we start the clock for real.
   while(1){
@@ -159,7 +228,7 @@ void loop() {
       // This must be a multiple of 3 AND be even!
       // It also should be long enough to establish a pattern
       // before changing.
-      time_per_step = ((our_random() % 5) + 2) * 6; // 12 - 36
+      time_per_step = ((our_random() % STEP_CHOICES) + STEP_MIN) * 6; // 12 - 36
       place_in_list = 0;
       time_in_step = 0;
       rebuilding_state = 1;
@@ -175,6 +244,13 @@ void loop() {
               // empty after the bootstrapping. 9 sleeps should be plenty to replenish
               // it (since we gain 4 random numbers every time).
               break;
+#ifdef PERMUTATION_BANK
+      case 2:
+          bank_list();
+          // all done.
+          rebuilding_state = 0;
+          break;
+#else
       case 2:
           build_list(0);
           break;
@@ -189,6 +265,7 @@ void loop() {
           // all done.
           rebuilding_state = 0;
           break;
+#endif
     }
     if (rebuilding_state != 0) rebuilding_state++;
     
@@ -0,0 +1,73 @@
+// Generated by permbank.c ('make crazy_bank.h') - don't edit.
+// 64 entries of 12 elements, 192 bytes of flash.
+
+#define BANK_LIST_LENGTH (12)
+#define BANK_ENTRIES (64)
+#define BANK_ENTRY_BYTES (3)
+
+PROGMEM const unsigned char bank_table[] = {
+  0xaa, 0xaa, 0xaa, // 0 slow/fast pairs
+  0x6a, 0xae, 0xaa, // 1 slow/fast pairs
+  0x6a, 0xaa, 0xba, // 1 slow/fast pairs
+  0xaa, 0x9a, 0xba, // 1 slow/fast pairs
+  0xaa, 0xa6, 0xab, // 1 slow/fast pairs
+  0xda, 0xaa, 0xaa, // 1 slow/fast pairs
+  0xa9, 0xba, 0xaa, // 1 slow/fast pairs
+  0xea, 0xb6, 0xa6, // 2 slow/fast pairs
+  0xa6, 0xea, 0x7a, // 2 slow/fast pairs
+  0xaf, 0x5a, 0xaa, // 2 slow/fast pairs
+  0xaa, 0x99, 0xee, // 2 slow/fast pairs
+  0x9d, 0xaa, 0xab, // 2 slow/fast pairs
+  0xaa, 0xb9, 0x9b, // 2 slow/fast pairs
+  0x9e, 0xaa, 0xad, // 2 slow/fast pairs
+  0xa6, 0xba, 0x6e, // 2 slow/fast pairs
+  0x5a, 0xbe, 0xaa, // 2 slow/fast pairs
+  0xaa, 0x66, 0xeb, // 2 slow/fast pairs
+  0x7a, 0xaa, 0x6b, // 2 slow/fast pairs
+  0x6a, 0xea, 0xe9, // 2 slow/fast pairs
+  0xa6, 0xba, 0xda, // 2 slow/fast pairs
+  0x5a, 0xaa, 0xfa, // 2 slow/fast pairs
+  0xe6, 0xea, 0xa6, // 2 slow/fast pairs
+  0xba, 0x6d, 0x7a, // 3 slow/fast pairs
+  0xaa, 0xe9, 0xf5, // 3 slow/fast pairs
+  0x66, 0xe9, 0xfa, // 3 slow/fast pairs
+  0xb6, 0xb6, 0xa7, // 3 slow/fast pairs
+  0xae, 0x5f, 0x6a, // 3 slow/fast pairs
+  0xde, 0xa6, 0xe9, // 3 slow/fast pairs
+  0xb9, 0xfa, 0x69, // 3 slow/fast pairs
+  0xda, 0x76, 0xae, // 3 slow/fast pairs
+  0xe6, 0xbb, 0xa5, // 3 slow/fast pairs
+  0xba, 0xed, 0xa5, // 3 slow/fast pairs
+  0x76, 0x9a, 0xaf, // 3 slow/fast pairs
+  0x69, 0xbb, 0x9e, // 3 slow/fast pairs
+  0xd6, 0xe7, 0xaa, // 3 slow/fast pairs
+  0x96, 0x6f, 0xba, // 3 slow/fast pairs
+  0xe6, 0xe9, 0xad, // 3 slow/fast pairs
+  0xaf, 0x66, 0xad, // 3 slow/fast pairs
+  0x9e, 0xd9, 0xba, // 3 slow/fast pairs
+  0xaa, 0xb9, 0x5f, // 3 slow/fast pairs
+  0xb7, 0x9b, 0x6a, // 3 slow/fast pairs
+  0xef, 0x6a, 0x99, // 3 slow/fast pairs
+  0xad, 0x5f, 0xe6, // 4 slow/fast pairs
+  0x5b, 0xda, 0xb7, // 4 slow/fast pairs
+  0x9a, 0xe7, 0xf5, // 4 slow/fast pairs
+  0xef, 0x5a, 0x67, // 4 slow/fast pairs
+  0xd5, 0xe9, 0xaf, // 4 slow/fast pairs
+  0xd9, 0x6e, 0xde, // 4 slow/fast pairs
+  0xbe, 0x5a, 0x7d, // 4 slow/fast pairs
+  0xe9, 0xb5, 0xf9, // 4 slow/fast pairs
+  0xf7, 0x6e, 0x69, // 4 slow/fast pairs
+  0x5a, 0xde, 0xdb, // 4 slow/fast pairs
+  0xe6, 0xf9, 0xb5, // 4 slow/fast pairs
+  0x65, 0xde, 0xeb, // 4 slow/fast pairs
+  0xad, 0xf7, 0x66, // 4 slow/fast pairs
+  0xdb, 0x9a, 0x5f, // 4 slow/fast pairs
+  0xeb, 0xe5, 0xd9, // 4 slow/fast pairs
+  0x5e, 0xd6, 0xf7, // 5 slow/fast pairs
+  0xf9, 0xd6, 0x7d, // 5 slow/fast pairs
+  0x75, 0x7e, 0xdb, // 5 slow/fast pairs
+  0x75, 0xfb, 0x67, // 5 slow/fast pairs
+  0xf5, 0xda, 0x7d, // 5 slow/fast pairs
+  0xd5, 0xdb, 0xe7, // 5 slow/fast pairs
+  0x77, 0x57, 0xfd, // 6 slow/fast pairs
+};
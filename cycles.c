@@ -0,0 +1,86 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Not a clock: an image that times the building blocks of one, for
+ * 'make cycles'. It's built like any other, with base.c and the same
+ * CFLAGS, and run in emu with -b (see emu.c), which counts the cycles
+ * between the marks this writes to GPIOR0. emu times the Timer0 interrupt
+ * by itself, and 'make cycles' runs this twice, once with a trim, since
+ * that's a different path through it.
+ *
+ * The inputs come from, and the results go to, volatiles, so the compiler
+ * can't fold them away or move the work outside of the marks. Mark 1 has
+ * nothing in it, to show what the marks themselves cost.
+ *
+ * The names that go with the marks are in cycles.ref, which has to be kept
+ * in step with this.
+ */
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+
+#include "base.h"
+
+#define MARK_EMPTY (1)
+#define MARK_Q_RANDOM (2)
+#define MARK_MODULO (3)
+#define MARK_EEPROM_SAME (4)
+#define MARK_DO_TICK (5)
+#define MARK_DO_SLEEP (6)
+#define MARK_HARMONIC_TERM (7)
+
+#define BENCH(mark, what) do { GPIOR0 = (mark); what; GPIOR0 = 0; } while(0)
+
+// The seed. It's only rewritten once a day, so it stays the same here.
+#define EE_SAME ((uint32_t *)0)
+
+static volatile unsigned long in, out;
+
+// One term of a harmonic.h clock's series, which sundial and hightide work
+// out one of a tenth. The angle moves on each time round, so that both
+// directions through the sine table get timed. harmonic.h's own loop() is
+// kept out of the way.
+#define HARMONIC_MEAN (0)
+#define HARMONIC_STEP (0)
+#define HARMONIC_SHIFT (4)
+#define HARMONIC_MULTIPLES { 3 }
+#define HARMONIC_PHASES { 0 }
+#define HARMONIC_COEFFICIENTS { 20000 }
+#define loop harmonic_loop
+#include "harmonic.h"
+#undef loop
+
+static volatile unsigned char term;
+static volatile uint32_t angle;
+
+void loop() {
+  BENCH(MARK_EMPTY, );
+  BENCH(MARK_Q_RANDOM, out = q_random());
+  in = out;
+  // What the clocks do with q_random() all the time - it's a 32 bit divide.
+  BENCH(MARK_MODULO, out = in % IRQS_PER_SECOND);
+  in = eeprom_read_dword(EE_SAME);
+  BENCH(MARK_EEPROM_SAME, eeprom_update_dword(EE_SAME, in));
+  BENCH(MARK_DO_TICK, doTick());
+  BENCH(MARK_DO_SLEEP, doSleep());
+  angle += 0x2a3b4c5dUL;
+  BENCH(MARK_HARMONIC_TERM, out = harmonic_term(term, angle));
+}
@@ -0,0 +1,651 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Checks that a clock still behaves the same, statistically, as it did when
+ * its baseline was saved, for 'make distcheck'. Comparing tick streams
+ * only works until something changes how the random numbers are drawn, and
+ * then every one of them is different even if the clock is doing just
+ * what it always did. This compares what they look like instead.
+ *
+ * sim-dist-{clock} [-n slots] [-s seed] [-k count] [-r num/den] [-j jobs]
+ *     [-p pattern] [-a alpha] [-w] baseline
+ *
+ * It runs count seeds (default 32, made from seed, see run_seed()) for slots
+ * (default 10 days) each, in parallel, and measures:
+ *
+ *   gaps     how many of each gap between ticks there were (see metrics.h).
+ *   high     how far ahead the hands got in each hour, and...
+ *   low      ...how far behind, in hundredths of a second.
+ *   pattern  how many times an hour the clock did its thing (-p):
+ *            "songs" are runs of gaps that aren't a second, which is what
+ *            tuney.c plays, and "stutters" are gaps of 2 tenths or less,
+ *            which is vetinari.c's extra tick. There isn't one by default.
+ *
+ * With -w, that's written to baseline. Otherwise, each is compared with
+ * baseline's: gaps and pattern with a two-sample chi-squared test, and high
+ * and low with a two-sample Kolmogorov-Smirnov test. Each prints a line
+ *   name: stat=... p=...
+ * and it fails if any p is under alpha divided by how many tests there
+ * are (alpha is 0.01 by default). So a clock that hasn't changed fails
+ * one time in 1/alpha at most, whatever it's doing.
+ *
+ * Neither test is meant for samples that depend on each other, and the
+ * gaps and hours of one seed do. A song puts the same number into half a
+ * dozen gaps at once, and a walk (see walk.h) that's behind this hour
+ * will be behind the next. The seeds are independent, though, so how much
+ * they differ from each other is how sure the tests can be. The chi-squared
+ * test is scaled to the covariance of the bins between seeds, in both
+ * samples, and its degrees of freedom cut to match (Rao and Scott's second
+ * order correction). That covariance is only an estimate from a few dozen
+ * seeds, so the result is taken as an F statistic. For the KS test, the
+ * sample sizes are divided by how much more the seeds' means spread than
+ * they would if every hour were drawn on its own (the design effect), the
+ * bigger of the two samples'.
+ *
+ * The baseline keeps each seed's histograms for that. If the seeds and
+ * everything else are the same as the baseline's, then so are the samples,
+ * and p is 1.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "metrics.h"
+
+#define SLOTS_PER_HOUR (36000ULL)
+// Bins of a chi-squared test are put together until there's at least this
+// much in each.
+#define MIN_BIN (20)
+// How many different values a KS sample can have.
+#define MAX_VALUES (100000)
+
+enum pattern { PATTERN_NONE, PATTERN_SONGS, PATTERN_STUTTERS, PATTERNS };
+static const char *pattern_names[PATTERNS] = { "none", "songs", "stutters" };
+
+struct options {
+  unsigned long long slots;
+  unsigned long seed;
+  unsigned long rate_num, rate_den;
+  enum pattern pattern;
+  unsigned long hours; // in each seed's run
+  unsigned int count;
+  // What each seed came up with.
+  unsigned long long *gaps; // [count][METRICS_MAX_GAP]
+  float *high, *low, *patterns; // [count][hours]
+  unsigned int done;
+};
+
+// What a seed's run is keeping track of, and then its results.
+struct dist {
+  const struct options *opt;
+  unsigned long long ticks, last, hour;
+  double high, low;
+  unsigned int events;
+  int off; // in a run of gaps that aren't a second
+  unsigned long long *gaps;
+  float *out_high, *out_low, *out_patterns;
+};
+
+static double drift(const struct dist *d, unsigned long long slot) {
+  return (double)d->ticks - (double)slot * d->opt->rate_num / d->opt->rate_den;
+}
+
+// The hands are at drift(slot), and every hour up to slot is over.
+static void drift_at(struct dist *d, unsigned long long slot) {
+  while(d->hour < d->opt->hours && slot >= (d->hour + 1) * SLOTS_PER_HOUR) {
+    double edge = drift(d, (d->hour + 1) * SLOTS_PER_HOUR);
+    if (edge > d->high) d->high = edge;
+    if (edge < d->low) d->low = edge;
+    d->out_high[d->hour] = d->high;
+    d->out_low[d->hour] = d->low;
+    d->out_patterns[d->hour] = d->events;
+    d->hour++;
+    d->high = d->low = edge;
+    d->events = 0;
+  }
+  double x = drift(d, slot);
+  if (x > d->high) d->high = x;
+  if (x < d->low) d->low = x;
+}
+
+static void tick(unsigned long long slot, void *arg) {
+  struct dist *d = (struct dist *)arg;
+  drift_at(d, slot); // just before the tick...
+  if (d->ticks != 0) {
+    unsigned long long gap = slot - d->last;
+    d->gaps[gap >= METRICS_MAX_GAP ? METRICS_MAX_GAP - 1 : gap]++;
+    int off = gap * d->opt->rate_num != d->opt->rate_den;
+    if (d->opt->pattern == PATTERN_SONGS && off && !d->off) d->events++;
+    if (d->opt->pattern == PATTERN_STUTTERS && gap <= 2) d->events++;
+    d->off = off;
+  }
+  d->last = slot;
+  d->ticks++;
+  drift_at(d, slot); // ...and just after.
+}
+
+static size_t out_size(const struct options *opt) {
+  return sizeof(unsigned long long) * METRICS_MAX_GAP + sizeof(float) * 3 * opt->hours;
+}
+
+// The seed for run i. q_random() is a multiplicative generator, so seed
+// s + 1's stream is s's plus the same offset at each step, and a run of
+// seeds in a row isn't as independent as the tests need. Mixing them up
+// (with splitmix64's finalizer) takes care of that.
+static unsigned long run_seed(unsigned long seed, unsigned int i) {
+  unsigned long long x = (unsigned long long)seed << 32 | i;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return 1 + x % 0x7ffffffeUL;
+}
+
+static void work(unsigned int i, void *out, void *arg) {
+  struct options *opt = (struct options *)arg;
+  struct dist d;
+  struct sim_run run;
+
+  memset(out, 0, out_size(opt));
+  memset(&d, 0, sizeof(d));
+  d.opt = opt;
+  d.gaps = (unsigned long long *)out;
+  d.out_high = (float *)(d.gaps + METRICS_MAX_GAP);
+  d.out_low = d.out_high + opt->hours;
+  d.out_patterns = d.out_low + opt->hours;
+  memset(&run, 0, sizeof(run));
+  run.slots = opt->slots;
+  run.seed = run_seed(opt->seed, i);
+  run.tick = tick;
+  run.arg = &d;
+  sim_run(&run);
+  drift_at(&d, run.slots);
+}
+
+static void done(unsigned int i, void *out, void *arg) {
+  struct options *opt = (struct options *)arg;
+  const unsigned long long *gaps = (const unsigned long long *)out;
+  const float *f = (const float *)(gaps + METRICS_MAX_GAP);
+  size_t hours = opt->hours;
+  memcpy(opt->gaps + i * METRICS_MAX_GAP, gaps, sizeof(*gaps) * METRICS_MAX_GAP);
+  memcpy(opt->high + i * hours, f, sizeof(float) * hours);
+  memcpy(opt->low + i * hours, f + hours, sizeof(float) * hours);
+  memcpy(opt->patterns + i * hours, f + 2 * hours, sizeof(float) * hours);
+  opt->done++;
+}
+
+// Samples
+
+// A histogram for each seed, as a list of how many times each seed had
+// each value, leaving out the ones it never had.
+struct entry {
+  unsigned int seed;
+  long value;
+  double count;
+};
+struct hist {
+  unsigned int seeds, n;
+  struct entry *e;
+};
+
+static void hist_add(struct hist *h, unsigned int seed, long value, double count) {
+  if (count == 0) return;
+  h->e = realloc(h->e, sizeof(*h->e) * (h->n + 1));
+  h->e[h->n].seed = seed;
+  h->e[h->n].value = value;
+  h->e[h->n++].count = count;
+  if (seed >= h->seeds) h->seeds = seed + 1;
+}
+
+// All of the samples of a KS test, as how many times each value came up,
+// in order of value, and its design effect.
+struct sample {
+  unsigned int n;
+  long value[MAX_VALUES];
+  double count[MAX_VALUES];
+  double deff;
+};
+
+static int cmp_long(const void *a, const void *b) {
+  long x = *(const long *)a, y = *(const long *)b;
+  return (x > y) - (x < y);
+}
+
+// x is seeds runs of hours each.
+static void sample_from(struct sample *s, const float *x, unsigned int seeds, unsigned long hours) {
+  size_t n = (size_t)seeds * hours;
+  long *v = malloc(n * sizeof(*v));
+  double sum = 0, sum2 = 0, means = 0, means2 = 0;
+  for(unsigned int k = 0; k < seeds; k++) {
+    double m = 0;
+    for(unsigned long j = 0; j < hours; j++) {
+      long h = lround(x[k * hours + j] * 100);
+      v[k * hours + j] = h;
+      m += h;
+      sum += h;
+      sum2 += (double)h * h;
+    }
+    m /= hours;
+    means += m;
+    means2 += m * m;
+  }
+  double var = (sum2 - sum * sum / n) / (n - 1);
+  double var_means = (means2 - means * means / seeds) / (seeds - 1);
+  s->deff = var > 0 ? var_means * hours / var : 1;
+
+  qsort(v, n, sizeof(*v), cmp_long);
+  s->n = 0;
+  for(size_t i = 0; i < n; i++) {
+    if (s->n != 0 && s->value[s->n - 1] == v[i])
+      s->count[s->n - 1]++;
+    else if (s->n < MAX_VALUES) {
+      s->value[s->n] = v[i];
+      s->count[s->n++] = 1;
+    }
+  }
+  free(v);
+}
+
+// Statistics
+
+// The regularized incomplete beta function I_x(a, b), which gives the F
+// distribution's tail: P(F > f with d1 and d2 degrees of freedom) is
+// I_x(d2 / 2, d1 / 2) with x = d2 / (d2 + d1 * f).
+static double beta_i(double a, double b, double x) {
+  if (x <= 0) return 0;
+  if (x >= 1) return 1;
+  // The continued fraction converges quickly on this side.
+  if (x > (a + 1) / (a + b + 2)) return 1 - beta_i(b, a, 1 - x);
+  double front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) + b * log(1 - x));
+  // Lentz's method.
+  double c = 1, d = 1 - (a + b) * x / (a + 1);
+  if (fabs(d) < 1e-300) d = 1e-300;
+  d = 1 / d;
+  double h = d;
+  for(int m = 1; m < 10000; m++) {
+    for(int odd = 0; odd < 2; odd++) {
+      double an = odd ? -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1))
+        : m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m));
+      d = 1 + an * d;
+      if (fabs(d) < 1e-300) d = 1e-300;
+      c = 1 + an / c;
+      if (fabs(c) < 1e-300) c = 1e-300;
+      d = 1 / d;
+      h *= d * c;
+    }
+    if (fabs(d * c - 1) < 1e-15) break;
+  }
+  return front * h / a;
+}
+
+// The Kolmogorov distribution's tail, P(K > lambda).
+static double ks_q(double lambda) {
+  if (lambda < 0.2) return 1;
+  double sum = 0;
+  for(int j = 1; j <= 100; j++) {
+    double term = 2 * ((j & 1) ? 1 : -1) * exp(-2.0 * j * j * lambda * lambda);
+    sum += term;
+    if (fabs(term) < 1e-12) break;
+  }
+  return sum < 0 ? 0 : sum > 1 ? 1 : sum;
+}
+
+// The bins' values, from both a and b, in order.
+static unsigned int all_values(const struct hist *a, const struct hist *b, long **values) {
+  long *v = malloc(sizeof(long) * (a->n + b->n + 1));
+  unsigned int n = 0;
+  for(unsigned int i = 0; i < a->n; i++) v[n++] = a->e[i].value;
+  for(unsigned int i = 0; i < b->n; i++) v[n++] = b->e[i].value;
+  qsort(v, n, sizeof(long), cmp_long);
+  unsigned int u = 0;
+  for(unsigned int i = 0; i < n; i++)
+    if (u == 0 || v[u - 1] != v[i]) v[u++] = v[i];
+  *values = v;
+  return u;
+}
+
+static unsigned int value_at(long value, const long *values, unsigned int n) {
+  return (const long *)bsearch(&value, values, n, sizeof(long), cmp_long) - values;
+}
+
+// h's seeds, as a table of [seed][group].
+static double *table(const struct hist *h, const long *values, unsigned int n,
+    const unsigned int *groups, unsigned int ngroups) {
+  double *t = calloc((size_t)h->seeds * ngroups, sizeof(double));
+  for(unsigned int i = 0; i < h->n; i++)
+    t[(size_t)h->e[i].seed * ngroups + groups[value_at(h->e[i].value, values, n)]] += h->e[i].count;
+  return t;
+}
+
+// Adds the covariance of the proportions in t of the first g groups, all
+// of t being total, to v[g][g], from how t's seeds differ.
+static void covariance(const double *t, unsigned int seeds, unsigned int ngroups, double total,
+    double *v) {
+  unsigned int g = ngroups - 1;
+  double *p = calloc(ngroups, sizeof(double)), *r = malloc(sizeof(double) * ngroups);
+  for(unsigned int k = 0; k < seeds; k++)
+    for(unsigned int j = 0; j < ngroups; j++) p[j] += t[k * ngroups + j] / total;
+  for(unsigned int k = 0; k < seeds; k++) {
+    double m = 0;
+    for(unsigned int j = 0; j < ngroups; j++) m += t[k * ngroups + j];
+    for(unsigned int j = 0; j < g; j++) r[j] = (t[k * ngroups + j] - p[j] * m) / total;
+    for(unsigned int i = 0; i < g; i++)
+      for(unsigned int j = 0; j < g; j++) v[i * g + j] += r[i] * r[j] * seeds / (seeds - 1);
+  }
+  free(p);
+  free(r);
+}
+
+// Two-sample chi-squared of a against b.
+static double chi2_test(const char *name, const struct hist *a, const struct hist *b) {
+  long *values;
+  unsigned int n = all_values(a, b, &values);
+  double *both = calloc(n + 1, sizeof(double));
+  for(unsigned int i = 0; i < a->n; i++) both[value_at(a->e[i].value, values, n)] += a->e[i].count;
+  for(unsigned int i = 0; i < b->n; i++) both[value_at(b->e[i].value, values, n)] += b->e[i].count;
+  // Bins go together, in order, until each has MIN_BIN, and what's left
+  // over at the end goes in with the last of them.
+  unsigned int *groups = malloc(sizeof(unsigned int) * (n + 1)), ngroups = 0;
+  double in = 0;
+  for(unsigned int i = 0; i < n; i++) {
+    groups[i] = ngroups;
+    in += both[i];
+    if (in >= MIN_BIN) {
+      ngroups++;
+      in = 0;
+    }
+  }
+  if (ngroups == 0)
+    ngroups = 1;
+  else if (in > 0)
+    for(unsigned int i = 0; i < n; i++)
+      if (groups[i] == ngroups) groups[i] = ngroups - 1;
+
+  double *ta = table(a, values, n, groups, ngroups), *tb = table(b, values, n, groups, ngroups);
+  double *pa = calloc(ngroups, sizeof(double)), *pb = calloc(ngroups, sizeof(double));
+  double na = 0, nb = 0;
+  for(unsigned int k = 0; k < a->seeds; k++)
+    for(unsigned int j = 0; j < ngroups; j++) pa[j] += ta[k * ngroups + j];
+  for(unsigned int k = 0; k < b->seeds; k++)
+    for(unsigned int j = 0; j < ngroups; j++) pb[j] += tb[k * ngroups + j];
+  for(unsigned int j = 0; j < ngroups; j++) {
+    na += pa[j];
+    nb += pb[j];
+  }
+  // Pearson's statistic, as if every sample were independent.
+  unsigned int g = ngroups - 1;
+  double x2 = 0, scale = 1 / na + 1 / nb;
+  double *p = malloc(sizeof(double) * ngroups);
+  for(unsigned int j = 0; j < ngroups; j++) {
+    p[j] = (pa[j] + pb[j]) / (na + nb);
+    pa[j] /= na;
+    pb[j] /= nb;
+    x2 += (pa[j] - pb[j]) * (pa[j] - pb[j]) / (p[j] * scale);
+  }
+  // The design effects are the eigenvalues of D, the covariance the seeds
+  // say the difference in proportions has, over what it would be if every
+  // sample were independent (a multinomial's, which is easy to invert).
+  // Only the traces of D and D squared are needed.
+  double *v = calloc((size_t)g * g + 1, sizeof(double)), *d = malloc(sizeof(double) * ((size_t)g * g + 1));
+  covariance(ta, a->seeds, ngroups, na, v);
+  covariance(tb, b->seeds, ngroups, nb, v);
+  for(unsigned int i = 0; i < g; i++)
+    for(unsigned int j = 0; j < g; j++) {
+      double sum = 0;
+      for(unsigned int k = 0; k < g; k++) sum += ((i == k ? 1 / p[i] : 0) + 1 / p[g]) * v[k * g + j];
+      d[i * g + j] = sum / scale;
+    }
+  double tr = 0, tr2 = 0;
+  for(unsigned int i = 0; i < g; i++) {
+    tr += d[i * g + i];
+    for(unsigned int j = 0; j < g; j++) tr2 += d[i * g + j] * d[j * g + i];
+  }
+  double stat = x2, df = 0, deff = 1, result = 1;
+  if (g != 0 && tr2 > 0) {
+    stat = x2 * tr / tr2;
+    df = tr * tr / tr2;
+    deff = tr / g;
+    // The covariance is only as good as the seeds it came from.
+    double d2 = df * (a->seeds + b->seeds - 2);
+    result = beta_i(d2 / 2, df / 2, d2 / (d2 + stat));
+  }
+  printf("%s: chi2=%.2f df=%.1f deff=%.2f p=%.4g", name, stat, df, deff, result);
+  free(values);
+  free(both);
+  free(groups);
+  free(ta);
+  free(tb);
+  free(pa);
+  free(pb);
+  free(p);
+  free(v);
+  free(d);
+  return result;
+}
+
+// Two-sample Kolmogorov-Smirnov of a against b.
+static double ks_test(const char *name, const struct sample *a, const struct sample *b) {
+  double na = 0, nb = 0, fa = 0, fb = 0, d = 0;
+  for(unsigned int i = 0; i < a->n; i++) na += a->count[i];
+  for(unsigned int i = 0; i < b->n; i++) nb += b->count[i];
+  unsigned int i = 0, j = 0;
+  while(i < a->n || j < b->n) {
+    long v = (j == b->n || (i < a->n && a->value[i] <= b->value[j])) ? a->value[i] : b->value[j];
+    if (i < a->n && a->value[i] == v) fa += a->count[i++];
+    if (j < b->n && b->value[j] == v) fb += b->count[j++];
+    if (fabs(fa / na - fb / nb) > d) d = fabs(fa / na - fb / nb);
+  }
+  double deff = a->deff > b->deff ? a->deff : b->deff;
+  if (deff < 1) deff = 1;
+  double ne = na * nb / (na + nb) / deff;
+  double p = ks_q((sqrt(ne) + 0.12 + 0.11 / sqrt(ne)) * d);
+  printf("%s: d=%.4f deff=%.2f p=%.4g", name, d, deff, p);
+  return p;
+}
+
+// The baseline has a line for each seed's histogram, "name value:count ...",
+// and one for each KS sample, "name deff value:count ...".
+
+static void write_hist(FILE *f, const char *name, const struct hist *h) {
+  for(unsigned int k = 0; k < h->seeds; k++) {
+    fprintf(f, "%s", name);
+    for(unsigned int i = 0; i < h->n; i++)
+      if (h->e[i].seed == k) fprintf(f, " %ld:%.0f", h->e[i].value, h->e[i].count);
+    fprintf(f, "\n");
+  }
+}
+
+static void write_sample(FILE *f, const char *name, const struct sample *s) {
+  fprintf(f, "%s %.4f", name, s->deff);
+  for(unsigned int i = 0; i < s->n; i++) fprintf(f, " %ld:%.0f", s->value[i], s->count[i]);
+  fprintf(f, "\n");
+}
+
+// The pairs in p, into h for seed if there's an h, or else s.
+static void read_pairs(char *p, struct hist *h, unsigned int seed, struct sample *s) {
+  char *end;
+  for(;; p = end) {
+    long v = strtol(p, &end, 10);
+    if (end == p || *end != ':') break;
+    double c = strtod(end + 1, &end);
+    if (h != NULL)
+      hist_add(h, seed, v, c);
+    else if (s->n < MAX_VALUES) {
+      s->value[s->n] = v;
+      s->count[s->n++] = c;
+    }
+  }
+}
+
+// Reads name's lines into h (every one, a seed each) or s (the first).
+// Returns 0 if they're there.
+static int read_baseline(FILE *f, const char *name, struct hist *h, struct sample *s) {
+  static char line[1 << 22];
+  size_t len = strlen(name);
+  unsigned int seeds = 0;
+  rewind(f);
+  while(fgets(line, sizeof(line), f) != NULL) {
+    if (strncmp(line, name, len) != 0 || (line[len] != ' ' && line[len] != '\n')) continue;
+    if (h != NULL) {
+      read_pairs(line + len, h, seeds++, NULL);
+      h->seeds = seeds;
+      continue;
+    }
+    char *end;
+    s->n = 0;
+    s->deff = strtod(line + len, &end);
+    read_pairs(end, NULL, 0, s);
+    return 0;
+  }
+  if (seeds < 2) fprintf(stderr, "the baseline has no %s\n", name);
+  return seeds < 2;
+}
+
+static int result(double p, double limit) {
+  printf("%s\n", p < limit ? " FAILED" : "");
+  return p < limit;
+}
+
+int main(int argc, char **argv) {
+  static struct options opt;
+  static struct sample high, low, then;
+  struct hist gaps, patterns, before;
+  unsigned int jobs = 0;
+  double alpha = 0.01;
+  int write = 0;
+  int c;
+
+  opt.slots = 864000ULL * 10;
+  opt.seed = 1;
+  opt.count = 32;
+  opt.rate_num = 1;
+  opt.rate_den = 10;
+  while((c = getopt(argc, argv, "n:s:k:r:j:p:a:w")) != -1) {
+    switch(c) {
+      case 'n': opt.slots = strtoull(optarg, NULL, 0); break;
+      case 's': opt.seed = strtoul(optarg, NULL, 0); break;
+      case 'k': opt.count = (unsigned int)strtoul(optarg, NULL, 0); break;
+      case 'r':
+        if (sscanf(optarg, "%lu/%lu", &opt.rate_num, &opt.rate_den) != 2 || opt.rate_den == 0) goto usage;
+        break;
+      case 'j': jobs = (unsigned int)strtoul(optarg, NULL, 0); break;
+      case 'p':
+        for(opt.pattern = PATTERN_NONE; opt.pattern < PATTERNS; opt.pattern++)
+          if (strcmp(optarg, pattern_names[opt.pattern]) == 0) break;
+        if (opt.pattern == PATTERNS) goto usage;
+        break;
+      case 'a': alpha = atof(optarg); break;
+      case 'w': write = 1; break;
+      default: goto usage;
+    }
+  }
+  opt.hours = opt.slots / SLOTS_PER_HOUR;
+  if (argc - optind != 1 || opt.count < 2 || opt.hours < 2) goto usage;
+
+  opt.gaps = calloc((size_t)opt.count * METRICS_MAX_GAP, sizeof(*opt.gaps));
+  opt.high = calloc((size_t)opt.count * opt.hours, sizeof(float));
+  opt.low = calloc((size_t)opt.count * opt.hours, sizeof(float));
+  opt.patterns = calloc((size_t)opt.count * opt.hours, sizeof(float));
+  if (sim_parallel(opt.count, jobs, out_size(&opt), work, done, &opt) || opt.done != opt.count) {
+    fprintf(stderr, "simulation failed\n");
+    return 1;
+  }
+
+  memset(&gaps, 0, sizeof(gaps));
+  memset(&patterns, 0, sizeof(patterns));
+  memset(&before, 0, sizeof(before));
+  long *counts = malloc(sizeof(long) * opt.hours);
+  for(unsigned int k = 0; k < opt.count; k++) {
+    for(unsigned int i = 0; i < METRICS_MAX_GAP; i++) hist_add(&gaps, k, i, opt.gaps[k * METRICS_MAX_GAP + i]);
+    // How many hours had each count of the pattern.
+    for(unsigned long j = 0; j < opt.hours; j++) counts[j] = lround(opt.patterns[k * opt.hours + j]);
+    qsort(counts, opt.hours, sizeof(long), cmp_long);
+    for(unsigned long j = 0, from = 0; j <= opt.hours; j++)
+      if (j == opt.hours || counts[j] != counts[from]) {
+        hist_add(&patterns, k, counts[from], j - from);
+        from = j;
+      }
+  }
+  free(counts);
+  gaps.seeds = patterns.seeds = opt.count;
+  sample_from(&high, opt.high, opt.count, opt.hours);
+  sample_from(&low, opt.low, opt.count, opt.hours);
+
+  const char *path = argv[optind];
+  const char *pattern = pattern_names[opt.pattern];
+  if (write) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+      perror(path);
+      return 1;
+    }
+    fprintf(f, "# What 'make distcheck' compares against: %u seeds from %lu, for %llu slots each,"
+      " and %s (see distcheck.c).\n", opt.count, opt.seed, opt.slots,
+      opt.pattern == PATTERN_NONE ? "no pattern" : pattern);
+    write_hist(f, "gaps", &gaps);
+    write_sample(f, "high", &high);
+    write_sample(f, "low", &low);
+    if (opt.pattern != PATTERN_NONE) write_hist(f, pattern, &patterns);
+    if (fclose(f) != 0) {
+      perror(path);
+      return 1;
+    }
+    return 0;
+  }
+
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    perror(path);
+    return 1;
+  }
+  double limit = alpha / (opt.pattern == PATTERN_NONE ? 3 : 4);
+  int failed = 0;
+  if (read_baseline(f, "gaps", &before, NULL) == 0)
+    failed |= result(chi2_test("gaps", &gaps, &before), limit);
+  else
+    failed = 1;
+  if (read_baseline(f, "high", NULL, &then) == 0)
+    failed |= result(ks_test("high", &high, &then), limit);
+  else
+    failed = 1;
+  if (read_baseline(f, "low", NULL, &then) == 0)
+    failed |= result(ks_test("low", &low, &then), limit);
+  else
+    failed = 1;
+  if (opt.pattern != PATTERN_NONE) {
+    free(before.e);
+    memset(&before, 0, sizeof(before));
+    if (read_baseline(f, pattern, &before, NULL) == 0)
+      failed |= result(chi2_test(pattern, &patterns, &before), limit);
+    else
+      failed = 1;
+  }
+  fclose(f);
+  return failed;
+
+usage:
+  fprintf(stderr, "usage: %s [-n slots] [-s seed] [-k count] [-r num/den] [-j jobs] [-p pattern]"
+    " [-a alpha] [-w] baseline\n", argv[0]);
+  return 1;
+}
@@ -31,6 +31,15 @@
  * RUN_SLOW - define this to make the clock run slow, leave it out to run fast
  */
 
+// Every BASE_CYCLE_LENGTH + NUM_LONG_CYCLES / CYCLE_COUNT tenths of the
+// displayed time, a real one is added (or taken away).
+#define DRIFT_TENTHS ((unsigned long)BASE_CYCLE_LENGTH * CYCLE_COUNT + NUM_LONG_CYCLES)
+#ifdef RUN_SLOW
+TICK_RATE(DRIFT_TENTHS, IRQS_PER_SECOND * (DRIFT_TENTHS + CYCLE_COUNT));
+#else
+TICK_RATE(DRIFT_TENTHS, IRQS_PER_SECOND * (DRIFT_TENTHS - CYCLE_COUNT));
+#endif
+
 
 void loop() {
   unsigned int inner_counter = 0; // this counts to either BASE_CYCLE or BASE_CYCLE+1 before we adjust tick_counter.
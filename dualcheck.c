@@ -0,0 +1,151 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Runs two clocks as a DUAL_MOVEMENT pair (see base.c) through the host
+ * simulator and checks that the pair fits in the tenth-of-a-second budget.
+ * Build and run it with 'make dualcheck TYPE={first} SECOND={second}'.
+ *
+ * -n slots   how long each run is, in tenths-of-a-second (default 10 days)
+ * -s seed    the first seed (default 1)
+ * -k count   how many seeds to run (default 8)
+ * -j jobs    how many to run at once (default one per core)
+ * -p cycles  CPU cycles for a tick pulse (default 35 msec worth)
+ * -q cycles  CPU cycles for a q_random() call (default 150)
+ * -o cycles  CPU cycles for everything else in a slot: the interrupt, the
+ *            hand-offs and the clocks' own bookkeeping (default 400)
+ *
+ * Each movement's metrics are printed as simstat would, then the pair's:
+ * how often both ticked in the same slot (so the two pulses ran back to
+ * back), the most q_random() calls in one slot, the most costly slot (in
+ * cycles, and as a fraction of the 3277 cycles in a tenth of a second at
+ * 32.768 kHz), and the furthest behind the CPU ever got.
+ *
+ * A slot can run long now and then - base.c makes it up by not sleeping in
+ * the next one - but the pair fails if the CPU ever gets a whole tenth of a
+ * second behind, since then a tick would land in the wrong slot.
+ *
+ * The q_random() and overhead costs are estimates. The pulses are most of
+ * it anyway.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "metrics.h"
+
+struct result {
+  struct metrics first, second;
+  unsigned long long both_ticked;
+  unsigned long max_draws, max_cycles, max_behind;
+};
+
+static struct options {
+  unsigned long long slots;
+  unsigned long seed;
+  unsigned long tick_cycles, draw_cycles, overhead;
+  struct result total;
+  int have_total;
+} opt;
+
+static void work(unsigned int i, void *out, void *arg) {
+  struct result *r = (struct result *)out;
+  struct sim_run run;
+
+  metrics_init(&r->first, 1, 10);
+  metrics_init(&r->second, 1, 10);
+  memset(&run, 0, sizeof(run));
+  run.slots = opt.slots;
+  run.seed = opt.seed + i;
+  run.tick = metrics_tick;
+  run.arg = &r->first;
+  run.tick_second = metrics_tick;
+  run.arg_second = &r->second;
+  run.tick_cycles = opt.tick_cycles;
+  run.draw_cycles = opt.draw_cycles;
+  run.overhead_cycles = opt.overhead;
+  sim_run(&run);
+  metrics_finish(&r->first, run.slots);
+  metrics_finish(&r->second, run.slots);
+  r->both_ticked = run.both_ticked;
+  r->max_draws = run.max_draws;
+  r->max_cycles = run.max_cycles;
+  r->max_behind = run.max_behind;
+}
+
+static void done(unsigned int i, void *out, void *arg) {
+  struct result *r = (struct result *)out;
+  if (!opt.have_total) {
+    memcpy(&opt.total, r, sizeof(*r));
+    opt.have_total = 1;
+    return;
+  }
+  metrics_merge(&opt.total.first, &r->first);
+  metrics_merge(&opt.total.second, &r->second);
+  opt.total.both_ticked += r->both_ticked;
+  if (r->max_draws > opt.total.max_draws) opt.total.max_draws = r->max_draws;
+  if (r->max_cycles > opt.total.max_cycles) opt.total.max_cycles = r->max_cycles;
+  if (r->max_behind > opt.total.max_behind) opt.total.max_behind = r->max_behind;
+}
+
+int main(int argc, char **argv) {
+  unsigned int count = 8, jobs = 0;
+  int c;
+
+  opt.slots = 864000ULL * 10;
+  opt.seed = 1;
+  opt.tick_cycles = 35 * 32768UL / 1000;
+  opt.draw_cycles = 150;
+  opt.overhead = 400;
+  while((c = getopt(argc, argv, "n:s:k:j:p:q:o:")) != -1) {
+    switch(c) {
+      case 'n': opt.slots = strtoull(optarg, NULL, 0); break;
+      case 's': opt.seed = strtoul(optarg, NULL, 0); break;
+      case 'k': count = (unsigned int)strtoul(optarg, NULL, 0); break;
+      case 'j': jobs = (unsigned int)strtoul(optarg, NULL, 0); break;
+      case 'p': opt.tick_cycles = strtoul(optarg, NULL, 0); break;
+      case 'q': opt.draw_cycles = strtoul(optarg, NULL, 0); break;
+      case 'o': opt.overhead = strtoul(optarg, NULL, 0); break;
+      default:
+        fprintf(stderr, "usage: %s [-n slots] [-s seed] [-k count] [-j jobs] [-p cycles] [-q cycles] [-o cycles]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  if (sim_parallel(count, jobs, sizeof(struct result), work, done, NULL) || !opt.have_total) {
+    fprintf(stderr, "simulation failed\n");
+    return 1;
+  }
+  printf("first:  ");
+  metrics_print(stdout, &opt.total.first);
+  printf("second: ");
+  metrics_print(stdout, &opt.total.second);
+  printf("pair:   both_ticked_day=%.1f draws_max=%lu worst_cycles=%lu worst_slot=%.2f behind_max=%lu\n",
+    opt.total.both_ticked * 864000.0 / opt.total.first.slots, opt.total.max_draws,
+    opt.total.max_cycles, (double)opt.total.max_cycles / SIM_SLOT_CYCLES, opt.total.max_behind);
+  if (opt.total.max_behind >= SIM_SLOT_CYCLES) {
+    fprintf(stderr, "the CPU got %lu cycles behind\n", opt.total.max_behind);
+    return 1;
+  }
+  return 0;
+}
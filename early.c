@@ -19,59 +19,27 @@
  */
 
 /*
- * This clock runs 20% fast for 50 minutes, then 10% slow for 100 minutes.
+ * This clock wanders between on-time and 10 minutes fast.
  * The idea is that this is for folks who set their clock 10 minutes fast
  * to keep from being late to things, but then find themselves compensating.
  *
  * This clock will be anywhere from on-time to 10 minutes fast... but you
  * won't be able to predict it (without comparing it to a proper clock).
+ * It used to run 20% fast for 50 minutes, then 10% slow for 100 minutes,
+ * but that was a pattern you could learn. Now the rate and length of each
+ * stretch are picked at random (see walk.h).
  *
  */
 
 #include "base.h"
 
-// 50 minutes in seconds - at 20% fast, that's 10 minutes error.
-#define FAST_CYCLE_LENGTH (60L*50)
-// This is a multiple of 10% for how much swing we give
-#define FAST_CYCLE_MAGNITUDE (-2)
-#define NORMAL_CYCLE_MAGNITUDE (0)
-// This is twice as long as the FAST cycle because it's half the error rate
-#define SLOW_CYCLE_LENGTH (FAST_CYCLE_LENGTH * 2)
-#define SLOW_CYCLE_MAGNITUDE -(FAST_CYCLE_MAGNITUDE / 2)
+// On-time to 10 minutes ahead, in tenths of a second.
+#define WALK_MIN (0)
+#define WALK_MAX (10L * 60 * 10)
+// 20% fast, normal or 10% slow. The slow rate is half the fast one, so it's
+// listed twice to keep the walk from leaning one way or the other.
+#define WALK_RATES { -2, 0, 0, 1, 1 }
+// Anywhere from half a minute to 50 minutes at a stretch.
+#define WALK_DURATIONS { 30, 45, 60, 120, 300, 600, 1200, 1800, 3000 }
 
-void loop() {
-  // we have a four-state machine. Between each interval of fast or slow
-  // ticking, we put a short period of normal ticking so that the transition
-  // isn't obvious.
-  unsigned char state = 99; // force a reset
-  unsigned long current_cycle_position = 99; // force a reset
-  unsigned long current_cycle_length = 0; // squelch bogus warning
-  char current_cycle_magnitude = 0; // squelch bogus warning
-  while(1) {
-    if (current_cycle_position++ >= current_cycle_length) {
-      if (++state > 3) state = 0;
-      current_cycle_position = 0;
-      switch(state) {
-        case 0:
-        case 2:
-          current_cycle_length = 30 + (q_random() % 30); // shift it around a lot.
-          current_cycle_magnitude = NORMAL_CYCLE_MAGNITUDE;
-          break;
-        case 1:
-          current_cycle_length = FAST_CYCLE_LENGTH;
-          current_cycle_magnitude = FAST_CYCLE_MAGNITUDE;
-          break;
-        case 3:
-          current_cycle_length = SLOW_CYCLE_LENGTH;
-          current_cycle_magnitude = SLOW_CYCLE_MAGNITUDE;
-          break;
-      }
-    }
-    for(unsigned char i = 0; i < IRQS_PER_SECOND + current_cycle_magnitude; i++) {
-      if (i == 0)
-        doTick();
-      else
-        doSleep();
-    }
-  }
-} 
+#include "walk.h"
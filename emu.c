@@ -0,0 +1,1417 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * An ATtiny45 emulator, just good enough to run the real .hex files,
+ * cycle for cycle. The host simulator (sim.c) runs the clock code itself,
+ * but not base.c, the compiler's output or the timing of any of it. This
+ * runs all of that.
+ *
+ * emu [-n slots] [-s seed] [-r num/den] [-e eeprom.hex] [-F] [-2] [-l] [-a] [-b] [-t]
+ *     [-P slot[+cycles]] [-T h:mm:ss] [-S ppm[,from-to]] [-c every [-C prefix]]
+ *     [-R snapshot] file.hex
+ *
+ * The chip spends almost all of its time asleep, waiting for the Timer0
+ * compare interrupt. So rather than count out those cycles one by one, a
+ * SLEEP works out when the timer will next raise an interrupt and skips
+ * straight there. Only the cycles the CPU is awake cost anything, and that
+ * makes a year of a clock a matter of minutes.
+ *
+ * Only what the firmware uses is here: the CPU (the ATtiny's instruction
+ * set, without MUL), the RAM, Timer0 in its counting-up modes, PORTB, the
+ * EEPROM, sleep in idle mode, the ADC (its input is always ADC_VALUE) and,
+ * with -P or -S, INT0, or with -T, PB2's pin change interrupt. The analog
+ * comparator, Timer1, the USI, the other pin change interrupts and the
+ * watchdog are just registers that hold what's written to them. Anything else the firmware does that isn't modelled - running
+ * off the end of the RAM or into empty flash, SPM, phase correct PWM,
+ * changing the clock prescaler, or ten minutes without a slot going by
+ * (stuck in a loop, or asleep for good) - stops the run with an error.
+ *
+ * The EEPROM starts out blank, except for the seed (-s, at 0) and a trim
+ * of 0 (at 4), unless -e loads something else over it. It also has the
+ * .hex's build report (see buildid.h), as if the chip had already started
+ * up once. -F leaves that out, so it works out its flash CRC first.
+ *
+ * A slot is the time between two Timer0 compare matches, counted from the
+ * last time TCNT0 was written (which base.c does just before it starts).
+ * It runs for -n slots (10 days by default), and each rising edge of PB0
+ * or PB1 counts as a tick in the slot it happens in. It prints the same
+ * metrics as simstat (except the draws, which it can't see), so for a
+ * given seed, the two should be identical if the firmware keeps up with
+ * its tenths of a second. 'make emucheck TYPE=...' checks that.
+ *
+ * With -2, it's a DUAL_MOVEMENT image (see base.c), with PB2 as well, and
+ * it prints the metrics of each movement. -l lists the slot and cycle of
+ * every tick first.
+ *
+ * Then it prints how the CPU did:
+ *   awake_max   the most cycles it was awake between two sleeps
+ *   awake_mean  the average of those
+ *   overruns    how many times an interrupt came before it went to sleep
+ *   lost        compare matches that came while the last one was still
+ *               waiting to be handled, so the clock fell a slot behind
+ *   pulse_min, pulse_max  the shortest and longest tick pulse, in msec
+ *   speed       how many times faster than real time the run went
+ *
+ * -a audits the image instead: it stops at the first sleep, prints the
+ * registers that decide how much current the chip draws asleep, and fails
+ * if any of them isn't what lowpower.h says. An image that never sleeps
+ * is audited at the end of the run.
+ *
+ * -b times things instead, to the cycle. A write of n (1 to 255) to GPIOR0,
+ * which nothing else uses, starts mark n, and the next write to it ends
+ * that mark (and starts another, unless it's 0). The cycles in between
+ * count, less any spent asleep or in an interrupt, which keeps what's being
+ * timed apart from when the timer happens to go off. Each interrupt is
+ * timed on its own, from when it's taken to the end of its RETI. At the end
+ * of the run, in place of the metrics, it prints a line for each mark and
+ * each interrupt vector that came up:
+ *   markN runs=... best=... worst=...
+ *   isrN runs=... best=... worst=...
+ * cycles.c is the image for this ('make cycles'). -b doesn't go with -R.
+ *
+ * -t runs a test image (see emutest.c) up to its first BREAK, and then, in
+ * place of the metrics, prints where the CPU got to:
+ *   r0=.. ... r31=.. sreg=.. sp=... pc=... cycles=...
+ * all in hex but the cycles, which don't count the BREAK. With -b as well,
+ * the marks and interrupts follow. A test image that never gets to a BREAK
+ * fails like any other that gets stuck. -t doesn't go with -R.
+ *
+ * -P is the battery going, for a POWER_FAIL image (see base.c). PB2 reads
+ * high until the given slot, and that many cycles into it (0 by default),
+ * it falls, which can raise INT0. The run stops a second later, and after
+ * the rest, it prints
+ *   power_fail: writes=... checkpoint_ms=...
+ * which is how many EEPROM writes the chip started after PB2 fell, and how
+ * long from then until the last of them was done. That's how long the
+ * hold-up capacitor has to last. With -a as well, PB2 has to be an input.
+ *
+ * -T is a DCF77 receiver on PB2, for a TIME_CODE image (see base.c), with
+ * the run starting at the given time of day. The signal is perfect, with
+ * every second's pulse right on time, and it raises the pin change
+ * interrupt on each edge if PCMSK lets it. Taking the hands to have
+ * started at 12 (as they do with an EEPROM that's never had them in it),
+ * after the rest it prints
+ *   time_code: hands=h:mm:ss want=h:mm:ss off=...
+ * which is where the ticks have taken them, where they should be by the
+ * end of the run, and how many seconds fast they are. -T doesn't go with
+ * -2 or -R, and with -a as well, PB2 has to be an input.
+ *
+ * -S is a GPS module's 1PPS output on PB2, for a PPS image (see base.c),
+ * against a crystal that's ppm fast (or slow, for less than 0). Each edge
+ * is a true second, and it's high for 100 msec, which raises INT0 on
+ * whichever edges MCUCR says. From slot from to slot to, there aren't any
+ * edges, which is the module losing the satellites. Each tick is timed
+ * against the true seconds, and after the rest it prints
+ *   pps: p2p=... rms=... drift=...
+ * which is, in msec, how far apart the earliest and latest ticks were and
+ * their spread, over the second half of the run (less the outage and the
+ * hour after it), and how far the ticks moved over the outage, against
+ * the hour before it. -S doesn't go with -2, -P, -T or -R, and with -a as
+ * well, PB2 has to be an input.
+ *
+ * With -c, it takes a snapshot every so many slots, in prefix-{slot}.snap
+ * (emu-{slot}.snap by default). That's the whole chip - the RAM (and so the
+ * PRNG seed and every clock's statics), the registers, Timer0 and the
+ * EEPROM - and the metrics so far. It's taken while the chip is asleep, the
+ * first time it is once the slot count gets to each multiple. -R carries
+ * on from one, given the same file.hex, up to the new -n, and the results
+ * are the same as if the run had never stopped. An -e given with -R is
+ * loaded over the snapshot's EEPROM, for what-ifs that change what the
+ * firmware reads from it later on. -s and -F don't do anything then, and
+ * -2 has to match.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "buildid.h"
+#include "lowpower.h"
+#include "metrics.h"
+
+#define F_CPU (32768)
+#define FLASH_SIZE (4096)
+#define EEPROM_SIZE (256)
+#define SRAM_START (0x60)
+#define RAMEND (0x15f)
+#define ADC_VALUE (0x200)
+
+// The I/O registers we do something with, by I/O address.
+#define IO_ACSR (0x08)
+#define IO_ADCL (0x04)
+#define IO_ADCH (0x05)
+#define IO_ADCSRA (0x06)
+#define IO_GPIOR0 (0x11)
+#define IO_DIDR0 (0x14)
+#define IO_PCMSK (0x15)
+#define IO_PINB (0x16)
+#define IO_DDRB (0x17)
+#define IO_PORTB (0x18)
+#define IO_EECR (0x1c)
+#define IO_EEDR (0x1d)
+#define IO_EEARL (0x1e)
+#define IO_EEARH (0x1f)
+#define IO_PRR (0x20)
+#define IO_CLKPR (0x26)
+#define IO_OCR0B (0x28)
+#define IO_OCR0A (0x29)
+#define IO_TCCR0A (0x2a)
+#define IO_GTCCR (0x2c)
+#define IO_TCNT0 (0x32)
+#define IO_TCCR0B (0x33)
+#define IO_MCUCR (0x35)
+#define IO_TIFR (0x38)
+#define IO_TIMSK (0x39)
+#define IO_GIFR (0x3a)
+#define IO_GIMSK (0x3b)
+#define IO_SPL (0x3d)
+#define IO_SPH (0x3e)
+#define IO_SREG (0x3f)
+
+// Bits in them
+#define TOV0 (1)
+#define OCF0B (3)
+#define OCF0A (4)
+#define ADIF (4)
+#define ADIE (3)
+#define ADSC (6)
+#define ADEN (7)
+#define EERE (0)
+#define EEPE (1)
+#define EEMPE (2)
+#define EERIE (3)
+#define SE (5)
+#define SM_MASK (0x18)
+#define CLKPCE (7)
+#define ISC_MASK (0x03)
+#define INT0 (6)
+#define INTF0 (6)
+#define PCIE (5)
+#define PCIF (5)
+
+#define SREG_C (0x01)
+#define SREG_Z (0x02)
+#define SREG_N (0x04)
+#define SREG_V (0x08)
+#define SREG_S (0x10)
+#define SREG_H (0x20)
+#define SREG_T (0x40)
+#define SREG_I (0x80)
+
+// Interrupt vectors, in order of priority.
+#define VECT_INT0 (1)
+#define VECT_PCINT0 (2)
+#define VECT_TIMER0_OVF (5)
+#define VECT_EE_RDY (6)
+#define VECT_ADC (8)
+#define VECT_TIMER0_COMPA (10)
+#define VECT_TIMER0_COMPB (11)
+
+#define NEVER (~0ULL)
+// If no slot goes by for this long, the firmware is stuck. (Working out the
+// flash CRC the first time takes a few seconds.)
+#define STUCK_CYCLES (600ULL * F_CPU)
+#define _BV(bit) (1 << (bit))
+#define PC_MASK (FLASH_SIZE / 2 - 1)
+
+// Each word of flash is decoded once, up front.
+enum {
+  OP_BAD, OP_NOP, OP_MOVW, OP_CPC, OP_SBC, OP_ADD, OP_CPSE, OP_CP, OP_SUB, OP_ADC,
+  OP_AND, OP_EOR, OP_OR, OP_MOV, OP_CPI, OP_SBCI, OP_SUBI, OP_ORI, OP_ANDI,
+  OP_LDD_Y, OP_LDD_Z, OP_STD_Y, OP_STD_Z, OP_LDS, OP_LD_ZP, OP_LD_MZ, OP_LPM, OP_LPM_ZP,
+  OP_LD_YP, OP_LD_MY, OP_LD_X, OP_LD_XP, OP_LD_MX, OP_POP, OP_STS, OP_ST_ZP, OP_ST_MZ,
+  OP_ST_YP, OP_ST_MY, OP_ST_X, OP_ST_XP, OP_ST_MX, OP_PUSH, OP_COM, OP_NEG, OP_SWAP,
+  OP_INC, OP_ASR, OP_LSR, OP_ROR, OP_DEC, OP_JMP, OP_CALL, OP_BSET, OP_BCLR, OP_RET,
+  OP_RETI, OP_SLEEP, OP_BREAK, OP_WDR, OP_LPM0, OP_SPM, OP_IJMP, OP_ICALL, OP_ADIW,
+  OP_SBIW, OP_CBI, OP_SBIC, OP_SBI, OP_SBIS, OP_IN, OP_OUT, OP_RJMP, OP_RCALL, OP_LDI,
+  OP_BRBS, OP_BRBC, OP_BLD, OP_BST, OP_SBRC, OP_SBRS,
+};
+
+struct op {
+  uint8_t code, d, r, words;
+  int16_t k;
+};
+
+static uint8_t flash[FLASH_SIZE];
+static struct op prog[FLASH_SIZE / 2];
+static uint8_t data[RAMEND + 1]; // registers, then I/O, then RAM
+static uint8_t eeprom[EEPROM_SIZE];
+#define reg data
+#define io (data + 0x20)
+
+static uint16_t pc, sp;
+static uint8_t sreg;
+static unsigned long long cycle;
+
+// Timer0. Every timer clock is prescale cycles after the last, counting
+// from prescale_base (the last prescaler reset). The counter has had all
+// the clocks up to timer_cycle.
+static unsigned int prescale;
+static unsigned long long prescale_base, timer_cycle;
+static unsigned char compare_blocked;
+
+// The EEPROM and ADC are busy until these.
+static unsigned long long ee_busy, ee_mpe, adc_done = NEVER;
+
+// When something next happens that the CPU loop has to stop for.
+static unsigned long long next_event;
+static int irq_pending; // interrupts are on and one is waiting
+static unsigned long long irq_held; // no interrupt right after this cycle
+static int asleep;
+
+// What we're measuring
+static unsigned long long slot, horizon, slot_cycle;
+static struct metrics metrics[2];
+static int dual, list, audit, test;
+static uint8_t pins; // the tick pins that are high
+static unsigned long long pulse_start;
+static double pulse_min = 1e9, pulse_max;
+static unsigned long long woke = NEVER, awake_total, wakes, overruns, lost;
+static unsigned long awake_max;
+
+// For -b. away is every cycle so far spent asleep or in an interrupt.
+struct bench {
+  unsigned long long runs, best, worst;
+};
+static struct bench marks[256], isrs[VECT_TIMER0_COMPB + 1];
+static int bench, mark, isr_vector;
+static unsigned long long mark_start, isr_start, slept_at, away;
+
+// For -P. sense is PB2's level from outside (-1 if nothing drives it).
+static unsigned long long fail_slot = NEVER, fail_cycles, fail_at = NEVER, fail_done;
+static unsigned int fail_writes;
+static int sense = -1;
+
+// For -T. code_start is the time of day at cycle 0, in seconds, and the
+// signal's level is code_level until code_next.
+static long code_start = -1;
+static int code_level;
+static unsigned long long code_next, code_ticks;
+
+// For -S. A true second is pps_second cycles, and the edges are PPS_AT
+// into each one. PB2's level is pps_level until pps_next, which is the nth
+// edge if pps_rising.
+#define PPS_AT (0.3)
+#define PPS_WIDTH (0.1)
+static int pps, pps_level, pps_rising;
+static double pps_second;
+static unsigned long long pps_n, pps_next, pps_from = NEVER, pps_to = NEVER;
+struct pps_spread {
+  double n, mean, m2, lo, hi;
+};
+static struct pps_spread pps_settled, pps_before;
+static double pps_last = NAN, pps_unwrap, pps_drift = NAN;
+
+// Snapshots
+static unsigned long long snapshot_every, next_snapshot = NEVER;
+static const char *snapshot_prefix = "emu";
+
+static void __attribute__((noreturn)) fault(const char *what) {
+  fprintf(stderr, "emu: %s at %04x, cycle %llu (slot %llu)\n", what, pc * 2, cycle, slot);
+  exit(1);
+}
+
+// For -a, check the low power setup. Returns whether it's wrong.
+static int audit_report(int slept) {
+  static const struct {
+    const char *name;
+    uint8_t at, want;
+  } audited[] = {
+    { "ADCSRA", IO_ADCSRA, LOW_POWER_ADCSRA },
+    { "ACSR", IO_ACSR, LOW_POWER_ACSR },
+    { "PRR", IO_PRR, LOW_POWER_PRR },
+    { "DIDR0", IO_DIDR0, LOW_POWER_DIDR0 },
+    { "PORTB", IO_PORTB, LOW_POWER_PORTB },
+    { "DDRB", IO_DDRB, LOW_POWER_DDRB },
+  };
+  int failed = 0;
+  for(unsigned int i = 0; i < sizeof(audited) / sizeof(audited[0]); i++)
+    printf("%s=%02x ", audited[i].name, io[audited[i].at]);
+  printf("sleep=%s\n", !slept ? "never" : (io[IO_MCUCR] & SM_MASK) ? "deep" : "idle");
+  for(unsigned int i = 0; i < sizeof(audited) / sizeof(audited[0]); i++) {
+    uint8_t want = audited[i].want;
+    // With POWER_FAIL or TIME_CODE, PB2 is an input, with its buffer on.
+    if ((sense >= 0 || code_start >= 0 || pps) && (audited[i].at == IO_DDRB || audited[i].at == IO_DIDR0)) want &= ~_BV(2);
+    if (io[audited[i].at] == want) continue;
+    fprintf(stderr, "emu: %s is %02x, not %02x (see lowpower.h)\n", audited[i].name,
+      io[audited[i].at], want);
+    failed = 1;
+  }
+  return failed;
+}
+
+static void decode(uint16_t at) {
+  uint16_t w = flash[2 * at] | (flash[2 * at + 1] << 8);
+  struct op *o = &prog[at];
+  uint8_t d5 = (w >> 4) & 0x1f, r5 = (w & 0xf) | ((w >> 5) & 0x10);
+  uint8_t k8 = (w & 0xf) | ((w >> 4) & 0xf0);
+  o->words = 1;
+  o->d = d5;
+  o->r = r5;
+  o->k = 0;
+  o->code = OP_BAD;
+
+  switch(w >> 12) {
+    case 0x0:
+      if (w == 0) o->code = OP_NOP;
+      else if ((w & 0xff00) == 0x0100) {
+        o->code = OP_MOVW;
+        o->d = ((w >> 4) & 0xf) * 2;
+        o->r = (w & 0xf) * 2;
+      } else if ((w & 0x0c00) == 0x0400) o->code = OP_CPC;
+      else if ((w & 0x0c00) == 0x0800) o->code = OP_SBC;
+      else if ((w & 0x0c00) == 0x0c00) o->code = OP_ADD;
+      return; // MULS and the FMULs aren't on the ATtiny
+    case 0x1:
+      o->code = (uint8_t[]){ OP_CPSE, OP_CP, OP_SUB, OP_ADC }[(w >> 10) & 3];
+      return;
+    case 0x2:
+      o->code = (uint8_t[]){ OP_AND, OP_EOR, OP_OR, OP_MOV }[(w >> 10) & 3];
+      return;
+    case 0x3: case 0x4: case 0x5: case 0x6: case 0x7:
+      o->code = (uint8_t[]){ OP_CPI, OP_SBCI, OP_SUBI, OP_ORI, OP_ANDI }[(w >> 12) - 3];
+      o->d = 16 + ((w >> 4) & 0xf);
+      o->k = k8;
+      return;
+    case 0x8: case 0xa:
+      o->k = (w & 7) | ((w >> 7) & 0x18) | ((w >> 8) & 0x20);
+      if (w & 0x0200) o->code = (w & 8) ? OP_STD_Y : OP_STD_Z;
+      else o->code = (w & 8) ? OP_LDD_Y : OP_LDD_Z;
+      return;
+    case 0x9:
+      break;
+    case 0xb:
+      o->code = (w & 0x0800) ? OP_OUT : OP_IN;
+      o->k = (w & 0xf) | ((w >> 5) & 0x30);
+      return;
+    case 0xc: case 0xd:
+      o->code = (w & 0x1000) ? OP_RCALL : OP_RJMP;
+      o->k = (int16_t)(w << 4) >> 4;
+      return;
+    case 0xe:
+      o->code = OP_LDI;
+      o->d = 16 + ((w >> 4) & 0xf);
+      o->k = k8;
+      return;
+    case 0xf:
+      if (w & 0x0800) {
+        if (w & 8) return;
+        o->code = (uint8_t[]){ OP_BLD, OP_BST, OP_SBRC, OP_SBRS }[(w >> 9) & 3];
+        o->r = w & 7;
+      } else {
+        o->code = (w & 0x0400) ? OP_BRBC : OP_BRBS;
+        o->r = w & 7;
+        o->k = (int16_t)(w << 6) >> 9;
+      }
+      return;
+  }
+
+  // What's left is all 1001 xxxx xxxx xxxx.
+  uint16_t next = (at + 1 < FLASH_SIZE / 2) ? flash[2 * at + 2] | (flash[2 * at + 3] << 8) : 0xffff;
+  switch((w >> 9) & 7) {
+    case 0: // loads
+    case 1: { // stores
+      static const uint8_t ld[16] = {
+        OP_LDS, OP_LD_ZP, OP_LD_MZ, OP_BAD, OP_LPM, OP_LPM_ZP, OP_BAD, OP_BAD,
+        OP_BAD, OP_LD_YP, OP_LD_MY, OP_BAD, OP_LD_X, OP_LD_XP, OP_LD_MX, OP_POP,
+      };
+      static const uint8_t st[16] = {
+        OP_STS, OP_ST_ZP, OP_ST_MZ, OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD,
+        OP_BAD, OP_ST_YP, OP_ST_MY, OP_BAD, OP_ST_X, OP_ST_XP, OP_ST_MX, OP_PUSH,
+      };
+      o->code = (w & 0x0200) ? st[w & 0xf] : ld[w & 0xf];
+      if (o->code == OP_LDS || o->code == OP_STS) {
+        o->words = 2;
+        o->k = (int16_t)next;
+      }
+      return;
+    }
+    case 2: // one operand, and the odds and ends
+      switch(w & 0xf) {
+        case 0x0: o->code = OP_COM; return;
+        case 0x1: o->code = OP_NEG; return;
+        case 0x2: o->code = OP_SWAP; return;
+        case 0x3: o->code = OP_INC; return;
+        case 0x5: o->code = OP_ASR; return;
+        case 0x6: o->code = OP_LSR; return;
+        case 0x7: o->code = OP_ROR; return;
+        case 0xa: o->code = OP_DEC; return;
+        case 0xc: case 0xd: case 0xe: case 0xf:
+          // Not on the ATtiny45, but harmless as long as they stay in range.
+          o->code = (w & 2) ? OP_CALL : OP_JMP;
+          o->words = 2;
+          o->k = (int16_t)next;
+          if (((w >> 3) & 0x3e) | (w & 1)) o->code = OP_BAD;
+          return;
+        case 0x8:
+          if ((w & 0x0100) == 0) {
+            o->code = (w & 0x80) ? OP_BCLR : OP_BSET;
+            o->r = (w >> 4) & 7;
+            return;
+          }
+          switch(w) {
+            case 0x9508: o->code = OP_RET; return;
+            case 0x9518: o->code = OP_RETI; return;
+            case 0x9588: o->code = OP_SLEEP; return;
+            case 0x9598: o->code = OP_BREAK; return;
+            case 0x95a8: o->code = OP_WDR; return;
+            case 0x95c8: o->code = OP_LPM0; return;
+            case 0x95e8: o->code = OP_SPM; return;
+          }
+          return;
+        case 0x9:
+          if (w == 0x9409) o->code = OP_IJMP;
+          else if (w == 0x9509) o->code = OP_ICALL;
+          return;
+      }
+      return;
+    case 3:
+      o->code = (w & 0x0100) ? OP_SBIW : OP_ADIW;
+      o->d = 24 + ((w >> 3) & 6);
+      o->k = (w & 0xf) | ((w >> 2) & 0x30);
+      return;
+    case 4: case 5:
+      o->code = (uint8_t[]){ OP_CBI, OP_SBIC, OP_SBI, OP_SBIS }[(w >> 8) & 3];
+      o->k = (w >> 3) & 0x1f;
+      o->r = w & 7;
+      return;
+  }
+  // and MUL isn't on the ATtiny either
+}
+
+// Timer0
+
+static int timer_top() {
+  unsigned char wgm = (io[IO_TCCR0A] & 3) | ((io[IO_TCCR0B] >> 1) & 4);
+  return (wgm == 2 || wgm == 7) ? io[IO_OCR0A] : 0xff;
+}
+
+// What one timer clock does to the counter. Returns the flags it sets.
+static uint8_t timer_step(uint8_t *count, unsigned char *blocked) {
+  uint8_t flags = 0;
+  if (!*blocked) {
+    if (*count == io[IO_OCR0A]) flags |= _BV(OCF0A);
+    if (*count == io[IO_OCR0B]) flags |= _BV(OCF0B);
+  }
+  *blocked = 0;
+  if (*count == timer_top()) {
+    if (*count == 0xff || (io[IO_TCCR0B] & 8)) flags |= _BV(TOV0);
+    *count = 0;
+  } else if (*count == 0xff) {
+    flags |= _BV(TOV0); // OCR0A got set below the count in CTC mode
+    *count = 0;
+  } else
+    ++*count;
+  return flags;
+}
+
+// The cycle of the n-th timer clock after timer_cycle (from 1).
+static unsigned long long timer_clock(unsigned int n) {
+  return prescale_base + ((timer_cycle - prescale_base) / prescale + n) * prescale;
+}
+
+// Catch the counter up to now.
+static void timer_sync() {
+  if (prescale == 0) {
+    timer_cycle = cycle;
+    return;
+  }
+  unsigned long long clocks = (cycle - prescale_base) / prescale
+    - (timer_cycle - prescale_base) / prescale;
+  timer_cycle = cycle;
+  while(clocks-- > 0) {
+    uint8_t flags = timer_step(&io[IO_TCNT0], &compare_blocked);
+    if (flags & _BV(OCF0A)) {
+      if ((io[IO_TIFR] & _BV(OCF0A)) && (io[IO_TIMSK] & _BV(OCF0A))) lost++;
+      slot++;
+      slot_cycle = cycle;
+    }
+    io[IO_TIFR] |= flags;
+  }
+}
+
+// When the timer next sets a flag.
+static unsigned long long timer_next() {
+  if (prescale == 0) return NEVER;
+  uint8_t count = io[IO_TCNT0];
+  unsigned char blocked = compare_blocked;
+  for(unsigned int n = 1; n <= 512; n++)
+    if (timer_step(&count, &blocked) != 0) return timer_clock(n);
+  return NEVER;
+}
+
+static int interrupt_vector() {
+  uint8_t timer = io[IO_TIFR] & io[IO_TIMSK];
+  if ((io[IO_GIMSK] & _BV(INT0)) && ((io[IO_GIFR] & _BV(INTF0))
+      || ((io[IO_MCUCR] & ISC_MASK) == 0 && sense == 0 && !(io[IO_DDRB] & 4))))
+    return VECT_INT0;
+  if ((io[IO_GIMSK] & _BV(PCIE)) && (io[IO_GIFR] & _BV(PCIF))) return VECT_PCINT0;
+  if (timer & _BV(TOV0)) return VECT_TIMER0_OVF;
+  if ((io[IO_EECR] & _BV(EERIE)) && cycle >= ee_busy) return VECT_EE_RDY;
+  if ((io[IO_ADCSRA] & _BV(ADIF)) && (io[IO_ADCSRA] & _BV(ADIE))) return VECT_ADC;
+  if (timer & _BV(OCF0A)) return VECT_TIMER0_COMPA;
+  if (timer & _BV(OCF0B)) return VECT_TIMER0_COMPB;
+  return 0;
+}
+
+// PB2 falls, for -P.
+static void power_fails() {
+  sense = 0;
+  unsigned char isc = io[IO_MCUCR] & ISC_MASK;
+  if (!(io[IO_DDRB] & 4) && (isc == 1 || isc == 2)) io[IO_GIFR] |= _BV(INTF0);
+  if (slot + 10 < horizon) horizon = slot + 10;
+}
+
+// For -T: whether bit s of the frame for the given minute of the day is a 1.
+// It's always winter, and the date is all 0s, which is even parity.
+static int code_bit(unsigned int minute, unsigned int s) {
+  unsigned int m = minute % 60, h = minute / 60 % 24;
+  unsigned int bcd = (s >= 29) ? (h / 10) << 4 | (h % 10) : (m / 10) << 4 | (m % 10);
+  unsigned int p = 0;
+  if (s == 18 || s == 20) return 1;
+  if (s >= 21 && s <= 27) return (bcd >> (s - 21)) & 1;
+  if (s >= 29 && s <= 34) return (bcd >> (s - 29)) & 1;
+  if (s == 28 || s == 35)
+    for(; bcd != 0; bcd >>= 1) p ^= bcd & 1;
+  return p;
+}
+
+// How long the pulse is, in msec, at the start of the nth second of the run
+// (0 for the minute mark).
+static unsigned int code_width(unsigned long long n) {
+  unsigned long long t = code_start + n;
+  if (t % 60 == 59) return 0;
+  // The bits in each minute are for the next one.
+  return code_bit((t / 60 + 1) % 1440, t % 60) ? 200 : 100;
+}
+
+// Where the signal is at cycle at, and when it next changes.
+static void code_at(unsigned long long at) {
+  unsigned long long n = at / F_CPU;
+  unsigned long long width = code_width(n) * (unsigned long long)F_CPU / 1000;
+  code_level = at - n * F_CPU < width;
+  if (code_level) {
+    code_next = n * F_CPU + width;
+    return;
+  }
+  do n++; while(code_width(n) == 0);
+  code_next = n * F_CPU;
+}
+
+// For -S: PB2 goes up at the start of a true second, or back down.
+static void pps_edge() {
+  unsigned char isc = io[IO_MCUCR] & ISC_MASK;
+  if (!pps_rising) {
+    pps_level = 0;
+    if (!(io[IO_DDRB] & 4) && (isc == 1 || isc == 2)) io[IO_GIFR] |= _BV(INTF0);
+    pps_rising = 1;
+    pps_next = (unsigned long long)((++pps_n + PPS_AT) * pps_second);
+    return;
+  }
+  if (slot < pps_from || slot >= pps_to) {
+    pps_level = 1;
+    if (!(io[IO_DDRB] & 4) && (isc == 1 || isc == 3)) io[IO_GIFR] |= _BV(INTF0);
+  }
+  pps_rising = 0;
+  pps_next = (unsigned long long)((pps_n + PPS_AT + PPS_WIDTH) * pps_second);
+}
+
+static void pps_add(struct pps_spread *s, double x) {
+  if (s->n == 0 || x < s->lo) s->lo = x;
+  if (s->n == 0 || x > s->hi) s->hi = x;
+  s->n++;
+  double d = x - s->mean;
+  s->mean += d / s->n;
+  s->m2 += d * (x - s->mean);
+}
+
+// For -S: where a tick came against the true seconds, in msec, without
+// wrapping.
+static void pps_tick() {
+  double t = cycle / pps_second - PPS_AT;
+  double ms = (t - floor(t)) * 1000;
+  if (isnan(pps_last)) pps_last = ms;
+  if (ms - pps_last > 500) pps_unwrap -= 1000;
+  if (ms - pps_last < -500) pps_unwrap += 1000;
+  pps_last = ms;
+  ms += pps_unwrap;
+  if (pps_from != NEVER && slot < pps_from && slot + 36000 >= pps_from) pps_add(&pps_before, ms);
+  if (slot >= pps_from && slot < pps_to) pps_drift = ms - pps_before.mean;
+  if (slot >= horizon / 2 && (slot < pps_from || slot >= pps_to + 36000)) pps_add(&pps_settled, ms);
+}
+
+// Bring everything up to now, and work out when to do it next.
+static void events() {
+  timer_sync();
+  if (cycle - slot_cycle >= STUCK_CYCLES) fault("no slot has gone by for ten minutes");
+  next_event = timer_next();
+  if (slot_cycle + STUCK_CYCLES < next_event) next_event = slot_cycle + STUCK_CYCLES;
+  if (cycle >= adc_done) {
+    io[IO_ADCL] = ADC_VALUE & 0xff;
+    io[IO_ADCH] = ADC_VALUE >> 8;
+    io[IO_ADCSRA] = (io[IO_ADCSRA] & ~_BV(ADSC)) | _BV(ADIF);
+    adc_done = NEVER;
+  }
+  if (adc_done < next_event) next_event = adc_done;
+  if ((io[IO_EECR] & _BV(EERIE)) && cycle < ee_busy && ee_busy < next_event) next_event = ee_busy;
+  if (fail_slot != NEVER && fail_at == NEVER && slot >= fail_slot) fail_at = slot_cycle + fail_cycles;
+  if (sense == 1 && cycle >= fail_at) power_fails();
+  if (sense == 1 && fail_at < next_event) next_event = fail_at;
+  if (code_start >= 0) {
+    if (cycle >= code_next) {
+      int was = code_level;
+      code_at(cycle);
+      if (code_level != was && !(io[IO_DDRB] & 4) && (io[IO_PCMSK] & 4)) io[IO_GIFR] |= _BV(PCIF);
+    }
+    if (code_next < next_event) next_event = code_next;
+  }
+  if (pps) {
+    if (cycle >= pps_next) pps_edge();
+    if (pps_next < next_event) next_event = pps_next;
+  }
+  irq_pending = (sreg & SREG_I) && interrupt_vector() != 0;
+}
+
+// The tick pins
+
+static void port_changed() {
+  uint8_t now = io[IO_PORTB] & io[IO_DDRB] & (dual ? 7 : 3);
+  if (now == pins) return;
+  if (pins == 0) {
+    pulse_start = cycle;
+    // For DUAL_MOVEMENT, PB0 alone or PB1 and PB2 is the first movement.
+    int second = dual && (now == 4 || now == 3);
+    metrics_tick(slot, &metrics[second]);
+    code_ticks++;
+    if (pps) pps_tick();
+    if (list) printf("%s%llu %llu\n", second ? "  " : "", slot, cycle);
+  } else if (now == 0) {
+    double ms = (cycle - pulse_start) * 1000.0 / F_CPU;
+    if (ms < pulse_min) pulse_min = ms;
+    if (ms > pulse_max) pulse_max = ms;
+  }
+  pins = now;
+}
+
+// -b
+
+static void bench_add(struct bench *b, unsigned long long cycles) {
+  if (b->runs == 0 || cycles < b->best) b->best = cycles;
+  if (cycles > b->worst) b->worst = cycles;
+  b->runs++;
+}
+
+static void marked(uint8_t v) {
+  unsigned long long now = cycle - away;
+  if (mark != 0) bench_add(&marks[mark], now - mark_start);
+  mark = v;
+  mark_start = now;
+}
+
+static void bench_print(const char *what, const struct bench *b, int count) {
+  for(int i = 0; i < count; i++)
+    if (b[i].runs != 0)
+      printf("%s%d runs=%llu best=%llu worst=%llu\n", what, i, b[i].runs, b[i].best, b[i].worst);
+}
+
+// I/O registers
+
+static uint8_t io_read(uint8_t a) {
+  switch(a) {
+    case IO_TCNT0:
+    case IO_TIFR:
+      timer_sync();
+      break;
+    case IO_PINB:
+      if (sense >= 0 && !(io[IO_DDRB] & 4)) return (io[IO_PORTB] & ~4) | (sense << 2);
+      if (code_start >= 0 && !(io[IO_DDRB] & 4)) return (io[IO_PORTB] & ~4) | (code_level << 2);
+      if (pps && !(io[IO_DDRB] & 4)) return (io[IO_PORTB] & ~4) | (pps_level << 2);
+      return io[IO_PORTB];
+    case IO_EECR:
+      io[IO_EECR] &= ~(_BV(EEPE) | _BV(EEMPE));
+      if (cycle < ee_busy) io[IO_EECR] |= _BV(EEPE);
+      if (cycle < ee_mpe) io[IO_EECR] |= _BV(EEMPE);
+      break;
+    case IO_SREG: return sreg;
+    case IO_SPL: return sp & 0xff;
+    case IO_SPH: return sp >> 8;
+  }
+  return io[a];
+}
+
+static void io_write(uint8_t a, uint8_t v) {
+  switch(a) {
+    case IO_TCNT0:
+      timer_sync();
+      io[a] = v;
+      compare_blocked = 1;
+      slot = 0;
+      slot_cycle = cycle;
+      break;
+    case IO_TCCR0A:
+    case IO_TCCR0B:
+    case IO_OCR0A:
+    case IO_OCR0B:
+      timer_sync();
+      io[a] = v;
+      if (a == IO_TCCR0B) {
+        static const unsigned int prescales[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+        if ((v & 7) >= 6) fault("Timer0's external clock isn't modelled");
+        prescale = prescales[v & 7];
+      }
+      if ((io[IO_TCCR0A] & 3) == 1) fault("phase correct PWM isn't modelled");
+      break;
+    case IO_GTCCR:
+      timer_sync();
+      if (v & 1) prescale_base = timer_cycle = cycle;
+      io[a] = v & ~1;
+      break;
+    case IO_TIFR:
+      timer_sync();
+      io[a] &= ~v;
+      break;
+    case IO_GIFR:
+      io[a] &= ~v;
+      return;
+    case IO_GIMSK:
+      io[a] = v;
+      break;
+    case IO_PINB:
+      io[IO_PORTB] ^= v;
+      port_changed();
+      return;
+    case IO_PORTB:
+    case IO_DDRB:
+      io[a] = v;
+      port_changed();
+      return;
+    case IO_EECR: {
+      uint8_t was = io_read(IO_EECR);
+      unsigned int address = (io[IO_EEARL] | (io[IO_EEARH] << 8)) % EEPROM_SIZE;
+      // The mode bits can't change during a write. EEPE and EEMPE are
+      // worked out from the time when they're read.
+      io[a] = ((cycle < ee_busy) ? was & 0x30 : v & 0x30) | (v & _BV(EERIE));
+      if (v & _BV(EEMPE)) ee_mpe = cycle + 4;
+      if ((v & _BV(EEPE)) && (was & _BV(EEMPE)) && cycle >= ee_busy) {
+        // Erase and write take 3.4 msec; just one or the other, 1.8.
+        unsigned char mode = (io[a] >> 4) & 3;
+        if (mode != 2) eeprom[address] = 0xff;
+        if (mode != 1) eeprom[address] &= io[IO_EEDR];
+        ee_busy = cycle + (unsigned long long)(mode == 0 ? 3.4e-3 * F_CPU : 1.8e-3 * F_CPU);
+        if (cycle >= fail_at) {
+          fail_writes++;
+          fail_done = ee_busy;
+        }
+      }
+      if (v & _BV(EERE)) {
+        if (cycle < ee_busy) fault("EEPROM read while it's busy writing");
+        io[IO_EEDR] = eeprom[address];
+        cycle += 4;
+      }
+      break;
+    }
+    case IO_ADCSRA:
+      // Writing a one to ADIF clears it.
+      io[a] = (v & ~_BV(ADIF)) | (io[a] & _BV(ADIF) & ~v);
+      if ((v & _BV(ADSC)) && (v & _BV(ADEN)) && adc_done == NEVER) {
+        // 13 ADC clocks, at the prescaler's division of the CPU clock.
+        unsigned int divide = 1 << (v & 7);
+        adc_done = cycle + 13 * (divide < 2 ? 2 : divide);
+      }
+      break;
+    case IO_CLKPR:
+      if ((v & _BV(CLKPCE)) == 0 && (v & 0xf) != 0) fault("the clock prescaler isn't modelled");
+      io[a] = v;
+      return;
+    case IO_SREG:
+      if (v & ~sreg & SREG_I) irq_held = cycle;
+      sreg = v;
+      break;
+    case IO_SPL:
+      sp = (sp & 0xff00) | v;
+      return;
+    case IO_SPH:
+      sp = (sp & 0xff) | (v << 8);
+      return;
+    case IO_GPIOR0:
+      io[a] = v;
+      if (bench) marked(v);
+      return;
+    default:
+      io[a] = v;
+      return;
+  }
+  // Something that might change when the next event or interrupt is.
+  events();
+}
+
+// Data memory
+
+static inline uint8_t load(uint16_t a) {
+  if (a >= SRAM_START) {
+    if (a > RAMEND) fault("read past the end of RAM");
+    return data[a];
+  }
+  return (a < 0x20) ? reg[a] : io_read(a - 0x20);
+}
+
+static inline void store(uint16_t a, uint8_t v) {
+  if (a >= SRAM_START) {
+    if (a > RAMEND) fault("write past the end of RAM");
+    data[a] = v;
+  } else if (a < 0x20)
+    reg[a] = v;
+  else
+    io_write(a - 0x20, v);
+}
+
+static inline void push(uint8_t v) {
+  if (sp < SRAM_START || sp > RAMEND) fault("stack overflow");
+  data[sp--] = v;
+}
+
+static inline uint8_t pop() {
+  if (sp >= RAMEND) fault("stack underflow");
+  return data[++sp];
+}
+
+static inline void push_pc(uint16_t to) {
+  push(to & 0xff);
+  push(to >> 8);
+}
+
+static inline uint16_t pop_pc() {
+  uint16_t hi = pop();
+  return ((hi << 8) | pop()) & PC_MASK;
+}
+
+#define X (reg[26] | (reg[27] << 8))
+#define Y (reg[28] | (reg[29] << 8))
+#define Z (reg[30] | (reg[31] << 8))
+#define SET_PAIR(n, v) do { uint16_t _v = (v); reg[n] = _v & 0xff; reg[(n) + 1] = _v >> 8; } while(0)
+
+// The flags for the arithmetic. S is always N ^ V.
+static inline void flags_nzs(uint8_t r, uint8_t keep, uint8_t v) {
+  uint8_t n = (r & 0x80) ? SREG_N : 0;
+  v = v ? SREG_V : 0;
+  sreg = (sreg & keep) | n | v | (r == 0 ? SREG_Z : 0) | (((n != 0) ^ (v != 0)) ? SREG_S : 0);
+}
+
+static inline uint8_t add(uint8_t d, uint8_t r, uint8_t carry) {
+  uint8_t s = d + r + carry;
+  uint8_t c = (d & r) | (r & ~s) | (~s & d);
+  flags_nzs(s, ~(SREG_C | SREG_Z | SREG_N | SREG_V | SREG_S | SREG_H),
+    ((d & r & ~s) | (~d & ~r & s)) & 0x80);
+  sreg |= ((c & 0x80) ? SREG_C : 0) | ((c & 0x08) ? SREG_H : 0);
+  return s;
+}
+
+// keep_z is for SBC and CPC, where Z can only go from set to clear.
+static inline uint8_t sub(uint8_t d, uint8_t r, uint8_t carry, int keep_z) {
+  uint8_t s = d - r - carry;
+  uint8_t c = (~d & r) | (r & s) | (s & ~d);
+  uint8_t z = sreg & SREG_Z;
+  flags_nzs(s, ~(SREG_C | SREG_Z | SREG_N | SREG_V | SREG_S | SREG_H),
+    ((d & ~r & ~s) | (~d & r & s)) & 0x80);
+  sreg |= ((c & 0x80) ? SREG_C : 0) | ((c & 0x08) ? SREG_H : 0);
+  if (keep_z && s == 0 && !z) sreg &= ~SREG_Z;
+  return s;
+}
+
+static inline void logic(uint8_t r) {
+  flags_nzs(r, ~(SREG_Z | SREG_N | SREG_V | SREG_S), 0);
+}
+
+// Shifts right. C is the bit that fell off, V is N ^ C.
+static inline uint8_t shift(uint8_t d, uint8_t r) {
+  uint8_t n = r & 0x80, c = d & 1;
+  flags_nzs(r, ~(SREG_C | SREG_Z | SREG_N | SREG_V | SREG_S), (n != 0) ^ c);
+  sreg |= c ? SREG_C : 0;
+  return r;
+}
+
+// Skip the next instruction, however long it is.
+static inline void skip() {
+  unsigned int words = prog[pc].words;
+  pc = (pc + words) & PC_MASK;
+  cycle += words;
+}
+
+static void interrupt(int vector) {
+  if (asleep) {
+    cycle += 4; // waking up takes longer
+    asleep = 0;
+    woke = cycle;
+    away += cycle - slept_at;
+  } else
+    overruns++;
+  sreg &= ~SREG_I;
+  if (vector == VECT_TIMER0_OVF) io[IO_TIFR] &= ~_BV(TOV0);
+  if (vector == VECT_TIMER0_COMPA) io[IO_TIFR] &= ~_BV(OCF0A);
+  if (vector == VECT_TIMER0_COMPB) io[IO_TIFR] &= ~_BV(OCF0B);
+  if (vector == VECT_ADC) io[IO_ADCSRA] &= ~_BV(ADIF);
+  if (vector == VECT_INT0) io[IO_GIFR] &= ~_BV(INTF0);
+  if (vector == VECT_PCINT0) io[IO_GIFR] &= ~_BV(PCIF);
+  if (bench) {
+    isr_vector = vector;
+    isr_start = cycle;
+  }
+  push_pc(pc);
+  pc = vector;
+  cycle += 4;
+  irq_pending = 0;
+}
+
+static void snapshot();
+
+// This is where the time goes by: straight to the next event, until one
+// of them is an interrupt.
+static void sleep_on() {
+  while(interrupt_vector() == 0) {
+    cycle = next_event;
+    events();
+    if (slot >= next_snapshot) snapshot();
+    if (slot >= horizon) return;
+  }
+  if (!(sreg & SREG_I)) {
+    // It wakes up, but carries on right after the SLEEP.
+    asleep = 0;
+    woke = cycle;
+    away += cycle - slept_at;
+  }
+}
+
+static void go_to_sleep() {
+  if (!(io[IO_MCUCR] & _BV(SE))) return;
+  if (audit) exit(audit_report(1));
+  if (io[IO_MCUCR] & SM_MASK) fault("only idle sleep is modelled");
+  if (woke != NEVER) {
+    unsigned long awake = cycle - woke;
+    if (awake > awake_max) awake_max = awake;
+    awake_total += awake;
+    wakes++;
+  }
+  asleep = 1;
+  slept_at = cycle;
+  sleep_on();
+}
+
+static void run() {
+  // Carrying on from a snapshot, which is always taken asleep.
+  if (asleep) {
+    sleep_on();
+    goto resume;
+  }
+  while(slot < horizon) {
+    const struct op *o = &prog[pc];
+    uint8_t d = o->d, r = o->r, *rd = &reg[d];
+    uint16_t a;
+    pc = (pc + 1) & PC_MASK;
+    cycle++;
+    switch(o->code) {
+      case OP_BAD:
+        pc = (pc - 1) & PC_MASK;
+        fault(flash[2 * pc] == 0xff && flash[2 * pc + 1] == 0xff
+          ? "ran into empty flash" : "not an ATtiny45 instruction");
+      case OP_NOP: case OP_WDR: break;
+      case OP_MOVW: reg[d] = reg[r]; reg[d + 1] = reg[r + 1]; break;
+      case OP_ADD: *rd = add(*rd, reg[r], 0); break;
+      case OP_ADC: *rd = add(*rd, reg[r], sreg & SREG_C); break;
+      case OP_SUB: *rd = sub(*rd, reg[r], 0, 0); break;
+      case OP_SBC: *rd = sub(*rd, reg[r], sreg & SREG_C, 1); break;
+      case OP_CP: sub(*rd, reg[r], 0, 0); break;
+      case OP_CPC: sub(*rd, reg[r], sreg & SREG_C, 1); break;
+      case OP_CPI: sub(*rd, o->k, 0, 0); break;
+      case OP_SUBI: *rd = sub(*rd, o->k, 0, 0); break;
+      case OP_SBCI: *rd = sub(*rd, o->k, sreg & SREG_C, 1); break;
+      case OP_AND: logic(*rd &= reg[r]); break;
+      case OP_ANDI: logic(*rd &= o->k); break;
+      case OP_OR: logic(*rd |= reg[r]); break;
+      case OP_ORI: logic(*rd |= o->k); break;
+      case OP_EOR: logic(*rd ^= reg[r]); break;
+      case OP_MOV: *rd = reg[r]; break;
+      case OP_LDI: *rd = o->k; break;
+      case OP_CPSE: if (*rd == reg[r]) skip(); break;
+      case OP_COM:
+        logic(*rd = ~*rd);
+        sreg |= SREG_C;
+        break;
+      case OP_NEG: *rd = sub(0, *rd, 0, 0); break;
+      case OP_SWAP: *rd = (*rd << 4) | (*rd >> 4); break;
+      case OP_INC:
+        ++*rd;
+        flags_nzs(*rd, ~(SREG_Z | SREG_N | SREG_V | SREG_S), *rd == 0x80);
+        break;
+      case OP_DEC:
+        --*rd;
+        flags_nzs(*rd, ~(SREG_Z | SREG_N | SREG_V | SREG_S), *rd == 0x7f);
+        break;
+      case OP_ASR: *rd = shift(*rd, (*rd >> 1) | (*rd & 0x80)); break;
+      case OP_LSR: *rd = shift(*rd, *rd >> 1); break;
+      case OP_ROR: *rd = shift(*rd, (*rd >> 1) | ((sreg & SREG_C) << 7)); break;
+      case OP_ADIW:
+      case OP_SBIW: {
+        uint16_t was = reg[d] | (reg[d + 1] << 8);
+        uint16_t now = (o->code == OP_ADIW) ? was + o->k : was - o->k;
+        SET_PAIR(d, now);
+        uint8_t c = (o->code == OP_ADIW) ? (was & ~now) >> 15 : (now & ~was) >> 15;
+        uint8_t v = (o->code == OP_ADIW) ? (~was & now) >> 15 : (was & ~now) >> 15;
+        uint8_t n = now >> 15;
+        sreg = (sreg & ~(SREG_C | SREG_Z | SREG_N | SREG_V | SREG_S)) | (c ? SREG_C : 0)
+          | (now == 0 ? SREG_Z : 0) | (n ? SREG_N : 0) | (v ? SREG_V : 0) | ((n ^ v) ? SREG_S : 0);
+        cycle++;
+        break;
+      }
+      case OP_BSET:
+        if (r == 7 && !(sreg & SREG_I)) irq_held = cycle;
+        sreg |= 1 << r;
+        if (r == 7) events();
+        break;
+      case OP_BCLR:
+        sreg &= ~(1 << r);
+        if (r == 7) irq_pending = 0;
+        break;
+      case OP_BST: sreg = (sreg & ~SREG_T) | ((*rd >> r) & 1 ? SREG_T : 0); break;
+      case OP_BLD: *rd = (*rd & ~(1 << r)) | ((sreg & SREG_T) ? 1 << r : 0); break;
+      case OP_SBRC: if (!(*rd & (1 << r))) skip(); break;
+      case OP_SBRS: if (*rd & (1 << r)) skip(); break;
+      case OP_BRBS:
+        if (sreg & (1 << r)) {
+          pc = (pc + o->k) & PC_MASK;
+          cycle++;
+        }
+        break;
+      case OP_BRBC:
+        if (!(sreg & (1 << r))) {
+          pc = (pc + o->k) & PC_MASK;
+          cycle++;
+        }
+        break;
+      case OP_RJMP:
+        pc = (pc + o->k) & PC_MASK;
+        cycle++;
+        break;
+      case OP_RCALL:
+        push_pc(pc);
+        pc = (pc + o->k) & PC_MASK;
+        cycle += 2;
+        break;
+      case OP_JMP:
+        pc = (uint16_t)o->k & PC_MASK;
+        cycle += 2;
+        break;
+      case OP_CALL:
+        push_pc(pc + 1);
+        pc = (uint16_t)o->k & PC_MASK;
+        cycle += 3;
+        break;
+      case OP_IJMP:
+        pc = Z & PC_MASK;
+        cycle++;
+        break;
+      case OP_ICALL:
+        push_pc(pc);
+        pc = Z & PC_MASK;
+        cycle += 2;
+        break;
+      case OP_RET:
+        pc = pop_pc();
+        cycle += 3;
+        break;
+      case OP_RETI:
+        pc = pop_pc();
+        cycle += 3;
+        sreg |= SREG_I;
+        irq_held = cycle;
+        if (isr_vector != 0) {
+          bench_add(&isrs[isr_vector], cycle - isr_start);
+          away += cycle - isr_start;
+          isr_vector = 0;
+        }
+        events();
+        break;
+      case OP_IN: *rd = io_read(o->k); break;
+      case OP_OUT: io_write(o->k, *rd); break;
+      case OP_SBI:
+      case OP_CBI:
+        // The PINB bits toggle on their own.
+        if (o->k == IO_PINB) io_write(IO_PINB, (o->code == OP_SBI) ? 1 << r : 0);
+        else io_write(o->k, (o->code == OP_SBI) ? io_read(o->k) | (1 << r) : io_read(o->k) & ~(1 << r));
+        cycle++;
+        break;
+      case OP_SBIC: if (!(io_read(o->k) & (1 << r))) skip(); break;
+      case OP_SBIS: if (io_read(o->k) & (1 << r)) skip(); break;
+      case OP_LDS:
+        *rd = load((uint16_t)o->k);
+        pc = (pc + 1) & PC_MASK;
+        cycle++;
+        break;
+      case OP_STS:
+        store((uint16_t)o->k, *rd);
+        pc = (pc + 1) & PC_MASK;
+        cycle++;
+        break;
+      case OP_LDD_Y: *rd = load(Y + o->k); cycle++; break;
+      case OP_LDD_Z: *rd = load(Z + o->k); cycle++; break;
+      case OP_STD_Y: store(Y + o->k, *rd); cycle++; break;
+      case OP_STD_Z: store(Z + o->k, *rd); cycle++; break;
+      case OP_LD_X: *rd = load(X); cycle++; break;
+      case OP_ST_X: store(X, *rd); cycle++; break;
+      // For the pre-decrement and post-increment ones, the pointer is
+      // updated first, in case it's also the register being loaded.
+      case OP_LD_XP: a = X; SET_PAIR(26, a + 1); *rd = load(a); cycle++; break;
+      case OP_LD_YP: a = Y; SET_PAIR(28, a + 1); *rd = load(a); cycle++; break;
+      case OP_LD_ZP: a = Z; SET_PAIR(30, a + 1); *rd = load(a); cycle++; break;
+      case OP_LD_MX: a = X - 1; SET_PAIR(26, a); *rd = load(a); cycle++; break;
+      case OP_LD_MY: a = Y - 1; SET_PAIR(28, a); *rd = load(a); cycle++; break;
+      case OP_LD_MZ: a = Z - 1; SET_PAIR(30, a); *rd = load(a); cycle++; break;
+      case OP_ST_XP: a = X; store(a, *rd); SET_PAIR(26, a + 1); cycle++; break;
+      case OP_ST_YP: a = Y; store(a, *rd); SET_PAIR(28, a + 1); cycle++; break;
+      case OP_ST_ZP: a = Z; store(a, *rd); SET_PAIR(30, a + 1); cycle++; break;
+      case OP_ST_MX: a = X - 1; SET_PAIR(26, a); store(a, *rd); cycle++; break;
+      case OP_ST_MY: a = Y - 1; SET_PAIR(28, a); store(a, *rd); cycle++; break;
+      case OP_ST_MZ: a = Z - 1; SET_PAIR(30, a); store(a, *rd); cycle++; break;
+      case OP_LPM0: reg[0] = flash[Z % FLASH_SIZE]; cycle += 2; break;
+      case OP_LPM: *rd = flash[Z % FLASH_SIZE]; cycle += 2; break;
+      case OP_LPM_ZP: a = Z; SET_PAIR(30, a + 1); *rd = flash[a % FLASH_SIZE]; cycle += 2; break;
+      case OP_PUSH: push(*rd); cycle++; break;
+      case OP_POP: *rd = pop(); cycle++; break;
+      case OP_SLEEP: go_to_sleep(); break;
+      case OP_BREAK:
+        pc = (pc - 1) & PC_MASK;
+        if (!test) fault("BREAK");
+        cycle--;
+        return;
+      case OP_SPM: pc = (pc - 1) & PC_MASK; fault("SPM isn't modelled");
+    }
+resume:
+    if (cycle >= next_event) events();
+    if (irq_pending && irq_held != cycle) interrupt(interrupt_vector());
+  }
+}
+
+// Snapshots
+
+#define SNAPSHOT_MAGIC "emusnap2"
+
+// Everything that changes as the chip runs, apart from the metrics.
+static const struct {
+  void *at;
+  size_t size;
+} state[] = {
+  { data, sizeof(data) }, { eeprom, sizeof(eeprom) },
+  { &pc, sizeof(pc) }, { &sp, sizeof(sp) }, { &sreg, sizeof(sreg) }, { &cycle, sizeof(cycle) },
+  { &prescale, sizeof(prescale) }, { &prescale_base, sizeof(prescale_base) },
+  { &timer_cycle, sizeof(timer_cycle) }, { &compare_blocked, sizeof(compare_blocked) },
+  { &ee_busy, sizeof(ee_busy) }, { &ee_mpe, sizeof(ee_mpe) }, { &adc_done, sizeof(adc_done) },
+  { &next_event, sizeof(next_event) }, { &irq_pending, sizeof(irq_pending) },
+  { &irq_held, sizeof(irq_held) }, { &asleep, sizeof(asleep) },
+  { &slot, sizeof(slot) }, { &slot_cycle, sizeof(slot_cycle) }, { &dual, sizeof(dual) },
+  { &pins, sizeof(pins) }, { &pulse_start, sizeof(pulse_start) },
+  { &pulse_min, sizeof(pulse_min) }, { &pulse_max, sizeof(pulse_max) },
+  { &woke, sizeof(woke) }, { &awake_total, sizeof(awake_total) }, { &wakes, sizeof(wakes) },
+  { &overruns, sizeof(overruns) }, { &lost, sizeof(lost) }, { &awake_max, sizeof(awake_max) },
+};
+
+static void snapshot() {
+  char path[1024], temp[1100];
+  snprintf(path, sizeof(path), "%s-%llu.snap", snapshot_prefix, slot);
+  snprintf(temp, sizeof(temp), "%s.tmp", path);
+  FILE *f = fopen(temp, "wb");
+  if (f == NULL) {
+    perror(temp);
+    exit(1);
+  }
+  uint16_t crc = build_crc(flash, FLASH_SIZE);
+  fwrite(SNAPSHOT_MAGIC, 1, 8, f);
+  fwrite(&crc, sizeof(crc), 1, f);
+  for(unsigned int i = 0; i < sizeof(state) / sizeof(state[0]); i++)
+    fwrite(state[i].at, state[i].size, 1, f);
+  int failed = 0;
+  for(int i = 0; i <= dual; i++) failed |= metrics_save(f, &metrics[i]);
+  if (fclose(f) != 0 || failed || rename(temp, path) != 0) {
+    perror(path);
+    exit(1);
+  }
+  next_snapshot = (slot / snapshot_every + 1) * snapshot_every;
+}
+
+static int restore(const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    perror(path);
+    return 1;
+  }
+  char magic[8];
+  uint16_t crc;
+  int want_dual = dual, failed = fread(magic, 1, 8, f) != 8 || memcmp(magic, SNAPSHOT_MAGIC, 8) != 0
+    || fread(&crc, sizeof(crc), 1, f) != 1;
+  if (!failed && crc != build_crc(flash, FLASH_SIZE)) {
+    fprintf(stderr, "%s is of a different .hex\n", path);
+    fclose(f);
+    return 1;
+  }
+  for(unsigned int i = 0; !failed && i < sizeof(state) / sizeof(state[0]); i++)
+    failed = fread(state[i].at, state[i].size, 1, f) != 1;
+  for(int i = 0; !failed && i <= dual; i++) failed = metrics_load(f, &metrics[i]);
+  failed |= getc(f) != EOF;
+  fclose(f);
+  if (failed) {
+    fprintf(stderr, "%s isn't a snapshot\n", path);
+    return 1;
+  }
+  if (dual != want_dual) {
+    fprintf(stderr, "%s is %s a dual movement\n", path, dual ? "of" : "not of");
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  unsigned long seed = 1, rate_num = 1, rate_den = 10;
+  const char *ee_path = NULL, *restore_path = NULL;
+  int first_start = 0;
+  int c;
+
+  horizon = 864000ULL * 10;
+  while((c = getopt(argc, argv, "n:s:r:e:F2labtP:T:S:c:C:R:")) != -1) {
+    switch(c) {
+      case 'n': horizon = strtoull(optarg, NULL, 0); break;
+      case 's': seed = strtoul(optarg, NULL, 0); break;
+      case 'r':
+        if (sscanf(optarg, "%lu/%lu", &rate_num, &rate_den) != 2 || rate_den == 0) goto usage;
+        break;
+      case 'e': ee_path = optarg; break;
+      case 'F': first_start = 1; break;
+      case '2': dual = 1; break;
+      case 'l': list = 1; break;
+      case 'a': audit = 1; break;
+      case 'b': bench = 1; break;
+      case 't': test = 1; horizon = NEVER; break;
+      case 'P':
+        if (sscanf(optarg, "%llu+%llu", &fail_slot, &fail_cycles) < 1) goto usage;
+        sense = 1;
+        break;
+      case 'T': {
+        unsigned int h, m, sec;
+        if (sscanf(optarg, "%u:%u:%u", &h, &m, &sec) != 3 || m > 59 || sec > 59) goto usage;
+        code_start = ((h % 24) * 60L + m) * 60 + sec;
+        break;
+      }
+      case 'S': {
+        double ppm;
+        int got = sscanf(optarg, "%lf,%llu-%llu", &ppm, &pps_from, &pps_to);
+        if (got != 1 && got != 3) goto usage;
+        if (got == 1) pps_from = pps_to = NEVER;
+        pps_second = F_CPU * (1 + ppm * 1e-6);
+        pps = pps_rising = 1;
+        pps_next = (unsigned long long)(PPS_AT * pps_second);
+        break;
+      }
+      case 'c': snapshot_every = strtoull(optarg, NULL, 0); break;
+      case 'C': snapshot_prefix = optarg; break;
+      case 'R': restore_path = optarg; break;
+      default: goto usage;
+    }
+  }
+  if (argc - optind != 1 || ((bench || test) && restore_path != NULL)) goto usage;
+  if (code_start >= 0 && (dual || restore_path != NULL || sense >= 0)) goto usage;
+  if (pps && (dual || restore_path != NULL || sense >= 0 || code_start >= 0)) goto usage;
+
+  memset(flash, 0xff, sizeof(flash));
+  long end = build_read_hex(argv[optind], flash, NULL, FLASH_SIZE);
+  if (end < 0) return 1;
+  for(unsigned int i = 0; i < FLASH_SIZE / 2; i++) decode(i);
+
+  metrics_init(&metrics[0], rate_num, rate_den);
+  metrics_init(&metrics[1], rate_num, rate_den);
+  if (restore_path != NULL) {
+    if (restore(restore_path)) return 1;
+    if (ee_path != NULL && build_read_hex(ee_path, eeprom, NULL, EEPROM_SIZE) < 0) return 1;
+  } else {
+    memset(eeprom, 0xff, sizeof(eeprom));
+    eeprom[4] = eeprom[5] = 0;
+    if (ee_path != NULL && build_read_hex(ee_path, eeprom, NULL, EEPROM_SIZE) < 0) return 1;
+    for(int i = 0; i < 4; i++) eeprom[i] = seed >> (8 * i);
+    if (!first_start) {
+      const uint8_t *trailer = flash + FLASH_SIZE - BUILD_TRAILER_SIZE;
+      memcpy(eeprom + EE_BUILD_LOC, trailer, 4);
+      memcpy(eeprom + EE_BUILD_LOC + 4, trailer + 6, 2);
+    }
+    sp = RAMEND;
+    next_event = STUCK_CYCLES;
+  }
+  if (snapshot_every != 0) next_snapshot = (slot / snapshot_every + 1) * snapshot_every;
+  unsigned long long first_cycle = cycle;
+  clock_t started = clock();
+  run();
+  double seconds = (double)(clock() - started) / CLOCKS_PER_SEC;
+  if (audit) return audit_report(0);
+  if (test) {
+    for(int i = 0; i < 32; i++) printf("r%d=%02x ", i, reg[i]);
+    printf("sreg=%02x sp=%03x pc=%04x cycles=%llu\n", sreg, sp, pc * 2, cycle);
+    if (!bench) return 0;
+  }
+  if (bench) {
+    bench_print("mark", marks, sizeof(marks) / sizeof(marks[0]));
+    bench_print("isr", isrs, sizeof(isrs) / sizeof(isrs[0]));
+    return 0;
+  }
+
+  for(int i = 0; i <= dual; i++) {
+    metrics_finish(&metrics[i], horizon);
+    metrics_print(stdout, &metrics[i]);
+  }
+  printf("awake_max=%lu awake_mean=%.1f overruns=%llu lost=%llu pulse_min=%.2f pulse_max=%.2f speed=%.0f\n",
+    awake_max, wakes == 0 ? 0 : (double)awake_total / wakes, overruns, lost,
+    pulse_max == 0 ? 0 : pulse_min, pulse_max,
+    seconds > 0 ? (double)(cycle - first_cycle) / F_CPU / seconds : 0);
+  if (sense == 1) {
+    fprintf(stderr, "emu: the run ended before PB2 fell\n");
+    return 1;
+  }
+  if (sense == 0)
+    printf("power_fail: writes=%u checkpoint_ms=%.2f\n", fail_writes,
+      fail_writes == 0 ? 0 : (fail_done - fail_at) * 1000.0 / F_CPU);
+  if (code_start >= 0) {
+    long hands = code_ticks % 43200, want = (code_start + slot / 10) % 43200;
+    long off = (hands - want + 43200 + 21600) % 43200 - 21600;
+    printf("time_code: hands=%ld:%02ld:%02ld want=%ld:%02ld:%02ld off=%ld\n", hands / 3600,
+      hands / 60 % 60, hands % 60, want / 3600, want / 60 % 60, want % 60, off);
+  }
+  if (pps) {
+    printf("pps: p2p=%.2f rms=%.2f", pps_settled.hi - pps_settled.lo,
+      pps_settled.n > 1 ? sqrt(pps_settled.m2 / (pps_settled.n - 1)) : 0);
+    if (pps_from != NEVER) printf(" drift=%.2f", pps_drift);
+    printf("\n");
+  }
+  return 0;
+
+usage:
+  fprintf(stderr, "usage: %s [-n slots] [-s seed] [-r num/den] [-e eeprom.hex] [-F] [-2] [-l] [-a] [-b] [-t]"
+    " [-P slot[+cycles]] [-T h:mm:ss] [-S ppm[,from-to]] [-c every [-C prefix]] [-R snapshot] file.hex\n",
+    argv[0]);
+  return 1;
+}
@@ -0,0 +1,336 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * The emulator's own tests, for 'make emutest'.
+ *
+ * emutest [test ...]
+ *
+ * Each test is a little image, assembled by hand with the macros below,
+ * which follow the opcode formats in Atmel's AVR instruction set manual.
+ * Each one says what the registers, the flags and the cycle count have to
+ * be once it gets to its BREAK. Those were worked out from the manual and
+ * the ATtiny45 datasheet, not from emu.c. The test writes each image out
+ * as emutest.hex, runs './emu -t' on it, and compares each name=value it
+ * wants with what emu printed. For a line like "mark1 runs=1 best=3", the
+ * names are mark1.runs and so on. With no arguments, it runs every test.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Two registers, 0000 ooor dddd rrrr.
+#define TWO(op, d, r) ((op) | (((r) & 0x10) << 5) | ((d) << 4) | ((r) & 0xf))
+#define ADD(d, r) TWO(0x0c00, d, r)
+#define ADC(d, r) TWO(0x1c00, d, r)
+#define SUB(d, r) TWO(0x1800, d, r)
+#define CP(d, r) TWO(0x1400, d, r)
+#define CPC(d, r) TWO(0x0400, d, r)
+#define CPSE(d, r) TWO(0x1000, d, r)
+#define AND(d, r) TWO(0x2000, d, r)
+#define EOR(d, r) TWO(0x2400, d, r)
+// A register from 16 up and a constant, oooo KKKK dddd KKKK.
+#define IMM(op, d, k) ((op) | (((k) & 0xf0) << 4) | (((d) - 16) << 4) | ((k) & 0xf))
+#define LDI(d, k) IMM(0xe000, d, k)
+#define ORI(d, k) IMM(0x6000, d, k)
+#define ANDI(d, k) IMM(0x7000, d, k)
+// One register, 1001 010d dddd oooo (and the loads, stores, PUSH and POP).
+#define ONE(op, d) ((op) | ((d) << 4))
+#define COM(d) ONE(0x9400, d)
+#define NEG(d) ONE(0x9401, d)
+#define SWAP(d) ONE(0x9402, d)
+#define INC(d) ONE(0x9403, d)
+#define ASR(d) ONE(0x9405, d)
+#define LSR(d) ONE(0x9406, d)
+#define ROR(d) ONE(0x9407, d)
+#define DEC(d) ONE(0x940a, d)
+#define LD_X(d) ONE(0x900c, d)
+#define LD_MX(d) ONE(0x900e, d)
+#define LD_ZP(d) ONE(0x9001, d)
+#define ST_X(r) ONE(0x920c, r)
+#define ST_XP(r) ONE(0x920d, r)
+#define LPM_ZP(d) ONE(0x9005, d)
+#define PUSH(r) ONE(0x920f, r)
+#define POP(d) ONE(0x900f, d)
+// These two take the address in the next word.
+#define LDS(d, k) ONE(0x9000, d), (k)
+#define STS(k, r) ONE(0x9200, r), (k)
+// Y or Z plus a displacement q, 10q0 qqsd dddd yqqq.
+#define DISP(op, d, q) ((op) | (((q) & 0x20) << 8) | (((q) & 0x18) << 7) | ((d) << 4) | ((q) & 7))
+#define LDD_Y(d, q) DISP(0x8008, d, q)
+#define STD_Z(q, r) DISP(0x8200, r, q)
+// The word pairs, r24 to r30, 1001 011o KKdd KKKK.
+#define ADIW(d, k) (0x9600 | (((k) & 0x30) << 2) | ((((d) - 24) / 2) << 4) | ((k) & 0xf))
+#define SBIW(d, k) (0x9700 | (((k) & 0x30) << 2) | ((((d) - 24) / 2) << 4) | ((k) & 0xf))
+#define MOVW(d, r) (0x0100 | (((d) / 2) << 4) | ((r) / 2))
+// I/O, by I/O address.
+#define IN(d, a) (0xb000 | (((a) & 0x30) << 5) | ((d) << 4) | ((a) & 0xf))
+#define OUT(a, r) (0xb800 | (((a) & 0x30) << 5) | ((r) << 4) | ((a) & 0xf))
+#define SBI(a, b) (0x9a00 | ((a) << 3) | (b))
+// Bits, and the branches and skips on them. k is in words, from the next one.
+#define BSET(s) (0x9408 | ((s) << 4))
+#define BST(d, b) (0xfa00 | ((d) << 4) | (b))
+#define BLD(d, b) (0xf800 | ((d) << 4) | (b))
+#define SBRC(r, b) (0xfc00 | ((r) << 4) | (b))
+#define SBRS(r, b) (0xfe00 | ((r) << 4) | (b))
+#define BRBC(s, k) (0xf400 | (((k) & 0x7f) << 3) | (s))
+#define BRNE(k) BRBC(1, k)
+#define RJMP(k) (0xc000 | ((k) & 0xfff))
+#define RCALL(k) (0xd000 | ((k) & 0xfff))
+#define NOP (0x0000)
+#define IJMP (0x9409)
+#define RET (0x9508)
+#define RETI (0x9518)
+#define SLEEP (0x9588)
+#define BREAK (0x9598)
+#define SEC BSET(0)
+#define SEI BSET(7)
+
+// I/O addresses
+#define SREG (0x3f)
+#define SPL (0x3d)
+#define TCCR0B (0x33)
+#define TCNT0 (0x32)
+#define MCUCR (0x35)
+#define TIMSK (0x39)
+#define TCCR0A (0x2a)
+#define OCR0A (0x29)
+#define EECR (0x1c)
+#define EEDR (0x1d)
+#define EEARL (0x1e)
+#define GPIOR0 (0x11)
+
+static const struct test {
+  const char *name;
+  const char *options; // for emu, besides -t
+  uint16_t code[48];
+  const char *want;
+} tests[] = {
+  // The flags from ADD, ADC, SUB, CP, CPC and NEG, each saved with IN.
+  { "arith", "", {
+    LDI(16, 0x7f), LDI(17, 0x01), ADD(16, 17), IN(2, SREG), // 0x80: H, V and N
+    LDI(18, 0xff), LDI(19, 0x01), ADD(18, 19), IN(3, SREG), // 0: C, H and Z
+    LDI(20, 0x00), LDI(21, 0x00), ADC(20, 21), IN(4, SREG), // the carry in, and none out
+    LDI(22, 0x80), LDI(23, 0x01), SUB(22, 23), IN(5, SREG), // 0x7f: H, V and S
+    LDI(24, 0x34), LDI(25, 0x12), LDI(26, 0x34), LDI(27, 0x12),
+    CP(24, 26), CPC(25, 27), IN(6, SREG), // 0x1234 against itself: Z
+    LDI(28, 0x33), CP(24, 28), CPC(25, 27), IN(7, SREG), // 0x1234 - 0x1233: the CPC can't set Z
+    LDI(29, 0x80), NEG(29), IN(8, SREG), // 0x80 is its own negative: C, V and N
+    BREAK,
+  }, "r16=80 r2=2c r18=00 r3=23 r20=01 r4=00 r22=7f r5=38 r6=02 r7=00 r29=80 r8=0d sreg=0d cycles=30" },
+
+  // The logic, the shifts, INC and DEC, and the T flag.
+  { "logic", "", {
+    LDI(16, 0xf0), LDI(17, 0x3c), AND(16, 17), IN(2, SREG),
+    LDI(18, 0xaa), EOR(18, 18), IN(3, SREG), // Z
+    LDI(19, 0x01), COM(19), IN(4, SREG), // C always, N and S
+    LDI(20, 0x81), LSR(20), IN(5, SREG), // C, and V is N ^ C
+    LDI(21, 0x81), ASR(21), IN(6, SREG), // the sign stays
+    SEC, LDI(22, 0x02), ROR(22), IN(7, SREG), // the carry goes in the top
+    LDI(23, 0x80), DEC(23), IN(8, SREG), // V, and C left alone
+    LDI(24, 0x12), SWAP(24), ORI(24, 0x0c), ANDI(24, 0xf7), IN(9, SREG),
+    LDI(25, 0x04), BST(25, 2), LDI(26, 0x00), BLD(26, 7),
+    BREAK,
+  }, "r16=30 r2=00 r18=00 r3=02 r19=fe r4=15 r20=40 r5=19 r21=c0 r6=15 r22=81 r7=0c "
+     "r23=7f r8=18 r24=25 r9=00 r26=80 sreg=40 cycles=32" },
+
+  // ADIW and SBIW, which take two cycles, and MOVW.
+  { "word", "", {
+    LDI(24, 0xff), LDI(25, 0x7f), ADIW(24, 1), IN(2, SREG), // 0x8000: V and N
+    LDI(26, 0x00), LDI(27, 0x00), SBIW(26, 1), IN(3, SREG), // 0xffff: C, N and S
+    LDI(28, 0x01), LDI(29, 0x00), SBIW(28, 1), IN(4, SREG), // Z
+    LDI(30, 0xf0), LDI(31, 0x00), ADIW(30, 0x3f), IN(5, SREG), // the top two bits of K
+    MOVW(0, 24),
+    BREAK,
+  }, "r24=00 r25=80 r2=0c r26=ff r27=ff r3=15 r28=00 r29=00 r4=02 r30=2f r31=01 r5=00 "
+     "r0=00 r1=80 cycles=21" },
+
+  // What branches, skips, calls and jumps cost, taken or not. A skip
+  // over a two word instruction takes one more.
+  { "branch", "", {
+    LDI(16, 3), DEC(16), BRNE(-2), // 1, then 3 + 2 + 2 + 1
+    LDI(17, 5), LDI(18, 5), LDI(20, 0x11),
+    CPSE(17, 18), LDS(19, 0x0060), // 3
+    SBRS(17, 0), LDI(20, 0xee), // 2
+    RCALL(9), // to word 21: 3, then 1 and 4 for the RET
+    RJMP(1), LDI(22, 0xee), // 2
+    LDI(30, 18), LDI(31, 0), IJMP, LDI(23, 0xee), // 2
+    SBRC(17, 1), LDI(23, 0xdd), // 2
+    BREAK,
+    LDI(21, 0x42), RET,
+  }, "r16=00 r19=00 r20=11 r21=42 r22=00 r23=00 sreg=02 sp=15f pc=0028 cycles=33" },
+
+  // Every way there is to get at the RAM, and the flash.
+  { "memory", "", {
+    LDI(26, 0x60), LDI(27, 0x00),
+    LDI(16, 0x11), ST_XP(16), LDI(16, 0x22), ST_XP(16), LDI(16, 0x33), ST_X(16),
+    LD_MX(17), // 0x22, and X is 0x61
+    LDI(28, 0x60), LDI(29, 0x00), LDD_Y(18, 2), // 0x33
+    LDI(30, 0x60), LDI(31, 0x00), LD_ZP(19), // 0x11, and Z is 0x61
+    STD_Z(5, 19), LDS(20, 0x0066), // 0x11
+    STS(0x0070, 17), LDS(21, 0x0070), // 0x22
+    PUSH(21), POP(22),
+    PUSH(16), IN(23, SPL), POP(24),
+    LDI(30, 0x40), LDI(31, 0x00), LPM_ZP(25), 0x95c8, // LPM r0, Z from word 32
+    BREAK,
+    0xbeef,
+  }, "r17=22 r26=61 r27=00 r18=33 r19=11 r20=11 r21=22 r22=22 r23=5e r24=33 "
+     "r25=ef r0=be r30=41 sp=15f cycles=46" },
+
+  // Timer0 counting to 99 in CTC mode at the CPU clock, to wake the CPU
+  // from idle with its compare interrupt. The timer starts at the end of
+  // cycle 13, and matches 100 cycles later. Waking takes 4, the interrupt
+  // 4, and the handler 7 more with its RJMP. Under -b, mark 1 is the SEI,
+  // the SLEEP and the OUT that ends it, and the sleep and the handler
+  // don't count. Any other vector stops at a BREAK that's in the wrong
+  // place.
+  { "timer", "-b", {
+    RJMP(14), BREAK, BREAK, BREAK, BREAK, BREAK, BREAK, BREAK, BREAK, BREAK,
+    RJMP(21), BREAK, BREAK, BREAK, BREAK, // TIMER0_COMPA, to word 32
+    LDI(16, 99), OUT(OCR0A, 16),
+    LDI(16, 0x02), OUT(TCCR0A, 16), // CTC
+    LDI(16, 0x10), OUT(TIMSK, 16), // OCIE0A
+    LDI(16, 0x20), OUT(MCUCR, 16), // idle
+    OUT(TCNT0, 1),
+    LDI(16, 0x01), OUT(TCCR0B, 16), // no prescaler
+    OUT(GPIOR0, 16), SEI, SLEEP, OUT(GPIOR0, 1),
+    IN(17, TCNT0), // 17 timer clocks since the match
+    BREAK,
+    INC(20), RETI,
+  }, "r17=11 r20=01 sreg=80 sp=15f pc=003e cycles=130 "
+     "mark1.runs=1 mark1.best=3 isr10.runs=1 isr10.best=11" },
+
+  // An EEPROM read holds the CPU up for 4 cycles. The seed is at 0.
+  { "eeprom", "-s 42", {
+    LDI(16, 0), OUT(EEARL, 16), SBI(EECR, 0), IN(17, EEDR),
+    BREAK,
+  }, "r17=2a cycles=9" },
+};
+
+#define TESTS (sizeof(tests) / sizeof(tests[0]))
+
+static void write_hex(FILE *f, const uint16_t *code, unsigned int words) {
+  for(unsigned int at = 0; at < words * 2; at += 16) {
+    unsigned int n = (words * 2 - at < 16) ? words * 2 - at : 16;
+    unsigned char sum = n + (at >> 8) + at;
+    fprintf(f, ":%02X%04X00", n, at);
+    for(unsigned int i = at; i < at + n; i++) {
+      unsigned char b = (i & 1) ? code[i / 2] >> 8 : code[i / 2] & 0xff;
+      fprintf(f, "%02X", b);
+      sum += b;
+    }
+    fprintf(f, "%02X\n", (unsigned char)-sum);
+  }
+  fprintf(f, ":00000001FF\n");
+}
+
+// Turn what emu printed into name=value words, one to a line. A line
+// that starts with a name of its own (mark1, isr10) puts it in front of
+// the rest of that line's names.
+static void flatten(const char *out, char *flat, size_t size) {
+  size_t used = 0;
+  flat[0] = '\0';
+  while(*out != '\0') {
+    char line[512], prefix[32] = "";
+    size_t n = strcspn(out, "\n");
+    snprintf(line, sizeof(line), "%.*s", (int)n, out);
+    out += n + (out[n] == '\n');
+    char *word = strtok(line, " ");
+    if (word != NULL && strchr(word, '=') == NULL) {
+      snprintf(prefix, sizeof(prefix), "%s.", word);
+      word = strtok(NULL, " ");
+    }
+    for(; word != NULL; word = strtok(NULL, " "))
+      if (used + strlen(prefix) + strlen(word) + 2 < size)
+        used += sprintf(flat + used, "%s%s\n", prefix, word);
+  }
+}
+
+static int lookup(const char *flat, const char *name, char *got, size_t size) {
+  size_t len = strlen(name);
+  for(const char *p = flat; *p != '\0'; p += strcspn(p, "\n") + 1)
+    if (strncmp(p, name, len) == 0 && p[len] == '=') {
+      snprintf(got, size, "%.*s", (int)strcspn(p + len + 1, "\n"), p + len + 1);
+      return 1;
+    }
+  return 0;
+}
+
+static int run(const struct test *t) {
+  unsigned int words = sizeof(t->code) / sizeof(t->code[0]);
+  while(words > 0 && t->code[words - 1] == 0) words--;
+
+  FILE *f = fopen("emutest.hex", "w");
+  if (f == NULL) {
+    perror("emutest.hex");
+    return 1;
+  }
+  write_hex(f, t->code, words);
+  fclose(f);
+
+  char command[100], out[4096], flat[8192];
+  snprintf(command, sizeof(command), "./emu -t %s emutest.hex", t->options);
+  FILE *p = popen(command, "r");
+  if (p == NULL) {
+    perror("emu");
+    return 1;
+  }
+  size_t n = fread(out, 1, sizeof(out) - 1, p);
+  out[n] = '\0';
+  if (pclose(p) != 0) {
+    printf("%-8s emu failed\n", t->name);
+    return 1;
+  }
+
+  flatten(out, flat, sizeof(flat));
+  int failed = 0;
+  const char *w = t->want;
+  while(*w != '\0') {
+    char name[32], want[32], got[32];
+    size_t len = strcspn(w, "=");
+    snprintf(name, sizeof(name), "%.*s", (int)len, w);
+    w += len + 1;
+    len = strcspn(w, " ");
+    snprintf(want, sizeof(want), "%.*s", (int)len, w);
+    w += len;
+    while(*w == ' ') w++;
+    if (!lookup(flat, name, got, sizeof(got))) strcpy(got, "nothing");
+    if (strcmp(got, want) == 0) continue;
+    if (!failed) printf("%-8s FAILED:", t->name);
+    printf(" %s=%s, not %s", name, got, want);
+    failed = 1;
+  }
+  printf(failed ? "\n" : "%-8s ok\n", t->name);
+  return failed;
+}
+
+int main(int argc, char **argv) {
+  int failed = 0;
+  for(unsigned int i = 0; i < TESTS; i++) {
+    int chosen = (argc == 1);
+    for(int j = 1; j < argc; j++)
+      if (strcmp(argv[j], tests[i].name) == 0) chosen = 1;
+    if (chosen) failed |= run(&tests[i]);
+  }
+  remove("emutest.hex");
+  return failed;
+}
@@ -0,0 +1,106 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * This generates the reference tables that astrocheck compares the
+ * harmonic.h clocks against. It's done the long way around, in floating
+ * point, and doesn't share any code or coefficients with the clocks.
+ *
+ * ephem eot START DAYS
+ *   The equation of time (apparent minus mean solar time, in seconds) at
+ *   0h UT every day for DAYS days from the unix time START. This uses the
+ *   solar coordinates of Meeus, "Astronomical Algorithms", chapters 25
+ *   and 28, which are good to a second or so.
+ *
+ * ephem tide RATIO DAYS
+ *   The times of high water (in seconds from a spring tide) for DAYS days
+ *   of a tide made up of the principal lunar (M2) and solar (S2)
+ *   semidiurnal constituents, with S2 RATIO times the size of M2. They're
+ *   found by searching for the peaks of the summed tide curve.
+ *
+ * 'make ephem' regenerates eot.ref and tide.ref.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEG (M_PI / 180)
+
+static double eot(double unix_time) {
+  double jd = unix_time / 86400.0 + 2440587.5;
+  double t = (jd - 2451545.0) / 36525;
+  double l0 = fmod(280.46646 + t * (36000.76983 + t * 0.0003032), 360);
+  double m = 357.52911 + t * (35999.05029 - t * 0.0001537);
+  double c = (1.914602 - t * (0.004817 + t * 0.000014)) * sin(m * DEG)
+    + (0.019993 - t * 0.000101) * sin(2 * m * DEG) + 0.000289 * sin(3 * m * DEG);
+  double omega = 125.04 - 1934.136 * t;
+  double lambda = l0 + c - 0.00569 - 0.00478 * sin(omega * DEG);
+  double eps0 = 23 + 26 / 60.0 + (21.448 - t * (46.8150 + t * (0.00059 - t * 0.001813))) / 3600;
+  double eps = eps0 + 0.00256 * cos(omega * DEG);
+  double alpha = atan2(cos(eps * DEG) * sin(lambda * DEG), cos(lambda * DEG)) / DEG;
+  // nutation in longitude, to a tenth of an arcsecond or so
+  double lmoon = 218.3165 + 481267.8813 * t;
+  double dpsi = (-17.20 * sin(omega * DEG) - 1.32 * sin(2 * l0 * DEG)
+    - 0.23 * sin(2 * lmoon * DEG) + 0.21 * sin(2 * omega * DEG)) / 3600;
+  double e = l0 - 0.0057183 - alpha + dpsi * cos(eps * DEG);
+  e = fmod(e + 540, 360) - 180; // to -180..180
+  return e * 240; // 360 degrees is 86400 seconds
+}
+
+#define M2_PERIOD (44714.164)
+#define S2_PERIOD (43200.0)
+
+static double tide_slope(double t, double ratio) {
+  return -sin(2 * M_PI * t / M2_PERIOD) / M2_PERIOD - ratio * sin(2 * M_PI * t / S2_PERIOD) / S2_PERIOD;
+}
+
+int main(int argc, char **argv) {
+  if (argc == 4 && strcmp(argv[1], "eot") == 0) {
+    double start = atof(argv[2]);
+    int days = atoi(argv[3]);
+    printf("# unix time, equation of time in seconds\n");
+    for(int d = 0; d <= days; d++)
+      printf("%.0f %.2f\n", start + d * 86400.0, eot(start + d * 86400.0));
+    return 0;
+  }
+  if (argc == 4 && strcmp(argv[1], "tide") == 0) {
+    double ratio = atof(argv[2]);
+    double end = atof(argv[3]) * 86400;
+    int k = 0;
+    printf("# S2/M2 = %g. high water number, seconds after a spring tide\n", ratio);
+    printf("0 0.0\n");
+    // A peak is where the slope goes from up to down. Step a minute at a time
+    // to find them, then home in.
+    for(double t = 60; t < end; t += 60) {
+      if (!(tide_slope(t - 60, ratio) > 0 && tide_slope(t, ratio) <= 0)) continue;
+      double lo = t - 60, hi = t;
+      for(int i = 0; i < 60; i++) {
+        double mid = (lo + hi) / 2;
+        if (tide_slope(mid, ratio) > 0) lo = mid; else hi = mid;
+      }
+      printf("%d %.1f\n", ++k, (lo + hi) / 2);
+    }
+    return 0;
+  }
+  fprintf(stderr, "usage: %s eot START DAYS | tide RATIO DAYS\n", argv[0]);
+  return 1;
+}
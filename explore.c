@@ -0,0 +1,219 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Design-space explorer for the random clocks.
+ *
+ * The knobs (LIST_LENGTH, STEP_MIN and STEP_CHOICES in crazy.c, MAX_BURST
+ * in lazy.c, STUTTER_ODDS in vetinari.c, SONG_ODDS in tuney.c) are compile
+ * time constants, so every point in the sweep is its own simstat build. The
+ * points are built and run across all of the cores, and then the ones that
+ * no other point beats on every count are printed - the Pareto front.
+ *
+ * The four counts are:
+ *   score       - unpredictability (see metrics_score()) - higher is better
+ *   drift       - worst excursion of the hands, in seconds - lower is better
+ *   draws_max   - most q_random() calls in one slot. That's the bulk of the
+ *                 CPU time, and too many blows through an interrupt.
+ *   coil_ms_day - coil on-time per day - the bulk of the battery budget
+ *
+ * usage: explore [-a] [-j jobs] [-n slots] [-k seeds] [-r num/den] TYPE NAME=v1,v2,... ...
+ *
+ * -a prints every point, not just the front (front points are marked with *).
+ * Set HOSTCC to change the compiler used for the point builds. 'make explore'
+ * passes the Makefile's SIM_SRCS, the simulator sources that go with
+ * simstat.c, so the two lists can't differ.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define MAX_PARAMS 8
+#define MAX_VALUES 32
+#define WORK_DIR "explore.d"
+
+struct param {
+  char name[64];
+  char *values[MAX_VALUES];
+  int count;
+};
+
+struct point {
+  int index[MAX_PARAMS];
+  double score, drift, draws_max, coil;
+  int ok;
+  int front;
+};
+
+static struct param params[MAX_PARAMS];
+static int param_count;
+
+static void point_defines(const struct point *p, char *buf, size_t len) {
+  buf[0] = 0;
+  for(int i = 0; i < param_count; i++) {
+    size_t used = strlen(buf);
+    snprintf(buf + used, len - used, " -D%s=%s", params[i].name, params[i].values[p->index[i]]);
+  }
+}
+
+static double field(const char *line, const char *key) {
+  char pattern[64];
+  snprintf(pattern, sizeof(pattern), " %s=", key);
+  const char *where = strstr(line, pattern);
+  if (where == NULL) {
+    // It might be the very first one
+    size_t keylen = strlen(key);
+    if (strncmp(line, key, keylen) != 0 || line[keylen] != '=') return 0;
+    return atof(line + keylen + 1);
+  }
+  return atof(where + strlen(pattern));
+}
+
+// a is at least as good as b on every count, and better on at least one.
+static int dominates(const struct point *a, const struct point *b) {
+  if (a->score < b->score || a->drift > b->drift || a->draws_max > b->draws_max || a->coil > b->coil)
+    return 0;
+  return a->score > b->score || a->drift < b->drift || a->draws_max < b->draws_max || a->coil < b->coil;
+}
+
+static void usage(const char *me) {
+  fprintf(stderr, "usage: %s [-a] [-j jobs] [-n slots] [-k seeds] [-r num/den] TYPE NAME=v1,v2,... ...\n", me);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *slots = "8640000", *seeds = "8", *rate = "1/10";
+  const char *cc = getenv("HOSTCC"), *srcs = getenv("SIM_SRCS");
+  int jobs = 0, all = 0, c;
+
+  if (cc == NULL) cc = "gcc";
+  if (srcs == NULL) srcs = "sim.c metrics.c simcache.c tickarc.c";
+  while((c = getopt(argc, argv, "aj:n:k:r:")) != -1) {
+    switch(c) {
+      case 'a': all = 1; break;
+      case 'j': jobs = atoi(optarg); break;
+      case 'n': slots = optarg; break;
+      case 'k': seeds = optarg; break;
+      case 'r': rate = optarg; break;
+      default: usage(argv[0]);
+    }
+  }
+  if (optind >= argc) usage(argv[0]);
+  const char *type = argv[optind++];
+
+  for(; optind < argc; optind++) {
+    if (param_count >= MAX_PARAMS) usage(argv[0]);
+    struct param *p = &params[param_count++];
+    char *eq = strchr(argv[optind], '=');
+    if (eq == NULL) usage(argv[0]);
+    *eq = 0;
+    snprintf(p->name, sizeof(p->name), "%s", argv[optind]);
+    for(char *v = strtok(eq + 1, ","); v != NULL && p->count < MAX_VALUES; v = strtok(NULL, ","))
+      p->values[p->count++] = v;
+    if (p->count == 0) usage(argv[0]);
+  }
+
+  int total = 1;
+  for(int i = 0; i < param_count; i++) total *= params[i].count;
+  struct point *points = calloc(total, sizeof(struct point));
+  for(int n = 0; n < total; n++) {
+    int rest = n;
+    for(int i = param_count - 1; i >= 0; i--) {
+      points[n].index[i] = rest % params[i].count;
+      rest /= params[i].count;
+    }
+  }
+
+  if (jobs <= 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    jobs = cpus > 0 ? (int)cpus : 1;
+  }
+  mkdir(WORK_DIR, 0777);
+
+  // Build and run every point, jobs at a time. Each point runs its seeds
+  // one after another, since we're already keeping all of the cores busy.
+  int next = 0, running = 0;
+  while(next < total || running > 0) {
+    if (next < total && running < jobs) {
+      char defines[4096], cmd[8192];
+      point_defines(&points[next], defines, sizeof(defines));
+      snprintf(cmd, sizeof(cmd),
+        "rm -f %s/p%d.out && %s -O3 -flto -DUNIT_TEST%s -o %s/p%d simstat.c %s %s.c -lm && "
+        "%s/p%d -j 1 -n %s -k %s -r %s > %s/p%d.out",
+        WORK_DIR, next, cc, defines, WORK_DIR, next, srcs, type, WORK_DIR, next, slots, seeds, rate, WORK_DIR, next);
+      pid_t pid = fork();
+      if (pid == 0) {
+        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+        _exit(127);
+      }
+      if (pid > 0) running++;
+      next++;
+      continue;
+    }
+    if (wait(NULL) < 0) break;
+    running--;
+  }
+
+  for(int n = 0; n < total; n++) {
+    char path[256], line[1024];
+    snprintf(path, sizeof(path), "%s/p%d.out", WORK_DIR, n);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) continue;
+    if (fgets(line, sizeof(line), f) != NULL) {
+      points[n].score = field(line, "score");
+      points[n].drift = field(line, "drift");
+      points[n].draws_max = field(line, "draws_max");
+      points[n].coil = field(line, "coil_ms_day");
+      points[n].ok = 1;
+    }
+    fclose(f);
+  }
+
+  for(int n = 0; n < total; n++) {
+    if (!points[n].ok) continue;
+    points[n].front = 1;
+    for(int m = 0; m < total; m++) {
+      if (m != n && points[m].ok && dominates(&points[m], &points[n])) {
+        points[n].front = 0;
+        break;
+      }
+    }
+  }
+
+  for(int i = 0; i < param_count; i++) printf("%s\t", params[i].name);
+  printf("score\tdrift\tdraws_max\tcoil_ms_day\n");
+  int failed = 0;
+  for(int n = 0; n < total; n++) {
+    if (!points[n].ok) {
+      failed++;
+      continue;
+    }
+    if (!all && !points[n].front) continue;
+    for(int i = 0; i < param_count; i++) printf("%s\t", params[i].values[points[n].index[i]]);
+    printf("%.4f\t%.1f\t%.0f\t%.0f%s\n", points[n].score, points[n].drift, points[n].draws_max,
+      points[n].coil, (all && points[n].front) ? "\t*" : "");
+  }
+  if (failed) fprintf(stderr, "%d of %d points failed to build or run\n", failed, total);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,296 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Works out the trim factor from a logic analyser capture of calibrate.c's
+ * output, for benches without a GPS-referenced frequency counter. The
+ * analyser has to be clocked from a disciplined reference, since its
+ * timestamps are what everything is measured against.
+ *
+ * freqfit [-f nominal] [-r rate [-c column]] [-g gate] [-j jobs] capture...
+ *
+ * Rather than count edges in a gate, like a counter does, it numbers every
+ * rising edge by how many cycles of the nominal frequency (16384 Hz by
+ * default) it is after the first one, and fits a straight line through
+ * the edge times against those numbers. The slope is the period. Every
+ * edge counts towards it, not just the two at the ends, so the analyser's
+ * sample clock matters a lot less: a few minutes at 1 MHz is good to
+ * better than 0.01 ppm. An edge the analyser missed just leaves a gap in
+ * the numbering, and is counted in missed.
+ *
+ * A capture is either
+ *  - one edge per line, as "time" or "time,level" with the time in
+ *    seconds. With a level, only the lines where it goes from 0 to 1
+ *    count. Otherwise every line is a rising edge.
+ *  - with -r, sigrok's CSV output: one sample per line, rate samples per
+ *    second, and the signal in the given column (counting from 0).
+ * Lines that don't start with a number (sigrok's ';' comments, headers)
+ * are skipped. Captures are read a line at a time, so they can be as big
+ * as they like. Several are done at once, one per core unless -j says.
+ *
+ * For each capture, it prints how many edges there were, the span of
+ * time, the fitted frequency, the error in ppm (and its standard error),
+ * how much the error wandered between gates (-g seconds each, 10 by
+ * default), and the trim value: the error in tenths-of-a-ppm, positive
+ * for a crystal that's fast (see offset.md). Then the Intel HEX record
+ * that sets it, for offset.hexi.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define EE_TRIM_LOC (4)
+
+struct options {
+  double nominal, rate, gate;
+  int column;
+};
+
+// A straight line fit of t against k, kept as running means and sums of
+// products about them, which don't lose precision over hours of edges.
+struct fit {
+  double n, mk, mt, ckk, ckt, ctt;
+};
+
+static void fit_add(struct fit *f, double k, double t) {
+  f->n++;
+  double dk = k - f->mk, dt = t - f->mt;
+  f->mk += dk / f->n;
+  f->mt += dt / f->n;
+  f->ckk += dk * (k - f->mk);
+  f->ckt += dk * (t - f->mt);
+  f->ctt += dt * (t - f->mt);
+}
+
+static double fit_slope(const struct fit *f) {
+  return f->ckt / f->ckk;
+}
+
+// The standard error of the slope.
+static double fit_error(const struct fit *f) {
+  double residual = f->ctt - f->ckt * f->ckt / f->ckk;
+  if (f->n <= 2 || residual <= 0) return 0;
+  return sqrt(residual / (f->n - 2) / f->ckk);
+}
+
+struct result {
+  int ok;
+  char error[200];
+  unsigned long long edges, missed, glitches;
+  double span, freq, ppm, ppm_error;
+  unsigned int gates;
+  double gate_mean, gate_m2; // of the gates' ppm, for their spread
+};
+
+struct state {
+  const struct options *opt;
+  struct result *r;
+  double first, last, gate_start;
+  unsigned long long k;
+  struct fit all, gate;
+};
+
+static double ppm(const struct options *opt, double period) {
+  return (1 / period / opt->nominal - 1) * 1e6;
+}
+
+static void gate_done(struct state *s) {
+  if (s->gate.n > 2) {
+    double g = ppm(s->opt, fit_slope(&s->gate));
+    s->r->gates++;
+    double d = g - s->r->gate_mean;
+    s->r->gate_mean += d / s->r->gates;
+    s->r->gate_m2 += d * (g - s->r->gate_mean);
+  }
+  memset(&s->gate, 0, sizeof(s->gate));
+}
+
+static void edge(struct state *s, double t) {
+  if (s->r->edges == 0) {
+    s->first = s->gate_start = t;
+  } else {
+    // How many cycles since the last one? Anything much short of one is
+    // noise on the line, not an edge.
+    double cycles = (t - s->last) * s->opt->nominal;
+    if (cycles < 0.5) {
+      s->r->glitches++;
+      return;
+    }
+    unsigned long long step = (unsigned long long)llround(cycles);
+    s->r->missed += step - 1;
+    s->k += step;
+  }
+  s->r->edges++;
+  s->last = t;
+  if (t - s->gate_start >= s->opt->gate) {
+    gate_done(s);
+    s->gate_start = t;
+  }
+  fit_add(&s->all, s->k, t - s->first);
+  fit_add(&s->gate, s->k, t - s->first);
+}
+
+// Is this a line of data, rather than a comment or header?
+static int numeric(const char *p) {
+  while(*p == ' ' || *p == '\t') p++;
+  return (*p >= '0' && *p <= '9') || *p == '-' || *p == '+' || *p == '.';
+}
+
+static void measure(const char *path, const struct options *opt, struct result *r) {
+  struct state s;
+  memset(r, 0, sizeof(*r));
+  memset(&s, 0, sizeof(s));
+  s.opt = opt;
+  s.r = r;
+
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    snprintf(r->error, sizeof(r->error), "can't open it");
+    return;
+  }
+  static char line[65536];
+  unsigned long long sample = 0;
+  int level = -1;
+  while(fgets(line, sizeof(line), f) != NULL) {
+    if (!numeric(line)) continue;
+    int now;
+    double t;
+    if (opt->rate > 0) {
+      // sigrok: pick out the column
+      const char *p = line;
+      for(int c = 0; c < opt->column && p != NULL; c++) {
+        p = strchr(p, ',');
+        if (p != NULL) p++;
+      }
+      if (p == NULL) {
+        snprintf(r->error, sizeof(r->error), "no column %d", opt->column);
+        fclose(f);
+        return;
+      }
+      now = atoi(p) != 0;
+      t = sample++ / opt->rate;
+    } else {
+      char *p;
+      t = strtod(line, &p);
+      while(*p == ' ' || *p == '\t') p++;
+      now = (*p == ',') ? atoi(p + 1) != 0 : 1;
+      if (*p != ',') level = 0; // every line is an edge
+    }
+    if (now && level == 0) edge(&s, t);
+    level = now;
+  }
+  fclose(f);
+  gate_done(&s);
+
+  if (r->edges < 3 || s.all.ckk <= 0) {
+    snprintf(r->error, sizeof(r->error), "only %llu rising edges", r->edges);
+    return;
+  }
+  double period = fit_slope(&s.all);
+  r->span = s.last - s.first;
+  r->freq = 1 / period;
+  r->ppm = ppm(opt, period);
+  r->ppm_error = fit_error(&s.all) / period * 1e6;
+  r->ok = 1;
+}
+
+static void print(const char *path, const struct result *r) {
+  if (!r->ok) {
+    printf("%s: %s\n", path, r->error[0] ? r->error : "failed");
+    return;
+  }
+  // The trim is in tenths-of-a-ppm, and positive slows the clock down.
+  long trim = lround(r->ppm * 10);
+  if (trim > 32767) trim = 32767;
+  if (trim < -32768) trim = -32768;
+  uint8_t lo = (uint16_t)trim & 0xff, hi = (uint16_t)trim >> 8;
+  printf("%s: edges=%llu missed=%llu glitches=%llu span=%.1f freq=%.6f ppm=%+.4f ppm_error=%.4f"
+    " gates=%u gate_sd=%.4f trim=%ld :02%04X00%02X%02X%02X\n",
+    path, r->edges, r->missed, r->glitches, r->span, r->freq, r->ppm, r->ppm_error, r->gates,
+    r->gates > 1 ? sqrt(r->gate_m2 / (r->gates - 1)) : 0, trim, EE_TRIM_LOC, lo, hi,
+    (uint8_t)-(2 + EE_TRIM_LOC + lo + hi));
+}
+
+int main(int argc, char **argv) {
+  struct options opt = { 16384, 0, 10, 0 };
+  unsigned int jobs = 0;
+  int c;
+
+  while((c = getopt(argc, argv, "f:r:c:g:j:")) != -1) {
+    switch(c) {
+      case 'f': opt.nominal = atof(optarg); break;
+      case 'r': opt.rate = atof(optarg); break;
+      case 'c': opt.column = atoi(optarg); break;
+      case 'g': opt.gate = atof(optarg); break;
+      case 'j': jobs = (unsigned int)strtoul(optarg, NULL, 0); break;
+      default: goto usage;
+    }
+  }
+  if (optind >= argc || opt.nominal <= 0 || opt.gate <= 0 || opt.column < 0) goto usage;
+  unsigned int count = argc - optind;
+  if (jobs == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    jobs = cpus > 0 ? (unsigned int)cpus : 1;
+  }
+
+  // Each capture gets a child, which leaves its result in shared memory.
+  struct result *results = mmap(NULL, sizeof(struct result) * count, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (results == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+  unsigned int next = 0, running = 0;
+  while(next < count || running > 0) {
+    if (next < count && running < jobs) {
+      pid_t pid = fork();
+      if (pid == 0) {
+        measure(argv[optind + next], &opt, &results[next]);
+        _exit(0);
+      }
+      if (pid > 0) {
+        running++;
+        next++;
+        continue;
+      }
+      perror("fork");
+      next = count;
+    }
+    if (running == 0 || wait(NULL) < 0) break;
+    running--;
+  }
+
+  int failed = 0;
+  for(unsigned int i = 0; i < count; i++) {
+    print(argv[optind + i], &results[i]);
+    failed |= !results[i].ok;
+  }
+  return failed;
+
+usage:
+  fprintf(stderr, "usage: %s [-f nominal] [-r rate [-c column]] [-g gate] [-j jobs] capture...\n", argv[0]);
+  return 1;
+}
@@ -0,0 +1,177 @@
+/*
+
+ Harmonic Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * This is a common file with the code for a clock whose rate isn't constant,
+ * but follows some astronomical cycle - a sundial's time, or the tides.
+ * To build one, you just set the defines and include this file.
+ *
+ * Like drift.h, the clock adds or removes tenths-of-a-second to run fast or
+ * slow. But rather than a fixed fraction, it keeps a running accumulator
+ * to which it adds the current rate every tenth of a second. Each time that
+ * gets to a whole tenth, one is added (or removed). The rate is the sum of
+ * a constant and a short series of cosines of multiples of one fundamental
+ * angle, which goes around once per cycle (a year, say). The series is
+ * evaluated once per minute, in 16 bit fixed point, one term per tenth of a
+ * second so that no one tenth gets too much work.
+ *
+ * Rates are in units of 2^-24 tenths of a second per tenth of a second,
+ * which is to say that 2^24 is 100% fast.
+ *
+ * The macros required are:
+ *
+ * HARMONIC_MEAN - the constant part of the rate
+ * HARMONIC_STEP - how far the fundamental angle advances each minute,
+ *   where 2^32 is once around
+ * HARMONIC_SHIFT - the coefficients are in units of 2^HARMONIC_SHIFT rate units,
+ *   which is how big ones fit in 16 bits.
+ * HARMONIC_MULTIPLES - brace-enclosed list: for each term, the multiple of the fundamental
+ * HARMONIC_PHASES - brace-enclosed list: for each term, the phase, where 65536 is once around
+ * HARMONIC_COEFFICIENTS - brace-enclosed list: for each term, the amplitude
+ *
+ * The clock has to know where in its cycle it is when it starts. That's the
+ * fundamental angle (65536 is once around) in the EEPROM at EE_HARMONIC_LOC.
+ * 'make phase TYPE=...' will figure it out from the date and write it.
+ */
+
+#include <stdint.h>
+
+#if defined(UNIT_TEST)
+// On *nix, there is no PROGMEM. Just make it go away and turn the
+// pgm_read operations into just pointer derefs.
+#define PROGMEM
+#define pgm_read_byte(x) *(x)
+#define pgm_read_word(x) *(x)
+// And there's no EEPROM. A test harness can set this instead.
+__attribute__((weak)) unsigned int harmonic_start = 0;
+#else
+#include <avr/pgmspace.h>
+#include <avr/eeprom.h>
+#endif
+
+#define EE_HARMONIC_LOC ((void*)68)
+
+// One tenth of a second in the accumulator
+#define HARMONIC_ONE (1L << 24)
+
+// The cosines average out, so in the long run the clock runs at the mean
+// rate. Scaled down, so that base.c can do its sums in 32 bits, but no
+// further than that: what's dropped off the end is a steady drift.
+TICK_RATE((HARMONIC_ONE + HARMONIC_MEAN) >> 2, IRQS_PER_SECOND * (HARMONIC_ONE >> 2));
+
+// A minute in tenths of a second
+#define SLOTS_PER_MINUTE (60 * IRQS_PER_SECOND)
+
+PROGMEM const unsigned char harmonic_multiples[] = HARMONIC_MULTIPLES;
+PROGMEM const unsigned int harmonic_phases[] = HARMONIC_PHASES;
+PROGMEM const int harmonic_coefficients[] = HARMONIC_COEFFICIENTS;
+
+#define HARMONIC_TERMS (sizeof(harmonic_coefficients) / sizeof(harmonic_coefficients[0]))
+
+// The first quarter of a sine wave, 64 steps, with the end point. Q15.
+PROGMEM const int quarter_sine[] = {
+  0, 804, 1608, 2410, 3212, 4011, 4808, 5602, 6393, 7179, 7962, 8739, 9512, 10278,
+  11039, 11793, 12539, 13279, 14010, 14732, 15446, 16151, 16846, 17530, 18204, 18868,
+  19519, 20159, 20787, 21403, 22005, 22594, 23170, 23731, 24279, 24811, 25329, 25832,
+  26319, 26790, 27245, 27683, 28105, 28510, 28898, 29268, 29621, 29956, 30273, 30571,
+  30852, 31113, 31356, 31580, 31785, 31971, 32137, 32285, 32412, 32521, 32609, 32678,
+  32728, 32757, 32767
+};
+
+// cosine of a 16 bit angle, Q15, with linear interpolation between the table entries.
+static int harmonic_cos(uint16_t angle) {
+  angle += 0x4000; // cos(x) = sin(x + 90 degrees)
+  unsigned char quadrant = angle >> 14;
+  unsigned char index = (angle >> 8) & 0x3f;
+  unsigned char frac = (unsigned char)angle;
+  if (quadrant & 1) {
+    // The second and fourth quarters run backwards, so the position is
+    // 64 steps less this one: 63 - index and 256 - frac, or 64 - index
+    // exactly if frac is 0.
+    index = 63 - index;
+    frac = -frac;
+    if (frac == 0) index++;
+  }
+  int value = pgm_read_word(quarter_sine + index);
+  if (frac != 0) {
+    // index is 63 at most here, so this is still in the table.
+    int b = pgm_read_word(quarter_sine + index + 1);
+    value += (int)(((long)(b - value) * frac) >> 8);
+  }
+  return (quadrant & 2)?-value:value;
+}
+
+// One term of the series, in rate units
+static long harmonic_term(unsigned char term, uint32_t angle) {
+  uint16_t theta = (uint16_t)(angle >> 16) * pgm_read_byte(harmonic_multiples + term)
+    + pgm_read_word(harmonic_phases + term);
+  long value = (long)(int)pgm_read_word(harmonic_coefficients + term) * harmonic_cos(theta);
+  // Round, don't truncate. Half a unit per term every tenth of a second
+  // adds up to seconds a year.
+  return (value + (1L << (14 - HARMONIC_SHIFT))) >> (15 - HARMONIC_SHIFT);
+}
+
+void loop() {
+  uint32_t angle; // the fundamental, halfway through this minute. 2^32 is once around.
+  long rate = HARMONIC_MEAN; // what we add to the accumulator every tenth
+  long next_rate = HARMONIC_MEAN; // what we're adding up for the next minute
+  long accumulator = 0;
+  unsigned int minute_position = 0; // which tenth of the minute this is
+  unsigned char tick_counter = 0; // which tenth of the displayed second this is
+
+#if defined(UNIT_TEST)
+  angle = (uint32_t)harmonic_start << 16;
+#else
+  angle = (uint32_t)eeprom_read_word(EE_HARMONIC_LOC) << 16;
+#endif
+  angle += HARMONIC_STEP / 2;
+  // The clock hasn't started yet, so there's time to do it all at once.
+  for(unsigned char i = 0; i < HARMONIC_TERMS; i++)
+    rate += harmonic_term(i, angle);
+
+  while(1) {
+    if (minute_position < HARMONIC_TERMS)
+      next_rate += harmonic_term(minute_position, angle + HARMONIC_STEP);
+    if (++minute_position >= SLOTS_PER_MINUTE) {
+      minute_position = 0;
+      rate = next_rate;
+      next_rate = HARMONIC_MEAN;
+      angle += HARMONIC_STEP;
+    }
+
+    // Normally, the display moves one tenth for each tenth of real time.
+    // Running fast, now and then it moves two. Running slow, now and then none.
+    unsigned char advance = 1;
+    accumulator += rate;
+    if (accumulator >= HARMONIC_ONE) {
+      accumulator -= HARMONIC_ONE;
+      advance = 2;
+    } else if (accumulator <= -HARMONIC_ONE) {
+      accumulator += HARMONIC_ONE;
+      advance = 0;
+    }
+    tick_counter += advance;
+    if (tick_counter >= IRQS_PER_SECOND) {
+      tick_counter -= IRQS_PER_SECOND;
+      doTick();
+    } else
+      doSleep();
+  }
+}
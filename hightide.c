@@ -0,0 +1,77 @@
+/*
+
+ High Tide Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+ 
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * The tidal clock runs at the average rate of the lunar tide, but the real
+ * time between high tides isn't constant. The sun makes a tide of its own,
+ * and as the two come in and out of step over the 14.77 day spring-neap
+ * cycle, the combined high tide comes early, then late. This clock follows
+ * the sum of the principal lunar and solar tides (M2 and S2), so it points at
+ * 12 at high water all month long, not just on average.
+ *
+ * If the combined tide's phase is the lunar phase plus
+ * atan(r sin x / (1 + r cos x)), where x is the spring-neap angle and r is how big
+ * the solar tide is compared to the lunar one, then the clock's rate is the
+ * lunar rate plus (43200 / spring-neap period) times the sum over n of
+ * (-1)^(n+1) r^n cos(nx). Eight terms are plenty for r up to about 0.6.
+ *
+ * That's not quite it, though. The height of the tide grows and shrinks
+ * along with the phase, so the peak - high water - comes a little before
+ * the phase gets to 0 while the tide is building and a little after while
+ * it's falling away. That's worth a couple of minutes, and to first order it
+ * multiplies term n by 1 + n times the ratio of the lunar tide period to the
+ * spring-neap period.
+ *
+ * Set it at a high tide and then 'make phase TYPE=hightide EPOCH={unix time of
+ * a spring high tide}'.
+ */
+
+#include "base.h"
+
+// S2 compared to M2. Look it up for your harbor. 0.46 is the equilibrium tide.
+// Much over 0.85 and the first coefficient won't fit in 16 bits.
+#ifndef TIDE_RATIO
+#define TIDE_RATIO (0.4)
+#endif
+
+// The lunar tide's rate: 43200 / 44714.164 - 1.
+#define HARMONIC_MEAN (-568130L)
+// The spring-neap cycle is 1275722 seconds.
+#define HARMONIC_STEP (202002)
+#define HARMONIC_SHIFT (4)
+// 43200 / 1275722, in units of 2^(HARMONIC_SHIFT - 24)
+#define TIDE_SCALE (35508.1)
+// 44714.164 / 1275722
+#define TIDE_PEAK (0.035050)
+#define TIDE_TERM(n, sign) ((int)(sign TIDE_SCALE * (1 + n * TIDE_PEAK) * POW##n(TIDE_RATIO)))
+#define POW1(r) (r)
+#define POW2(r) ((r) * (r))
+#define POW3(r) (POW2(r) * (r))
+#define POW4(r) (POW2(r) * POW2(r))
+#define POW5(r) (POW4(r) * (r))
+#define POW6(r) (POW4(r) * POW2(r))
+#define POW7(r) (POW4(r) * POW3(r))
+#define POW8(r) (POW4(r) * POW4(r))
+#define HARMONIC_MULTIPLES { 1, 2, 3, 4, 5, 6, 7, 8 }
+#define HARMONIC_PHASES { 0, 0, 0, 0, 0, 0, 0, 0 }
+#define HARMONIC_COEFFICIENTS { TIDE_TERM(1, +), TIDE_TERM(2, -), TIDE_TERM(3, +), \
+  TIDE_TERM(4, -), TIDE_TERM(5, +), TIDE_TERM(6, -), TIDE_TERM(7, +), TIDE_TERM(8, -) }
+
+#include "harmonic.h"
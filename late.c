@@ -0,0 +1,38 @@
+/*
+
+ Late Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+ 
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * This clock wanders between on-time and 5 minutes slow. It's the opposite
+ * of the Early clock: it's for folks who'd rather be told they have more
+ * time than they do... but never by quite the same amount.
+ *
+ */
+
+#include "base.h"
+
+// 5 minutes behind to on-time, in tenths of a second.
+#define WALK_MIN (-5L * 60 * 10)
+#define WALK_MAX (0)
+// 10% fast, normal, 10% or 20% slow.
+#define WALK_RATES { -1, 0, 1, 2 }
+// Anywhere from half a minute to 40 minutes at a stretch.
+#define WALK_DURATIONS { 30, 60, 120, 300, 600, 1200, 2400 }
+
+#include "walk.h"
@@ -26,9 +26,14 @@
 
 #include "base.h"
 
+// The longest burst of ticks. The clock stops for 8 times as long after each.
+#ifndef MAX_BURST
+#define MAX_BURST 30
+#endif
+
 void loop() {
   while(1){
-    unsigned char tick_count = (q_random() % 30) + 1; //1-30, inclusive
+    unsigned char tick_count = (q_random() % MAX_BURST) + 1; //1-30, inclusive
     
     for(unsigned char i = 0; i < tick_count; i++) {
       doTick();
@@ -0,0 +1,87 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * The lowest-leakage setup of the chip, which every image starts with by
+ * calling lowPowerInit() (base.c and calibrate.c). Nearly all of the time
+ * is spent in idle sleep, so whatever is left on here is most of what the
+ * controller draws.
+ *
+ * Timer0 has to keep running, since it's what wakes us up, and so the
+ * sleep has to be idle rather than anything deeper. Everything else that
+ * can be turned off is:
+ *
+ *   ADCSRA  0: the ADC off. It has to be, before PRR stops its clock.
+ *   ACSR    ACD: the analog comparator off.
+ *   PRR     Timer1, the USI and the ADC have no clock.
+ *   DIDR0   No digital input buffers at all. Nothing reads a pin, and a
+ *           buffer on a pin that isn't driven can draw current.
+ *   PORTB   All low...
+ *   DDRB    ...and PB0, PB1 and PB2 outputs, so none of them float. PB3
+ *           and PB4 are the crystal and PB5 is reset, which stay inputs.
+ *
+ * Built with POWER_FAIL (see base.c), PB2 is an input that watches the
+ * battery, so it's left as one, with its input buffer on. It's always
+ * driven, from one side of the supply diode or the other. It's the same
+ * with TIME_CODE, where the receiver drives it, and PPS, where the GPS
+ * module does.
+ *
+ * 'make audit' runs every image in emu (see emu.c) up to its first sleep
+ * and checks these registers against the values here, so an image that
+ * leaves something on gets caught.
+ */
+
+#define LOW_POWER_ADCSRA (0x00)
+#define LOW_POWER_ACSR (0x80) // ACD
+#define LOW_POWER_PRR (0x0b) // PRTIM1, PRUSI, PRADC
+#if defined(POWER_FAIL) || defined(TIME_CODE) || defined(PPS)
+#define LOW_POWER_DIDR0 (0x3b) // ADC0D, ADC2D, ADC3D, AIN1D, AIN0D
+#define LOW_POWER_DDRB (0x03) // DDB0, DDB1
+#else
+#define LOW_POWER_DIDR0 (0x3f) // ADC0D, ADC2D, ADC3D, ADC1D, AIN1D, AIN0D
+#define LOW_POWER_DDRB (0x07) // DDB0, DDB1, DDB2
+#endif
+#define LOW_POWER_PORTB (0x00)
+
+#ifdef __AVR__
+#if defined(POWER_FAIL) || defined(TIME_CODE) || defined(PPS)
+#define LOW_POWER_PB2_DIDR0 (0)
+#define LOW_POWER_PB2_DDRB (0)
+#else
+#define LOW_POWER_PB2_DIDR0 _BV(ADC1D)
+#define LOW_POWER_PB2_DDRB _BV(DDB2)
+#endif
+#if LOW_POWER_ACSR != _BV(ACD) \
+  || LOW_POWER_PRR != (_BV(PRTIM1) | _BV(PRUSI) | _BV(PRADC)) \
+  || LOW_POWER_DIDR0 != (_BV(ADC0D) | _BV(ADC2D) | _BV(ADC3D) | LOW_POWER_PB2_DIDR0 | _BV(AIN1D) | _BV(AIN0D)) \
+  || LOW_POWER_DDRB != (_BV(DDB0) | _BV(DDB1) | LOW_POWER_PB2_DDRB)
+#error The low power settings don't match this chip's registers.
+#endif
+
+static inline void lowPowerInit() {
+  ADCSRA = LOW_POWER_ADCSRA; // DIE, ADC!!! DIE!!!
+  ACSR = LOW_POWER_ACSR;
+  PRR = LOW_POWER_PRR;
+  DIDR0 = LOW_POWER_DIDR0;
+  // Low first, so nothing goes high for an instant.
+  PORTB = LOW_POWER_PORTB;
+  DDRB = LOW_POWER_DDRB;
+}
+#endif
@@ -0,0 +1,270 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Tick stream measurements. See metrics.h.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "metrics.h"
+
+// The LZ78 dictionary. It's an open-addressed hash of (phrase, next gap)
+// to phrase number. When it fills up, we start over, just like LZW does.
+// There are only enough of these for two streams to be measured at a time
+// (which is all sim_run() can produce anyway - two with DUAL_MOVEMENT).
+#define LZ_BITS (20)
+#define LZ_SIZE (1UL << LZ_BITS)
+#define LZ_MAX_PHRASES (LZ_SIZE / 2)
+#define LZ_STREAMS (2)
+
+static struct lz {
+  uint64_t key[LZ_SIZE]; // 0 means empty
+  uint32_t val[LZ_SIZE];
+  uint32_t phrases;
+  uint32_t node; // the phrase we're in the middle of. 0 is the root.
+} lz[LZ_STREAMS];
+static unsigned int lz_next_stream;
+
+static void lz_reset(struct lz *d) {
+  memset(d->key, 0, sizeof(d->key));
+  d->phrases = 0;
+  d->node = 0;
+}
+
+static void lz_add(struct metrics *m, unsigned int sym) {
+  struct lz *d = &lz[m->lz_stream];
+  uint64_t key = (((uint64_t)d->node << 8) | sym) + 1;
+  uint32_t h = (uint32_t)((key * 0x9e3779b97f4a7c15ULL) >> (64 - LZ_BITS));
+  m->lz_symbols++;
+  while(d->key[h] != 0) {
+    if (d->key[h] == key) {
+      d->node = d->val[h];
+      return;
+    }
+    h = (h + 1) & (LZ_SIZE - 1);
+  }
+  // A new phrase. It costs the index of its prefix plus the new symbol.
+  m->lz_bits += log2((double)d->phrases + 1) + log2((double)METRICS_MAX_GAP);
+  d->key[h] = key;
+  d->val[h] = ++d->phrases;
+  d->node = 0;
+  if (d->phrases >= LZ_MAX_PHRASES) lz_reset(d);
+}
+
+void metrics_init(struct metrics *m, unsigned long rate_num, unsigned long rate_den) {
+  memset(m, 0, sizeof(*m));
+  m->rate_num = rate_num;
+  m->rate_den = rate_den;
+  m->prev_bin = -1;
+  m->lz_stream = lz_next_stream++ % LZ_STREAMS;
+  lz_reset(&lz[m->lz_stream]);
+}
+
+static void drift_at(struct metrics *m, unsigned long long slot) {
+  double drift = (double)m->ticks - (double)slot * m->rate_num / m->rate_den;
+  if (drift < m->drift_min) m->drift_min = drift;
+  if (drift > m->drift_max) m->drift_max = drift;
+}
+
+void metrics_tick(unsigned long long slot, void *arg) {
+  struct metrics *m = (struct metrics *)arg;
+
+  drift_at(m, slot); // just before the tick...
+  if (m->ticks != 0) {
+    unsigned long long gap = slot - m->last_tick;
+    int bin = gap >= METRICS_MAX_GAP ? METRICS_MAX_GAP - 1 : (int)gap;
+    m->gap_hist[bin]++;
+    if (m->prev_bin >= 0) {
+      m->bigram[m->prev_bin][bin]++;
+      m->sum_lag += m->prev_gap * (double)gap;
+      m->n_lag++;
+    } else
+      m->first_gaps += (double)gap;
+    m->n_gaps++;
+    m->sum += (double)gap;
+    m->sum2 += (double)gap * gap;
+    m->prev_bin = bin;
+    m->prev_gap = (double)gap;
+    lz_add(m, bin);
+  }
+  m->last_tick = slot;
+  m->ticks++;
+  drift_at(m, slot); // ...and just after.
+}
+
+void metrics_finish(struct metrics *m, unsigned long long slots) {
+  m->slots = slots;
+  drift_at(m, slots);
+  if (m->n_gaps != 0) m->last_gaps += m->prev_gap;
+  // Charge for the phrase left hanging at the end.
+  if (lz[m->lz_stream].node != 0)
+    m->lz_bits += log2((double)lz[m->lz_stream].phrases + 1);
+}
+
+void metrics_merge(struct metrics *into, const struct metrics *from) {
+  into->slots += from->slots;
+  into->ticks += from->ticks;
+  if (from->drift_min < into->drift_min) into->drift_min = from->drift_min;
+  if (from->drift_max > into->drift_max) into->drift_max = from->drift_max;
+  for(int i = 0; i < METRICS_MAX_GAP; i++) {
+    into->gap_hist[i] += from->gap_hist[i];
+    for(int j = 0; j < METRICS_MAX_GAP; j++)
+      into->bigram[i][j] += from->bigram[i][j];
+  }
+  into->sum += from->sum;
+  into->sum2 += from->sum2;
+  into->sum_lag += from->sum_lag;
+  into->n_gaps += from->n_gaps;
+  into->n_lag += from->n_lag;
+  into->first_gaps += from->first_gaps;
+  into->last_gaps += from->last_gaps;
+  into->lz_bits += from->lz_bits;
+  into->lz_symbols += from->lz_symbols;
+  into->draws += from->draws;
+  if (from->max_draws > into->max_draws) into->max_draws = from->max_draws;
+}
+
+double metrics_entropy_rate(const struct metrics *m) {
+  double total = 0, h = 0;
+  for(int i = 0; i < METRICS_MAX_GAP; i++) {
+    double row = 0;
+    for(int j = 0; j < METRICS_MAX_GAP; j++) row += m->bigram[i][j];
+    if (row == 0) continue;
+    for(int j = 0; j < METRICS_MAX_GAP; j++) {
+      if (m->bigram[i][j] == 0) continue;
+      double p = m->bigram[i][j] / row;
+      h -= m->bigram[i][j] * log2(p);
+    }
+    total += row;
+  }
+  return total == 0 ? 0 : h / total;
+}
+
+double metrics_autocorr(const struct metrics *m) {
+  unsigned long long n = m->n_gaps;
+  if (n < 2 || m->n_lag == 0) return 0;
+  double mean = m->sum / n;
+  double var = m->sum2 / n - mean * mean;
+  // Gaps that never change have no correlation to speak of. That's as
+  // predictable as a clock gets, but the entropy already says so.
+  if (var <= 1e-12 * mean * mean) return 0;
+  // The sum over pairs of (gap - mean) * (next gap - mean). The gaps that
+  // come first in a pair are all but the last of each run, and the ones
+  // that come second all but the first.
+  double cov = m->sum_lag - mean * (m->sum - m->last_gaps) - mean * (m->sum - m->first_gaps)
+    + m->n_lag * mean * mean;
+  return cov / m->n_lag / var;
+}
+
+double metrics_lz_rate(const struct metrics *m) {
+  return m->lz_symbols == 0 ? 0 : m->lz_bits / m->lz_symbols;
+}
+
+double metrics_score(const struct metrics *m) {
+  double h = metrics_entropy_rate(m);
+  double lz = metrics_lz_rate(m);
+  if (lz < h) h = lz;
+  return h * (1 - fabs(metrics_autocorr(m)));
+}
+
+double metrics_worst_drift(const struct metrics *m) {
+  return fabs(m->drift_min) > fabs(m->drift_max) ? fabs(m->drift_min) : fabs(m->drift_max);
+}
+
+double metrics_coil_ms_per_day(const struct metrics *m) {
+  if (m->slots == 0) return 0;
+  return (double)m->ticks * 864000.0 / m->slots * METRICS_PULSE_MS;
+}
+
+void metrics_print(FILE *f, const struct metrics *m) {
+  fprintf(f, "slots=%llu ticks=%llu entropy=%.4f autocorr=%.4f lz=%.4f score=%.4f"
+    " drift_min=%.1f drift_max=%.1f drift=%.1f draws_mean=%.4f draws_max=%lu coil_ms_day=%.0f\n",
+    m->slots, m->ticks, metrics_entropy_rate(m), metrics_autocorr(m), metrics_lz_rate(m),
+    metrics_score(m), m->drift_min, m->drift_max, metrics_worst_drift(m),
+    m->slots == 0 ? 0 : (double)m->draws / m->slots, m->max_draws,
+    metrics_coil_ms_per_day(m));
+}
+
+static void put_varint(FILE *f, uint64_t value) {
+  while(value >= 0x80) {
+    putc((int)(value & 0x7f) | 0x80, f);
+    value >>= 7;
+  }
+  putc((int)value, f);
+}
+
+static int get_varint(FILE *f, uint64_t *value) {
+  *value = 0;
+  for(unsigned int shift = 0; shift < 64; shift += 7) {
+    int byte = getc(f);
+    if (byte == EOF) return 0;
+    *value |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) return 1;
+  }
+  return 0;
+}
+
+// The struct as it is, then the dictionary: how many phrases, the one it's
+// in the middle of, and each entry that's in use, as how far on it is from
+// the last one, its key and its phrase number. They have to go back in the
+// same places, or the probing wouldn't find them the same way.
+int metrics_save(FILE *f, const struct metrics *m) {
+  const struct lz *d = &lz[m->lz_stream];
+  uint64_t used = 0;
+  for(uint32_t h = 0; h < LZ_SIZE; h++) used += d->key[h] != 0;
+  fwrite(m, sizeof(*m), 1, f);
+  put_varint(f, d->phrases);
+  put_varint(f, d->node);
+  put_varint(f, used);
+  uint32_t last = 0;
+  for(uint32_t h = 0; h < LZ_SIZE; h++) {
+    if (d->key[h] == 0) continue;
+    put_varint(f, h - last);
+    put_varint(f, d->key[h]);
+    put_varint(f, d->val[h]);
+    last = h;
+  }
+  return ferror(f) != 0;
+}
+
+int metrics_load(FILE *f, struct metrics *m) {
+  unsigned int stream = m->lz_stream;
+  struct lz *d = &lz[stream];
+  uint64_t phrases, node, used, gap, key, val;
+  if (fread(m, sizeof(*m), 1, f) != 1) return 1;
+  m->lz_stream = stream;
+  lz_reset(d);
+  if (!get_varint(f, &phrases) || !get_varint(f, &node) || !get_varint(f, &used)
+      || phrases >= LZ_MAX_PHRASES || node > phrases || used > LZ_SIZE) return 1;
+  d->phrases = (uint32_t)phrases;
+  d->node = (uint32_t)node;
+  uint64_t h = 0;
+  for(uint64_t i = 0; i < used; i++) {
+    if (!get_varint(f, &gap) || !get_varint(f, &key) || !get_varint(f, &val)) return 1;
+    h += gap;
+    if (h >= LZ_SIZE || key == 0) return 1;
+    d->key[h] = key;
+    d->val[h] = (uint32_t)val;
+  }
+  return 0;
+}
@@ -0,0 +1,105 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Host-side measurements of a simulated tick stream. Feed metrics_tick()
+ * to sim_run() as the tick callback.
+ *
+ * Everything here is about the gaps between ticks, in tenths-of-a-second.
+ * A normal clock has every gap equal to 10, so it has no entropy at all.
+ * The more a clock's next gap can't be guessed from the last one, the
+ * better it's doing its job.
+ */
+
+#include <stdio.h>
+
+// Gaps this long or longer all land in the last bin. It's also the
+// alphabet size for the compressibility estimate.
+#define METRICS_MAX_GAP (64)
+
+// The coil pulse length, in msec. This must match TICK_LENGTH in base.c.
+#define METRICS_PULSE_MS (35)
+
+struct metrics {
+  // The long-term tick rate the clock promises, in ticks per slot.
+  // That's 1/10 for any clock that keeps proper time.
+  unsigned long rate_num, rate_den;
+
+  unsigned long long slots, ticks;
+  unsigned long long last_tick;
+  int prev_bin; // -1 until there's been a gap
+
+  // How far ahead (positive) or behind the hands get, in seconds.
+  double drift_min, drift_max;
+
+  unsigned long long gap_hist[METRICS_MAX_GAP];
+  unsigned long long bigram[METRICS_MAX_GAP][METRICS_MAX_GAP];
+
+  // Sums for the lag-1 autocorrelation of the gap series. Pairs don't span
+  // runs, so after merging there are n_gaps minus one per run of them, and
+  // the first and last gaps of each run are each in only one.
+  double sum, sum2, sum_lag;
+  unsigned long long n_gaps, n_lag;
+  double first_gaps, last_gaps; // metrics_finish() adds the last one
+  double prev_gap;
+
+  // LZ78 code length of the gap series, in bits, and how many gaps it covers.
+  double lz_bits;
+  unsigned long long lz_symbols;
+  unsigned int lz_stream; // which dictionary
+
+  // Optional - filled in from struct sim_run by whoever has it.
+  unsigned long long draws;
+  unsigned long max_draws;
+};
+
+void metrics_init(struct metrics *m, unsigned long rate_num, unsigned long rate_den);
+// This has the signature of a sim_tick_fn. arg is the struct metrics.
+void metrics_tick(unsigned long long slot, void *arg);
+// Call this once at the end of the run with the total number of slots.
+void metrics_finish(struct metrics *m, unsigned long long slots);
+// Combine the results of two independent runs (e.g. two seeds).
+void metrics_merge(struct metrics *into, const struct metrics *from);
+
+// Conditional entropy of a gap given the previous one, in bits per tick.
+double metrics_entropy_rate(const struct metrics *m);
+// Lag-1 autocorrelation of the gaps. 0 is best, +/-1 is a dead giveaway.
+// It's undefined for gaps that are all the same, and comes out 0 then.
+double metrics_autocorr(const struct metrics *m);
+// How many bits per tick LZ78 needs to encode the gaps. Lower is more compressible.
+double metrics_lz_rate(const struct metrics *m);
+// A single figure of merit: the lesser of the two entropy estimates,
+// discounted by how correlated successive gaps are.
+double metrics_score(const struct metrics *m);
+// The worst excursion of the hands from the promised rate, in seconds.
+double metrics_worst_drift(const struct metrics *m);
+// Coil on-time per day, in msec. That's the bulk of the battery budget.
+double metrics_coil_ms_per_day(const struct metrics *m);
+
+// Write out everything about m, including how far its LZ78 dictionary has
+// got, so the run can be carried on later (see emu.c's snapshots). Returns
+// 0 if it worked.
+int metrics_save(FILE *f, const struct metrics *m);
+// Read that back into m, which has to have been through metrics_init()
+// already. Returns 0 if it worked.
+int metrics_load(FILE *f, struct metrics *m);
+
+// Print everything on one line as key=value pairs.
+void metrics_print(FILE *f, const struct metrics *m);
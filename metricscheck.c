@@ -0,0 +1,164 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Checks that merging the metrics of several seeds (as 'sim-{clock} -k'
+ * does) comes out the same as working them out from all of the seeds'
+ * gaps at once, for 'make metricscheck'.
+ *
+ * sim-metrics-{clock} [-n slots] [-s seed] [-k count]
+ *
+ * It runs count seeds (default 4) from seed for slots (default a day)
+ * each, keeping every gap, and merges their metrics. Then the lag-1
+ * autocorrelation is worked out again straight from the gaps, with only
+ * pairs inside a run counted, and the gap and tick counts are checked
+ * against the merged ones. It prints
+ *   autocorr merged=... pooled=...
+ * and fails if they're more than a millionth apart.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "metrics.h"
+
+struct options {
+  unsigned long long slots;
+  unsigned long seed;
+  unsigned int count;
+  struct metrics total;
+  // Every seed's gaps, one after another.
+  unsigned int *gaps;
+  unsigned long long *runs; // how many gaps each seed had
+  unsigned int done;
+};
+
+// What a child hands back: its metrics, then how many gaps, then them.
+struct result {
+  struct metrics m;
+  unsigned long long n;
+  unsigned int gap[];
+};
+
+struct keep {
+  struct metrics *m;
+  struct result *r;
+};
+
+static size_t out_size(const struct options *opt) {
+  // There's never more than a tick a slot.
+  return sizeof(struct result) + sizeof(unsigned int) * opt->slots;
+}
+
+static void tick(unsigned long long slot, void *arg) {
+  struct keep *k = (struct keep *)arg;
+  if (k->m->ticks != 0) k->r->gap[k->r->n++] = slot - k->m->last_tick;
+  metrics_tick(slot, k->m);
+}
+
+static void work(unsigned int i, void *out, void *arg) {
+  struct options *opt = (struct options *)arg;
+  struct result *r = (struct result *)out;
+  struct keep k = { &r->m, r };
+  struct sim_run run;
+
+  r->n = 0;
+  metrics_init(&r->m, 1, 10);
+  memset(&run, 0, sizeof(run));
+  run.slots = opt->slots;
+  run.seed = opt->seed + i;
+  run.tick = tick;
+  run.arg = &k;
+  sim_run(&run);
+  metrics_finish(&r->m, run.slots);
+}
+
+static void done(unsigned int i, void *out, void *arg) {
+  struct options *opt = (struct options *)arg;
+  const struct result *r = (const struct result *)out;
+  if (opt->done++ == 0)
+    memcpy(&opt->total, &r->m, sizeof(opt->total));
+  else
+    metrics_merge(&opt->total, &r->m);
+  opt->runs[i] = r->n;
+  memcpy(opt->gaps + i * opt->slots, r->gap, sizeof(unsigned int) * r->n);
+}
+
+int main(int argc, char **argv) {
+  static struct options opt;
+  int c;
+
+  opt.slots = 864000;
+  opt.seed = 1;
+  opt.count = 4;
+  while((c = getopt(argc, argv, "n:s:k:")) != -1) {
+    switch(c) {
+      case 'n': opt.slots = strtoull(optarg, NULL, 0); break;
+      case 's': opt.seed = strtoul(optarg, NULL, 0); break;
+      case 'k': opt.count = (unsigned int)strtoul(optarg, NULL, 0); break;
+      default: goto usage;
+    }
+  }
+  if (optind != argc || opt.count == 0) goto usage;
+
+  opt.gaps = malloc(sizeof(unsigned int) * opt.slots * opt.count);
+  opt.runs = calloc(opt.count, sizeof(*opt.runs));
+  if (sim_parallel(opt.count, 0, out_size(&opt), work, done, &opt) || opt.done != opt.count) {
+    fprintf(stderr, "simulation failed\n");
+    return 1;
+  }
+
+  // The same thing the long way round.
+  double sum = 0, var = 0, cov = 0;
+  unsigned long long n = 0, pairs = 0;
+  for(unsigned int i = 0; i < opt.count; i++)
+    for(unsigned long long j = 0; j < opt.runs[i]; j++) {
+      sum += opt.gaps[i * opt.slots + j];
+      n++;
+    }
+  double mean = sum / n;
+  for(unsigned int i = 0; i < opt.count; i++) {
+    const unsigned int *g = opt.gaps + i * opt.slots;
+    for(unsigned long long j = 0; j < opt.runs[i]; j++) {
+      var += (g[j] - mean) * (g[j] - mean);
+      if (j == 0) continue;
+      cov += (g[j - 1] - mean) * (g[j] - mean);
+      pairs++;
+    }
+  }
+  double pooled = var <= 1e-12 * mean * mean * n ? 0 : (cov / pairs) / (var / n);
+  double merged = metrics_autocorr(&opt.total);
+
+  int failed = opt.total.n_gaps != n || opt.total.n_lag != pairs || opt.total.ticks != n + opt.count;
+  if (failed)
+    printf("gaps merged=%llu pooled=%llu pairs merged=%llu pooled=%llu\n",
+      opt.total.n_gaps, n, opt.total.n_lag, pairs);
+  failed |= fabs(merged - pooled) > 1e-6;
+  printf("autocorr merged=%.6f pooled=%.6f%s\n", merged, pooled, failed ? " FAILED" : "");
+  return failed;
+
+usage:
+  fprintf(stderr, "usage: %s [-n slots] [-s seed] [-k count]\n", argv[0]);
+  return 1;
+}
@@ -0,0 +1,337 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * A stand-in for avrdude and a chip, so that the programming targets in the
+ * Makefile can be tried out without either. 'make flashcheck' uses it. It
+ * takes the same options the Makefile gives avrdude, and understands
+ *
+ *   -U {flash|eeprom|lfuse|hfuse|efuse}:{w|r|v}:file[:{i|r|m}]
+ *   -t, with 'dump MEM ADDR LEN', 'write MEM ADDR BYTE...' and 'quit' on stdin
+ *   -V, -D and -e
+ *
+ * The chip's memories live in files in MOCKDUDE_DIR (mockdude.d by default).
+ * Writing the flash erases it first, unless there's a -D, and leaves the
+ * EEPROM alone, just like a chip fused to save it.
+ *
+ * When it's done, the "chip" comes out of reset and starts up, so it does
+ * what base.c does when it starts with a build it hasn't seen before: it
+ * writes the build ID and CRC of its flash to the EEPROM (see buildid.h).
+ *
+ * To see that a bad flash gets caught, set MOCKDUDE_FAULT to an address,
+ * and that byte of flash won't take what's written to it.
+ *
+ * A chip that's programmed over ISP can only be erased all at once. Set
+ * MOCKDUDE_PAGE_ERASE to a page size to be one that (like the UPDI chips)
+ * erases each page it writes instead, when there's a -D.
+ *
+ * It says on stderr how many bytes went over the wire each way, which is
+ * what takes the time with a real programmer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "buildid.h"
+
+struct memory {
+  const char *name;
+  long size;
+  uint8_t *data;
+};
+
+static struct memory memories[] = {
+  { "flash", 4096, NULL },
+  { "eeprom", 256, NULL },
+  { "lfuse", 1, NULL },
+  { "hfuse", 1, NULL },
+  { "efuse", 1, NULL },
+};
+#define MEMORY_COUNT (sizeof(memories) / sizeof(memories[0]))
+
+static const char *dir;
+static long bytes_written, bytes_read;
+static int verify = 1, erase_flash = 1;
+
+static struct memory *find_memory(const char *name) {
+  for(unsigned int i = 0; i < MEMORY_COUNT; i++)
+    if (strcmp(memories[i].name, name) == 0) return &memories[i];
+  fprintf(stderr, "mockdude: no memory called %s\n", name);
+  return NULL;
+}
+
+static void path_of(char *path, size_t size, const struct memory *m) {
+  snprintf(path, size, "%s/%s.bin", dir, m->name);
+}
+
+static int load(void) {
+  mkdir(dir, 0777);
+  for(unsigned int i = 0; i < MEMORY_COUNT; i++) {
+    struct memory *m = &memories[i];
+    char path[512];
+    m->data = malloc(m->size);
+    memset(m->data, 0xff, m->size);
+    path_of(path, sizeof(path), m);
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) continue; // a new chip
+    size_t got = fread(m->data, 1, m->size, f);
+    (void)got;
+    fclose(f);
+  }
+  return 0;
+}
+
+static int save(void) {
+  for(unsigned int i = 0; i < MEMORY_COUNT; i++) {
+    char path[512];
+    path_of(path, sizeof(path), &memories[i]);
+    FILE *f = fopen(path, "wb");
+    if (f == NULL || fwrite(memories[i].data, 1, memories[i].size, f) != (size_t)memories[i].size) {
+      perror(path);
+      if (f != NULL) fclose(f);
+      return 1;
+    }
+    fclose(f);
+  }
+  return 0;
+}
+
+// What base.c does at power-up, if the build ID is new.
+static void start_up(void) {
+  struct memory *flash = find_memory("flash"), *eeprom = find_memory("eeprom");
+  const uint8_t *trailer = flash->data + flash->size - BUILD_TRAILER_SIZE;
+  if (build_get32(trailer) == build_get32(eeprom->data + EE_BUILD_LOC)) return;
+  uint16_t length = build_get16(trailer + 4);
+  uint16_t crc = 0xffff;
+  if (length <= flash->size - BUILD_TRAILER_SIZE) crc = build_crc(flash->data, length);
+  eeprom->data[EE_BUILD_LOC + 4] = crc;
+  eeprom->data[EE_BUILD_LOC + 5] = crc >> 8;
+  memcpy(eeprom->data + EE_BUILD_LOC, trailer, 4);
+}
+
+// Read a file in the given format into a scratch image the size of m, and
+// mark which bytes it has in used. Returns one past the last, or -1.
+static long read_file(const struct memory *m, const char *file, char format,
+  uint8_t *image, uint8_t *used) {
+  memset(image, 0xff, m->size);
+  memset(used, 0, m->size);
+  if (format == 'i') return build_read_hex(file, image, used, m->size);
+  if (format == 'm') {
+    // immediate mode: the "file" is the bytes, separated by commas
+    long n = 0;
+    for(const char *p = file; *p != '\0' && n < m->size; n++) {
+      char *end;
+      image[n] = (uint8_t)strtoul(p, &end, 0);
+      used[n] = 1;
+      if (end == p) return -1;
+      p = (*end == ',') ? end + 1 : end;
+    }
+    return n;
+  }
+  FILE *f = fopen(file, "rb");
+  if (f == NULL) {
+    perror(file);
+    return -1;
+  }
+  long n = (long)fread(image, 1, m->size, f);
+  fclose(f);
+  memset(used, 1, n);
+  return n;
+}
+
+static int update(char *spec) {
+  char *name = strtok(spec, ":");
+  char *op = strtok(NULL, ":");
+  char *file = strtok(NULL, ":");
+  char *format = strtok(NULL, ":");
+  struct memory *m = (name != NULL) ? find_memory(name) : NULL;
+  if (m == NULL || op == NULL || file == NULL) return 1;
+  char fmt = (format != NULL) ? format[0] : (strstr(file, ".hex") != NULL ? 'i' : 'r');
+
+  if (op[0] == 'r') {
+    bytes_read += m->size;
+    FILE *f = fopen(file, "w");
+    if (f == NULL) {
+      perror(file);
+      return 1;
+    }
+    if (fmt == 'i') {
+      for(long a = 0; a < m->size; a += 16) {
+        uint8_t sum = 16 + (a >> 8) + (a & 0xff);
+        fprintf(f, ":10%04lX00", a);
+        for(int i = 0; i < 16; i++) {
+          fprintf(f, "%02X", m->data[a + i]);
+          sum += m->data[a + i];
+        }
+        fprintf(f, "%02X\n", (uint8_t)-sum);
+      }
+      fputs(":00000001FF\n", f);
+    } else
+      fwrite(m->data, 1, m->size, f);
+    fclose(f);
+    return 0;
+  }
+
+  uint8_t *image = malloc(m->size), *used = malloc(m->size);
+  long length = read_file(m, file, fmt, image, used);
+  if (length < 0) {
+    free(image);
+    free(used);
+    return 1;
+  }
+  int failed = 0;
+  if (op[0] == 'w') {
+    int is_flash = strcmp(m->name, "flash") == 0;
+    if (is_flash && erase_flash) memset(m->data, 0xff, m->size);
+    const char *page_erase = getenv("MOCKDUDE_PAGE_ERASE");
+    long page_size = (page_erase != NULL && *page_erase != '\0') ? strtol(page_erase, NULL, 0) : 0;
+    if (is_flash && !erase_flash && page_size > 0) {
+      for(long page = 0; page < m->size; page += page_size) {
+        int touched = 0;
+        for(long a = page; a < page + page_size && a < length; a++) touched |= used[a];
+        if (touched) memset(m->data + page, 0xff, page_size);
+      }
+    }
+    const char *fault = getenv("MOCKDUDE_FAULT");
+    long fault_at = (fault != NULL && *fault != '\0') ? strtol(fault, NULL, 0) : -1;
+    for(long a = 0; a < length; a++) {
+      if (!used[a]) continue;
+      // Flash bits only go from 1 to 0, without an erase.
+      m->data[a] = is_flash ? (m->data[a] & image[a]) : image[a];
+      if (is_flash && a == fault_at) m->data[a] ^= 1;
+      bytes_written++;
+    }
+    fprintf(stderr, "mockdude: %s written\n", m->name);
+  }
+  if (op[0] == 'v' || (op[0] == 'w' && verify)) {
+    bytes_read += length;
+    for(long a = 0; a < length; a++) {
+      if (!used[a]) continue;
+      if (m->data[a] != image[a]) {
+        fprintf(stderr, "mockdude: verification error at %s %04lx: %02x != %02x\n",
+          m->name, a, m->data[a], image[a]);
+        failed = 1;
+        break;
+      }
+    }
+  }
+  free(image);
+  free(used);
+  return failed;
+}
+
+// Like avrdude: 16 bytes a line, starting right at the address.
+static void dump(struct memory *m, long address, long length) {
+  if (address + length > m->size) length = m->size - address;
+  for(long line = address; line < address + length; line += 16) {
+    long n = (address + length - line < 16) ? address + length - line : 16;
+    printf("%04lx  ", line);
+    for(long i = 0; i < 16; i++) {
+      if (i < n) printf("%02x ", m->data[line + i]);
+      else printf("   ");
+    }
+    printf(" |");
+    for(long i = 0; i < 16; i++) {
+      uint8_t c = (i < n) ? m->data[line + i] : ' ';
+      putchar(c >= 32 && c < 127 ? c : '.');
+    }
+    printf("|\n");
+    bytes_read += n;
+  }
+}
+
+static int terminal(void) {
+  char line[512];
+  int failed = 0;
+  while(printf("avrdude> "), fgets(line, sizeof(line), stdin) != NULL) {
+    printf(">>> %s", line);
+    char *command = strtok(line, " \t\n");
+    if (command == NULL) continue;
+    if (strcmp(command, "quit") == 0) break;
+    char *name = strtok(NULL, " \t\n");
+    char *address = strtok(NULL, " \t\n");
+    struct memory *m = (name != NULL) ? find_memory(name) : NULL;
+    if (m == NULL || address == NULL) {
+      failed = 1;
+      continue;
+    }
+    long a = strtol(address, NULL, 0);
+    if (strcmp(command, "dump") == 0) {
+      char *length = strtok(NULL, " \t\n");
+      dump(m, a, length != NULL ? strtol(length, NULL, 0) : 64);
+    } else if (strcmp(command, "write") == 0) {
+      for(char *byte; (byte = strtok(NULL, " \t\n")) != NULL && a < m->size; a++) {
+        m->data[a] = (uint8_t)strtoul(byte, NULL, 0);
+        bytes_written++;
+      }
+    } else {
+      fprintf(stderr, "mockdude: can't %s\n", command);
+      failed = 1;
+    }
+  }
+  printf("\n");
+  return failed;
+}
+
+int main(int argc, char **argv) {
+  char *updates[16];
+  int update_count = 0, term = 0, erase = 0;
+  int c;
+
+  dir = getenv("MOCKDUDE_DIR");
+  if (dir == NULL || *dir == '\0') dir = "mockdude.d";
+  while((c = getopt(argc, argv, "C:c:p:B:P:U:VDetqv")) != -1) {
+    switch(c) {
+      case 'p':
+        if (strstr(optarg, "85") != NULL) {
+          memories[0].size = 8192;
+          memories[1].size = 512;
+        } else if (strstr(optarg, "25") != NULL) {
+          memories[0].size = 2048;
+          memories[1].size = 128;
+        }
+        break;
+      case 'U':
+        if (update_count < 16) updates[update_count++] = optarg;
+        break;
+      case 'V': verify = 0; break;
+      case 'D': erase_flash = 0; break;
+      case 'e': erase = 1; break;
+      case 't': term = 1; break;
+      case 'C': case 'c': case 'B': case 'P': case 'q': case 'v': break;
+      default:
+        fprintf(stderr, "mockdude: unknown option\n");
+        return 1;
+    }
+  }
+
+  load();
+  int failed = 0;
+  if (erase) memset(find_memory("flash")->data, 0xff, find_memory("flash")->size);
+  if (term) failed |= terminal();
+  for(int i = 0; i < update_count && !failed; i++) failed |= update(updates[i]);
+  start_up();
+  failed |= save();
+  fprintf(stderr, "mockdude: %ld bytes written, %ld bytes read\n", bytes_written, bytes_read);
+  return failed;
+}
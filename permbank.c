@@ -0,0 +1,209 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * This generates crazy_bank.h, the bank of precomputed instruction lists
+ * for crazy.c's PERMUTATION_BANK option.
+ *
+ * usage: permbank [list length] [entries] > crazy_bank.h
+ *
+ * crazy.c normally builds each list from LIST_LENGTH / 2 pairs, each a
+ * coin flip between slow+fast and normal+normal, and then shuffles it. So
+ * the number of slow+fast pairs in a list is binomially distributed. The
+ * bank keeps exactly that distribution: with 6 pairs and 64 entries, there
+ * is 1 entry with no slow+fast pairs, 6 with one, 15 with two, 20 with three
+ * and so on. crazy.c picks an entry, rotates it to a random starting place
+ * and randomly swaps slow for fast, which takes care of evening out which
+ * positions get which speeds.
+ *
+ * What's left is which speeds follow which, and that's what most of the
+ * unpredictability of the tick stream comes from. So rather than taking
+ * whatever a single shuffle gives us, each entry is the best of many
+ * shuffles at keeping the bank's counts of adjacent speed pairs (going all
+ * the way around, since crazy.c rotates) at what a fresh shuffle of every
+ * list would give on average.
+ *
+ * An entry that's a rotation of another, or the same with slow and fast
+ * swapped, gives crazy.c exactly the same lists, which would waste it. So
+ * candidates like that only get picked if there are none that aren't, and
+ * one that's the same as another entry outright only if there's nothing
+ * else (the list with no slow+fast pairs, in a bank of more than 64).
+ *
+ * The entries are packed four to a byte, first element in the low bits.
+ * The output is deterministic, so regenerating it doesn't churn the tree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// These must match crazy.c
+#define SLOW_SPEED 1
+#define NORMAL_SPEED 2
+#define FAST_SPEED 3
+
+static unsigned long state = 0x2545f491UL;
+
+static unsigned long next_random() {
+  // xorshift32 - this only has to be deterministic.
+  state ^= (state << 13) & 0xffffffffUL;
+  state ^= state >> 17;
+  state ^= (state << 5) & 0xffffffffUL;
+  return state;
+}
+
+// How many candidate shuffles to try for each entry.
+#define CANDIDATES 4000
+
+static void shuffle(unsigned char *list, unsigned int length) {
+  for(unsigned int i = length - 1; i > 0; i--) {
+    unsigned int j = next_random() % (i + 1);
+    unsigned char temp = list[i];
+    list[i] = list[j];
+    list[j] = temp;
+  }
+}
+
+static void count_pairs(const unsigned char *list, unsigned int length, double pairs[4][4]) {
+  for(unsigned int i = 0; i < length; i++)
+    pairs[list[i]][list[(i + 1) % length]]++;
+}
+
+// The smallest of every rotation of the list, each with and without slow
+// and fast swapped. Lists that crazy.c can't tell apart come out the same.
+static void canonical(const unsigned char *list, unsigned int length, unsigned char *out) {
+  unsigned char trial[64];
+  int first = 1;
+  for(unsigned int r = 0; r < length; r++)
+    for(unsigned int swap = 0; swap < 2; swap++) {
+      for(unsigned int i = 0; i < length; i++) {
+        unsigned char op = list[(i + r) % length];
+        trial[i] = (swap && op != NORMAL_SPEED) ? op ^ (SLOW_SPEED ^ FAST_SPEED) : op;
+      }
+      if (first || memcmp(trial, out, length) < 0) memcpy(out, trial, length);
+      first = 0;
+    }
+}
+
+// 0 for a list that's new, 1 for one that's only new as it stands, and 2
+// for one that's already in the bank.
+static int repeat(const unsigned char *list, unsigned int length,
+  unsigned char (*bank)[64], unsigned char (*forms)[64], unsigned int count) {
+  unsigned char form[64];
+  int worst = 0;
+  canonical(list, length, form);
+  for(unsigned int i = 0; i < count && worst < 2; i++) {
+    if (memcmp(list, bank[i], length) == 0)
+      worst = 2;
+    else if (memcmp(form, forms[i], length) == 0)
+      worst = 1;
+  }
+  return worst;
+}
+
+static unsigned long choose(unsigned int n, unsigned int k) {
+  unsigned long r = 1;
+  for(unsigned int i = 1; i <= k; i++) r = r * (n - k + i) / i;
+  return r;
+}
+
+int main(int argc, char **argv) {
+  unsigned int length = argc > 1 ? atoi(argv[1]) : 12;
+  unsigned int entries = argc > 2 ? atoi(argv[2]) : 0;
+  unsigned int pairs = length / 2;
+
+  if (length < 2 || length % 2 != 0 || length > 64 || pairs > 16) {
+    fprintf(stderr, "The list length must be even and no more than 32.\n");
+    return 1;
+  }
+  if (entries == 0) entries = 1U << pairs;
+  if (entries > 256 || (entries & (entries - 1)) != 0 || entries < (1U << pairs)) {
+    fprintf(stderr, "The entry count must be a power of 2 between %u and 256.\n", 1U << pairs);
+    return 1;
+  }
+  unsigned int copies = entries >> pairs; // how many times over the binomial fits
+  unsigned int entry_bytes = (length + 3) / 4;
+
+  printf("// Generated by permbank.c ('make crazy_bank.h') - don't edit.\n");
+  printf("// %u entries of %u elements, %u bytes of flash.\n\n", entries, length, entries * entry_bytes);
+  printf("#define BANK_LIST_LENGTH (%u)\n", length);
+  printf("#define BANK_ENTRIES (%u)\n", entries);
+  printf("#define BANK_ENTRY_BYTES (%u)\n\n", entry_bytes);
+  printf("PROGMEM const unsigned char bank_table[] = {\n");
+
+  static unsigned char bank[256][64], forms[256][64];
+  unsigned int made = 0;
+  unsigned char list[64], best[64];
+  for(unsigned int k = 0; k <= pairs; k++) {
+    unsigned long count = choose(pairs, k) * copies;
+
+    // The expected number of each adjacent pair in one entry.
+    double n[4] = { 0, k, length - 2 * k, k };
+    double expect[4][4], have[4][4] = { { 0 } };
+    for(int a = 1; a < 4; a++)
+      for(int b = 1; b < 4; b++)
+        expect[a][b] = length * n[a] * (n[b] - (a == b)) / (length * (length - 1.0));
+
+    for(unsigned long c = 0; c < count; c++) {
+      unsigned int i = 0;
+      for(unsigned int p = 0; p < k; p++) {
+        list[i++] = SLOW_SPEED;
+        list[i++] = FAST_SPEED;
+      }
+      while(i < length) list[i++] = NORMAL_SPEED;
+
+      double best_error = -1;
+      int best_repeat = 3;
+      for(unsigned int t = 0; t < CANDIDATES; t++) {
+        double trial[4][4];
+        memcpy(trial, have, sizeof(trial));
+        shuffle(list, length);
+        count_pairs(list, length, trial);
+        double error = 0;
+        for(int a = 1; a < 4; a++)
+          for(int b = 1; b < 4; b++) {
+            double d = trial[a][b] - expect[a][b] * (c + 1);
+            error += d * d;
+          }
+        int r = repeat(list, length, bank, forms, made);
+        if (r < best_repeat || (r == best_repeat && error < best_error)) {
+          best_repeat = r;
+          best_error = error;
+          memcpy(best, list, length);
+        }
+      }
+      memcpy(list, best, length);
+      count_pairs(list, length, have);
+      memcpy(bank[made], list, length);
+      canonical(list, length, forms[made++]);
+
+      printf(" ");
+      for(unsigned int b = 0; b < entry_bytes; b++) {
+        unsigned int byte = 0;
+        for(unsigned int e = 0; e < 4 && b * 4 + e < length; e++)
+          byte |= list[b * 4 + e] << (e * 2);
+        printf(" 0x%02x,", byte);
+      }
+      printf(" // %u slow/fast pairs\n", k);
+    }
+  }
+  printf("};\n");
+  return 0;
+}
@@ -0,0 +1,99 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * The loop behind PPS (see base.c), which keeps the trim in step with a
+ * GPS module's 1PPS output. It's included by base.c, and by ppscheck.c,
+ * which runs it against a made-up crystal on the host.
+ *
+ * Each edge comes with its phase: where in our own second it came, in
+ * PPS_UNITS a second. That's 512 to a tenth, and 10 to a Timer0 count,
+ * which is as fine as it's measured. The first edge sets the phase that
+ * the loop holds the edges at from then on, so nothing jumps. After that,
+ * the error is how far from it each edge is, and the trim (in tenths of a
+ * ppm, positive to slow down, just like the one in the EEPROM) is
+ *
+ *   freq + error * PPS_KP
+ *
+ * where freq adds up error * PPS_KI, over 2^PPS_FREQ_SHIFT, every second.
+ * A trim of PPS_UNITS_TRIM moves the phase by one unit a second, so the
+ * error goes down with a time constant of PPS_UNITS_TRIM / PPS_KP seconds
+ * (two minutes), and PPS_KI is as big as it can be without the loop
+ * overshooting. freq is what the crystal really needs, learned as it goes,
+ * so that's the trim when the edges stop (holdover), and what base.c
+ * writes back to the EEPROM. An error of more than PPS_RELOCK means the
+ * phase has been lost (a long holdover, or a glitch) and the loop starts
+ * over from the next edge, keeping freq.
+ */
+
+#define PPS_UNITS (5120)
+// Tenths of a ppm, for one unit a second. A unit is 1/5120 sec.
+#define PPS_UNITS_TRIM (1953)
+#define PPS_KP (16)
+#define PPS_KI (8)
+#define PPS_FREQ_SHIFT (8)
+// About 100 msec
+#define PPS_RELOCK (512)
+// As far as the trim goes, either way: 200 ppm.
+#define PPS_TRIM_MAX (2000)
+// ref, before there's been an edge.
+#define PPS_NONE (-1)
+
+struct pps {
+  int ref; // the phase the edges are held at
+  long freq; // in tenths of a ppm, times 2^PPS_FREQ_SHIFT
+  unsigned int locked; // seconds since ref was set
+};
+
+static int pps_clamp(long trim) {
+  if (trim > PPS_TRIM_MAX) return PPS_TRIM_MAX;
+  if (trim < -PPS_TRIM_MAX) return -PPS_TRIM_MAX;
+  return (int)trim;
+}
+
+// Start from the trim that's in the EEPROM.
+static void pps_init(struct pps *p, int trim) {
+  p->ref = PPS_NONE;
+  p->freq = (long)trim << PPS_FREQ_SHIFT;
+  p->locked = 0;
+}
+
+// The trim to use when there aren't any edges.
+static int pps_holdover(const struct pps *p) {
+  return pps_clamp(p->freq >> PPS_FREQ_SHIFT);
+}
+
+// An edge came at phase (0 to PPS_UNITS - 1). Returns the trim to use now.
+static int pps_edge(struct pps *p, int phase) {
+  int error = phase - p->ref;
+  if (error >= PPS_UNITS / 2) error -= PPS_UNITS;
+  if (error < -PPS_UNITS / 2) error += PPS_UNITS;
+  if (p->ref == PPS_NONE || error > PPS_RELOCK || error < -PPS_RELOCK) {
+    p->ref = phase;
+    p->locked = 0;
+    return pps_holdover(p);
+  }
+  if (p->locked != 0xffff) p->locked++;
+  p->freq += (long)error * PPS_KI;
+  long limit = (long)PPS_TRIM_MAX << PPS_FREQ_SHIFT;
+  if (p->freq > limit) p->freq = limit;
+  if (p->freq < -limit) p->freq = -limit;
+  return pps_clamp((p->freq >> PPS_FREQ_SHIFT) + (long)error * PPS_KP);
+}
@@ -0,0 +1,220 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Runs the PPS loop (pps.h) against a made-up crystal and GPS module, for
+ * 'make ppscheck'.
+ *
+ * ppscheck [-s seed] [-p ms] [-d ms]
+ *
+ * The crystal is off by some ppm, which can wander up and down over the
+ * hours like the temperature does. Timer0 counts it out into tenths the
+ * way base.c's interrupt does, with the trim nudging a tenth by a count
+ * here and there, and the 1PPS edges come every true second, timestamped
+ * to the count. Each edge goes through pps_edge(), and its trim goes
+ * straight back to the interrupt. When the edges stop, it's
+ * pps_holdover()'s trim.
+ *
+ * What's measured is when the clock's seconds start (every tenth tenth,
+ * which is when normal.c ticks), against true time. Once the loop has
+ * settled, each run prints how far apart the earliest and latest of those
+ * were (p2p) and their spread (rms), in msec, and the trim it learned
+ * against what the crystal really needed. Runs with an outage print how
+ * far the seconds drifted by the end of it (holdover), and the spread
+ * again once the edges have been back for an hour. It fails if a spread is
+ * over -p msec (default 5) or a holdover over -d (default 5) for each hour
+ * of outage.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pps.h"
+
+// The same as base.c's.
+#define CLOCK_CYCLES (5)
+#define CLOCK_BASIC_CYCLE (51 - 1)
+#define CLOCK_NUM_LONG_CYCLES (1)
+#define TRIM_NUDGE (50000000UL)
+#define TRIM_COUNTS_PER_TENTH (256)
+#define COUNTS_PER_SECOND (512.0)
+#define HOUR (36000L) // tenths
+
+struct crystal {
+  const char *name;
+  double ppm, wander, wander_hours; // off by ppm, plus wander * sin(2 pi t / wander_hours)
+  int eeprom_trim; // what's in the EEPROM to start with
+  long hours, outage_from, outage_hours;
+};
+
+// base.c's interrupt, as it is when it's built with PPS, and what it's
+// been told.
+struct timer {
+  unsigned char cycle_pos, ocr;
+  unsigned long trim_pos, trim_step;
+  char trim_offset;
+  unsigned char tenth; // of the second
+};
+
+static void set_trim(struct timer *t, int trim) {
+  t->trim_step = (unsigned long)abs(trim) * TRIM_COUNTS_PER_TENTH;
+  t->trim_offset = (trim == 0) ? 0 : (trim < 0) ? -1 : 1;
+}
+
+// The compare match interrupt. Returns how many counts the next tenth is.
+static unsigned int timer_isr(struct timer *t) {
+  char offset = 0;
+  if (t->trim_offset != 0) {
+    t->trim_pos += t->trim_step;
+    if (t->trim_pos >= TRIM_NUDGE) {
+      t->trim_pos -= TRIM_NUDGE;
+      offset = t->trim_offset;
+    }
+  }
+  if (++t->cycle_pos >= CLOCK_CYCLES) t->cycle_pos = 0;
+  if (t->cycle_pos >= CLOCK_NUM_LONG_CYCLES)
+    t->ocr = CLOCK_BASIC_CYCLE + offset;
+  else
+    t->ocr = CLOCK_BASIC_CYCLE + 1 + offset;
+  if (++t->tenth == 10) t->tenth = 0;
+  return t->ocr + 1;
+}
+
+// Where the clock's seconds start, against true time, in msec.
+struct spread {
+  double n, mean, m2, lo, hi;
+};
+
+static void spread_add(struct spread *s, double x) {
+  if (s->n == 0 || x < s->lo) s->lo = x;
+  if (s->n == 0 || x > s->hi) s->hi = x;
+  s->n++;
+  double d = x - s->mean;
+  s->mean += d / s->n;
+  s->m2 += d * (x - s->mean);
+}
+
+static double spread_rms(const struct spread *s) {
+  return s->n > 1 ? sqrt(s->m2 / (s->n - 1)) : 0;
+}
+
+static double crystal_ppm(const struct crystal *c, double t) {
+  if (c->wander_hours == 0) return c->ppm;
+  return c->ppm + c->wander * sin(2 * M_PI * t / (c->wander_hours * 3600));
+}
+
+static int run(const struct crystal *c, double phase_ms, double drift_ms) {
+  struct timer tm;
+  struct pps pps;
+  memset(&tm, 0, sizeof(tm));
+  tm.ocr = CLOCK_BASIC_CYCLE + 1;
+  set_trim(&tm, c->eeprom_trim);
+  pps_init(&pps, c->eeprom_trim);
+
+  // The edges come at this much past each true second.
+  double edge_at = random() / (double)RAND_MAX;
+  double t = 0; // true time at the start of this tenth
+  unsigned int counts = tm.ocr + 1; // in this tenth
+  long slots = c->hours * HOUR;
+  long outage_to = c->outage_from + c->outage_hours * HOUR;
+  long settled_from = (c->outage_hours != 0 ? c->outage_from : slots) - 3 * HOUR;
+  struct spread settled = { 0 }, after = { 0 };
+  double first = NAN, unwrap = 0, last = 0, holdover = NAN, needed = 0;
+  int failed = 0;
+
+  for(long slot = 0; slot < slots; slot++) {
+    double rate = COUNTS_PER_SECOND * (1 + crystal_ppm(c, t) * 1e-6);
+    double length = counts / rate;
+    if (tm.tenth == 0) {
+      // A second starts. Keep track of it without wrapping.
+      double ms = fmod(t - edge_at, 1.0) * 1000;
+      if (isnan(first)) first = last = ms;
+      if (ms - last > 500) unwrap -= 1000;
+      if (ms - last < -500) unwrap += 1000;
+      last = ms;
+      double at = ms + unwrap;
+      if (slot >= settled_from && slot < settled_from + 3 * HOUR) spread_add(&settled, at);
+      if (c->outage_hours != 0 && slot >= outage_to - 10 && slot < outage_to)
+        holdover = at - settled.mean;
+      if (c->outage_hours != 0 && slot >= outage_to + HOUR) spread_add(&after, at);
+    }
+    int edges = c->outage_hours == 0 || slot < c->outage_from || slot >= outage_to;
+    double next_edge = floor(t - edge_at) + 1 + edge_at;
+    if (next_edge < t + length) {
+      // There's an edge in this tenth.
+      unsigned int count = (unsigned int)((next_edge - t) * rate);
+      if (count >= counts) count = counts - 1;
+      if (edges) set_trim(&tm, pps_edge(&pps, tm.tenth * 512 + count * 10));
+    }
+    if (!edges && slot == c->outage_from) set_trim(&tm, pps_holdover(&pps));
+    if (slot == slots - 1) needed = crystal_ppm(c, t) * 10;
+    t += length;
+    counts = timer_isr(&tm);
+  }
+
+  double rms = spread_rms(&settled), p2p = settled.hi - settled.lo;
+  printf("%s: p2p=%.2f rms=%.2f trim=%d needed=%.0f", c->name, p2p, rms,
+    pps_holdover(&pps), needed);
+  if (p2p > phase_ms) failed = 1;
+  if (c->outage_hours != 0) {
+    printf(" holdover=%.2f after_p2p=%.2f", holdover, after.hi - after.lo);
+    if (fabs(holdover) > drift_ms * c->outage_hours || after.hi - after.lo > phase_ms) failed = 1;
+  }
+  printf("%s\n", failed ? " FAILED" : "");
+  return failed;
+}
+
+int main(int argc, char **argv) {
+  unsigned long seed = 1;
+  double phase_ms = 5, drift_ms = 5;
+  int c;
+
+  while((c = getopt(argc, argv, "s:p:d:")) != -1) {
+    switch(c) {
+      case 's': seed = strtoul(optarg, NULL, 0); break;
+      case 'p': phase_ms = atof(optarg); break;
+      case 'd': drift_ms = atof(optarg); break;
+      default: goto usage;
+    }
+  }
+  if (optind != argc) goto usage;
+  srandom(seed);
+
+  static const struct crystal runs[] = {
+    // name, ppm, wander, wander_hours, eeprom_trim, hours, outage_from, outage_hours
+    { "steady", 15, 0, 0, 0, 6, 0, 0 },
+    { "calibrated", -8.3, 0, 0, -83, 6, 0, 0 },
+    { "wander", 15, 2, 6, 150, 12, 0, 0 },
+    { "holdover", 15, 0, 0, 0, 10, 6 * HOUR, 1 },
+    { "holdover-wander", 15, 2, 24, 150, 30, 24 * HOUR, 1 },
+    { "long-outage", 15, 0, 0, 100, 36, 6 * HOUR, 24 },
+  };
+  int failed = 0;
+  for(unsigned int i = 0; i < sizeof(runs) / sizeof(runs[0]); i++)
+    failed |= run(&runs[i], phase_ms, drift_ms);
+  return failed;
+
+usage:
+  fprintf(stderr, "usage: %s [-s seed] [-p ms] [-d ms]\n", argv[0]);
+  return 1;
+}
@@ -0,0 +1,482 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Turns rhythms into tick tables for the Tuney and Rhythm clocks.
+ *
+ * usage: quantise [-f tuney|rhythm|pgm] [-p [-s speed]] [-w weight] [-k note] [-m msec] file ...
+ *
+ * Each file is either a standard MIDI file or a list of onset times in
+ * seconds, one per line ('#' starts a comment). The first onset is the first
+ * tick and the last one is where the rhythm ends: for tuney, the tick that
+ * starts normal time again, and for rhythm, the first tick of the next time
+ * around. So n + 1 onsets make n gaps. From MIDI, every note-on is an onset
+ * (or just the ones for note number -k), and onsets less than -m msec
+ * (default 30) apart are taken as one.
+ *
+ * The clocks can only tick on a tenth-of-a-second, and the gaps have to add
+ * up exactly, or the clock won't keep time:
+ *
+ *   tuney  - n gaps take 10n tenths. Each gap is 2 to 256 tenths.
+ *   rhythm - n gaps take 10n tenths, and n must divide 60 (so the rhythm
+ *            starts on a minute). Each gap but the last is 1 to 255 tenths.
+ *
+ * So the rhythm is stretched or squeezed to fit the total exactly, and then
+ * the gaps are picked by dynamic programming over the tick positions to give
+ * the smallest total of:
+ *
+ *   - the squared distance of each tick from where it should be, in tenths, plus
+ *   - weight (default 1) times the squared error of each gap, divided by
+ *     how long the gap should be - a short gap a tenth off is much more
+ *     noticeable than a long one.
+ *
+ * That's the best there is subject to the total, not just rounding, which
+ * can't be made to add up in general.
+ *
+ * Stretching the whole rhythm can be a lot - it's 10 tenths per gap no
+ * matter how fast the rhythm is. With -p, the first and last gaps are just
+ * rests before and after, and the rhythm in between is played at speed
+ * (default 1, which is as written), with the rests taking up the slack.
+ * That's how the songs in tuney.c are done.
+ *
+ * -f tuney  (the default) prints a table per file, plus song_table and
+ *           SONG_COUNT. 'make songs SONGS="..."' puts those in tuney_songs.h
+ *           and builds tuney-songs.hex with them instead of the usual three.
+ * -f rhythm prints an EEPROM image for rhythm.c (see rhythm.md). Just one file.
+ * -f pgm    prints sleep[] and WAIT for rhythm_pgm.c. Just one file.
+ *
+ * How far off each result is goes to stderr.
+ */
+
+#include <ctype.h>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_ONSETS (1024)
+
+static double onsets[MAX_ONSETS];
+static unsigned int onset_count;
+
+static double merge_window = 0.030;
+static int only_note = -1;
+
+static void add_onset(double t) {
+  if (onset_count >= MAX_ONSETS) return;
+  onsets[onset_count++] = t;
+}
+
+static int compare_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Sort and merge near-simultaneous onsets (chords, flams).
+static void tidy_onsets() {
+  qsort(onsets, onset_count, sizeof(double), compare_double);
+  unsigned int out = 0;
+  for(unsigned int i = 0; i < onset_count; i++) {
+    if (out > 0 && onsets[i] - onsets[out - 1] < merge_window) continue;
+    onsets[out++] = onsets[i];
+  }
+  onset_count = out;
+}
+
+static int read_text(FILE *f) {
+  char line[256];
+  while(fgets(line, sizeof(line), f) != NULL) {
+    char *hash = strchr(line, '#');
+    if (hash != NULL) *hash = 0;
+    char *end;
+    double t = strtod(line, &end);
+    if (end != line) add_onset(t);
+  }
+  return 0;
+}
+
+// MIDI
+
+struct midi_event {
+  unsigned long tick;
+  unsigned long tempo; // 0 for a note
+};
+
+static struct midi_event *events;
+static unsigned int event_count, event_space;
+
+static void add_event(unsigned long tick, unsigned long tempo) {
+  if (event_count == event_space) {
+    event_space = event_space ? event_space * 2 : 256;
+    events = realloc(events, event_space * sizeof(*events));
+  }
+  events[event_count].tick = tick;
+  events[event_count].tempo = tempo;
+  event_count++;
+}
+
+static int compare_event(const void *a, const void *b) {
+  const struct midi_event *x = a, *y = b;
+  if (x->tick != y->tick) return (x->tick > y->tick) - (x->tick < y->tick);
+  // tempo changes first
+  return (y->tempo != 0) - (x->tempo != 0);
+}
+
+static unsigned long varlen(const unsigned char **p, const unsigned char *end) {
+  unsigned long value = 0;
+  while(*p < end) {
+    unsigned char c = *(*p)++;
+    value = (value << 7) | (c & 0x7f);
+    if (!(c & 0x80)) break;
+  }
+  return value;
+}
+
+static unsigned long be(const unsigned char *p, int bytes) {
+  unsigned long value = 0;
+  while(bytes--) value = (value << 8) | *p++;
+  return value;
+}
+
+static int read_track(const unsigned char *p, const unsigned char *end) {
+  unsigned long tick = 0;
+  unsigned char status = 0;
+  while(p < end) {
+    tick += varlen(&p, end);
+    if (p >= end) return 1;
+    if (*p & 0x80) status = *p++;
+    else if (status == 0) return 1; // running status with nothing to run
+    if (status == 0xff) {
+      if (p >= end) return 1;
+      unsigned char type = *p++;
+      unsigned long length = varlen(&p, end);
+      if (p + length > end) return 1;
+      if (type == 0x51 && length == 3) add_event(tick, be(p, 3));
+      if (type == 0x2f) return 0; // end of track
+      p += length;
+      status = 0;
+    } else if (status == 0xf0 || status == 0xf7) {
+      unsigned long length = varlen(&p, end);
+      p += length;
+      status = 0;
+    } else {
+      int data = ((status & 0xe0) == 0xc0) ? 1 : 2;
+      if (p + data > end) return 1;
+      if ((status & 0xf0) == 0x90 && p[1] != 0 && (only_note < 0 || p[0] == only_note))
+        add_event(tick, 0);
+      p += data;
+    }
+  }
+  return 0;
+}
+
+static int read_midi(const unsigned char *data, unsigned long size) {
+  if (size < 14 || memcmp(data, "MThd", 4) != 0) return 1;
+  unsigned long header = be(data + 4, 4);
+  unsigned int division = be(data + 12, 2);
+  const unsigned char *p = data + 8 + header, *end = data + size;
+
+  event_count = 0;
+  while(p + 8 <= end) {
+    unsigned long length = be(p + 4, 4);
+    if (p + 8 + length > end) return 1;
+    if (memcmp(p, "MTrk", 4) == 0 && read_track(p + 8, p + 8 + length)) return 1;
+    p += 8 + length;
+  }
+  qsort(events, event_count, sizeof(*events), compare_event);
+
+  // Walk the tempo map. Time codes are fixed ticks per second instead.
+  double seconds = 0, per_tick;
+  unsigned long last = 0;
+  if (division & 0x8000)
+    per_tick = 1.0 / ((double)-(signed char)(division >> 8) * (division & 0xff));
+  else
+    per_tick = 0.5 / division; // 120 bpm until told otherwise
+  for(unsigned int i = 0; i < event_count; i++) {
+    seconds += (events[i].tick - last) * per_tick;
+    last = events[i].tick;
+    if (events[i].tempo == 0)
+      add_onset(seconds);
+    else if (!(division & 0x8000))
+      per_tick = events[i].tempo / 1e6 / division;
+  }
+  return 0;
+}
+
+static int read_file(const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    perror(path);
+    return 1;
+  }
+  onset_count = 0;
+  unsigned char magic[4];
+  int is_midi = fread(magic, 1, 4, f) == 4 && memcmp(magic, "MThd", 4) == 0;
+  rewind(f);
+  int failed;
+  if (is_midi) {
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    rewind(f);
+    unsigned char *data = malloc(size);
+    failed = fread(data, 1, size, f) != (size_t)size || read_midi(data, size);
+    free(data);
+    if (failed) fprintf(stderr, "%s: not a MIDI file I can read\n", path);
+  } else
+    failed = read_text(f);
+  fclose(f);
+  tidy_onsets();
+  return failed;
+}
+
+// The quantiser
+
+struct limits {
+  unsigned int min_gap, max_gap; // for all but the last
+  unsigned int min_last, max_last; // for the last
+};
+
+// Picks the gaps between onsets first and last (gaps[0] is the one after
+// first), with first on tick 0 and last on a tick from end_min to end_max,
+// and lo[] and hi[] limiting each gap. Returns the cost and sets *end, or
+// returns -1 if there's no way to do it.
+static double quantise(unsigned int first, unsigned int last, double scale,
+    unsigned int end_min, unsigned int end_max, const unsigned int *lo, const unsigned int *hi,
+    double weight, unsigned int *gaps, unsigned int *end, double *worst) {
+  unsigned int n = last - first;
+  unsigned int total = end_max;
+  double *cost = malloc(sizeof(double) * (n + 1) * (total + 1));
+  unsigned short *from = malloc(sizeof(unsigned short) * (n + 1) * (total + 1));
+#define AT(i, q) ((size_t)(i) * (total + 1) + (q))
+
+  for(unsigned int q = 0; q <= total; q++) cost[AT(0, q)] = DBL_MAX;
+  cost[AT(0, 0)] = 0;
+  for(unsigned int i = 1; i <= n; i++) {
+    double want = (onsets[first + i] - onsets[first]) * scale;
+    double want_gap = (onsets[first + i] - onsets[first + i - 1]) * scale;
+    for(unsigned int q = 0; q <= total; q++) {
+      double best = DBL_MAX;
+      unsigned int best_gap = 0;
+      if (i < n || q >= end_min) {
+        for(unsigned int g = lo[i - 1]; g <= hi[i - 1] && g <= q; g++) {
+          double before = cost[AT(i - 1, q - g)];
+          if (before == DBL_MAX) continue;
+          double e = g - want_gap;
+          double c = before + weight * e * e / (want_gap > 1 ? want_gap : 1);
+          if (c < best) {
+            best = c;
+            best_gap = g;
+          }
+        }
+      }
+      if (best != DBL_MAX) best += (q - want) * (q - want);
+      cost[AT(i, q)] = best;
+      from[AT(i, q)] = best_gap;
+    }
+  }
+
+  double result = DBL_MAX;
+  for(unsigned int q = end_min; q <= end_max; q++) {
+    if (cost[AT(n, q)] < result) {
+      result = cost[AT(n, q)];
+      *end = q;
+    }
+  }
+  if (result != DBL_MAX) {
+    *worst = 0;
+    unsigned int q = *end;
+    for(unsigned int i = n; i > 0; i--) {
+      double off = fabs(q - (onsets[first + i] - onsets[first]) * scale);
+      if (off > *worst) *worst = off;
+      gaps[i - 1] = from[AT(i, q)];
+      q -= gaps[i - 1];
+    }
+  } else
+    result = -1;
+  free(cost);
+  free(from);
+  return result;
+#undef AT
+}
+
+// Fits all n = onset_count - 1 gaps into exactly 10n tenths, either by
+// stretching the whole thing to fit or, with padding, by playing everything
+// but the first and last gap at speed and splitting what's left between them.
+static double fit(const struct limits *lim, int padding, double speed, double weight,
+    unsigned int *gaps, double *worst, double *played_at) {
+  unsigned int n = onset_count - 1;
+  unsigned int total = 10 * n;
+  unsigned int lo[MAX_ONSETS], hi[MAX_ONSETS];
+  for(unsigned int i = 0; i < n; i++) {
+    lo[i] = (i == n - 1) ? lim->min_last : lim->min_gap;
+    hi[i] = (i == n - 1) ? lim->max_last : lim->max_gap;
+  }
+  unsigned int end;
+  if (!padding || n < 3) {
+    *played_at = total / (onsets[n] - onsets[0]) / 10;
+    return quantise(0, n, total / (onsets[n] - onsets[0]), total, total, lo, hi, weight, gaps, &end, worst);
+  }
+
+  // The middle can end anywhere that leaves room for both pads.
+  unsigned int pad_min = lo[0] + lo[n - 1], pad_max = hi[0] + hi[n - 1];
+  if (pad_min > total) return -1;
+  *played_at = speed;
+  double cost = quantise(1, n - 1, 10 * speed, pad_max > total ? 0 : total - pad_max, total - pad_min,
+    lo + 1, hi + 1, weight, gaps + 1, &end, worst);
+  if (cost < 0) return cost;
+  unsigned int pad = total - end;
+  gaps[0] = pad / 2;
+  if (gaps[0] < lo[0]) gaps[0] = lo[0];
+  if (gaps[0] > hi[0]) gaps[0] = hi[0];
+  if (pad - gaps[0] > hi[n - 1]) gaps[0] = pad - hi[n - 1];
+  if (pad - gaps[0] < lo[n - 1]) gaps[0] = pad - lo[n - 1];
+  gaps[n - 1] = pad - gaps[0];
+  return cost;
+}
+
+// Double check the invariants the clocks depend on.
+static int check(const unsigned int *gaps, unsigned int n, const struct limits *lim) {
+  unsigned int sum = 0;
+  for(unsigned int i = 0; i < n; i++) {
+    unsigned int lo = (i == n - 1) ? lim->min_last : lim->min_gap;
+    unsigned int hi = (i == n - 1) ? lim->max_last : lim->max_gap;
+    if (gaps[i] < lo || gaps[i] > hi) return 1;
+    sum += gaps[i];
+  }
+  return sum != 10 * n;
+}
+
+static void identifier(const char *path, char *out, size_t len) {
+  const char *base = strrchr(path, '/');
+  base = base ? base + 1 : path;
+  size_t i = 0;
+  if (!isalpha((unsigned char)*base)) out[i++] = 's';
+  for(; *base && *base != '.' && i < len - 1; base++)
+    out[i++] = isalnum((unsigned char)*base) ? tolower((unsigned char)*base) : '_';
+  out[i] = 0;
+}
+
+static void intel_hex(const unsigned char *data, unsigned int length, unsigned int address) {
+  unsigned int sum = length + (address >> 8) + (address & 0xff);
+  printf(":%02X%04X00", length, address);
+  for(unsigned int i = 0; i < length; i++) {
+    printf("%02X", data[i]);
+    sum += data[i];
+  }
+  printf("%02X\n", (256 - sum % 256) % 256);
+  printf(":00000001FF\n");
+}
+
+int main(int argc, char **argv) {
+  const char *format = "tuney";
+  double weight = 1, speed = 1;
+  int padding = 0, c;
+
+  while((c = getopt(argc, argv, "f:w:k:m:ps:")) != -1) {
+    switch(c) {
+      case 'p': padding = 1; break;
+      case 's': speed = atof(optarg); break;
+      case 'f': format = optarg; break;
+      case 'w': weight = atof(optarg); break;
+      case 'k': only_note = atoi(optarg); break;
+      case 'm': merge_window = atof(optarg) / 1000; break;
+      default: goto usage;
+    }
+  }
+  int tuney = strcmp(format, "tuney") == 0;
+  if (optind >= argc || (!tuney && strcmp(format, "rhythm") != 0 && strcmp(format, "pgm") != 0)
+    || (!tuney && argc - optind != 1)) goto usage;
+
+  struct limits lim;
+  if (tuney) {
+    // Each entry is a tick, then that many sleeps. 0 ends the song.
+    lim.min_gap = lim.min_last = 2;
+    lim.max_gap = lim.max_last = 256;
+  } else {
+    // The sleeps are bytes. The wait is a word, but the total caps it.
+    lim.min_gap = lim.min_last = 1;
+    lim.max_gap = 255;
+    lim.max_last = 600;
+  }
+
+  char (*names)[64] = calloc(argc, sizeof(*names));
+  int songs = 0, failed = 0;
+  if (tuney) printf("// Generated by quantise.c - don't edit.\n\n");
+  for(int a = optind; a < argc; a++) {
+    if (read_file(argv[a])) {
+      failed = 1;
+      continue;
+    }
+    unsigned int n = onset_count - 1;
+    if (onset_count < 2 || onsets[n] <= onsets[0]) {
+      fprintf(stderr, "%s: needs at least two onsets\n", argv[a]);
+      failed = 1;
+      continue;
+    }
+    if (!tuney && (n > 60 || 60 % n != 0)) {
+      fprintf(stderr, "%s: %u gaps, but a rhythm needs a number that divides 60\n", argv[a], n);
+      failed = 1;
+      continue;
+    }
+
+    unsigned int gaps[MAX_ONSETS];
+    double worst, played_at;
+    double cost = fit(&lim, padding, speed, weight, gaps, &worst, &played_at);
+    if (cost < 0 || check(gaps, n, &lim)) {
+      fprintf(stderr, "%s: can't be made to fit in %u tenths\n", argv[a], 10 * n);
+      failed = 1;
+      continue;
+    }
+    fprintf(stderr, "%s: %u gaps, played at %.0f%% speed, worst tick %.0f ms off, cost %.2f\n",
+      argv[a], n, played_at * 100, worst * 100, cost);
+
+    if (tuney) {
+      identifier(argv[a], names[songs], sizeof(names[songs]));
+      printf("// %s\nPROGMEM const unsigned char %s_table[] = {", argv[a], names[songs]);
+      for(unsigned int i = 0; i < n; i++) printf(" %u,", gaps[i] - 1);
+      printf(" 0 };\n");
+      songs++;
+    } else if (strcmp(format, "pgm") == 0) {
+      printf("// %s\nconst unsigned char sleep[] PROGMEM = {", argv[a]);
+      for(unsigned int i = 0; i < n - 1; i++) printf("%s0x%02X", i ? ", " : "", gaps[i]);
+      printf("};\n\n#define WAIT (0x%04X)\n", gaps[n - 1]);
+      if (n == 1) fprintf(stderr, "%s: rhythm_pgm.c needs at least one sleep\n", argv[a]);
+    } else {
+      unsigned char image[3 + 59];
+      image[0] = n - 1;
+      image[1] = gaps[n - 1] & 0xff;
+      image[2] = gaps[n - 1] >> 8;
+      for(unsigned int i = 0; i < n - 1; i++) image[3 + i] = gaps[i];
+      intel_hex(image, 3 + n - 1, 6);
+    }
+  }
+  if (tuney && songs > 0) {
+    printf("\nPROGMEM PGM_VOID_P const song_table[] = {");
+    for(int i = 0; i < songs; i++) printf("%s(PGM_VOID_P)&%s_table", i ? ", " : " ", names[i]);
+    printf(" };\n\n#define SONG_COUNT %d\n", songs);
+  }
+  return failed;
+
+usage:
+  fprintf(stderr, "usage: %s [-f tuney|rhythm|pgm] [-p [-s speed]] [-w weight] [-k note] [-m msec] file ...\n", argv[0]);
+  return 1;
+}
@@ -0,0 +1,175 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Reprograms a chip with a new image, writing only the flash pages that are
+ * different from what it has now. 'make update TYPE=...' runs it.
+ *
+ * reflash [-s flash_size] [-g page_size] [-a dir] [-e] -c command new.hex
+ *
+ * It reads the build ID from the end of the chip's flash (see buildid.h) and
+ * looks for that build in dir (where buildid -a keeps a copy of every one -
+ * 'builds' by default). That's what's in the chip's flash, so the pages that
+ * are the same in both can be left alone.
+ *
+ * command is how to run the programmer. It has to take avrdude's options,
+ * so it's avrdude itself, with the options for the programmer and chip, or
+ * mockdude for trying it out.
+ *
+ * Over ISP, an ATtiny can only erase the whole chip at once, and without an
+ * erase, writing a page can only turn bits from 1 to 0. Every build has its
+ * own ID and CRC in the last page, and those always need some bits turned
+ * back on. So unless -e says the programmer can erase a page at a time (as
+ * UPDI ones can, for the chips that have it), it's the whole image, the same
+ * as 'make flash'. It does that too if the chip's build isn't in dir.
+ *
+ * The page with the build ID in it goes last. If the update stops part way,
+ * the chip still says it has the old build, and the next one writes every
+ * page that's different from that, which includes all the ones that did get
+ * written.
+ *
+ * It doesn't verify anything. 'make update' does that afterwards, the same
+ * way as 'make flash'.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "buildid.h"
+
+#define MAX_FLASH (65536)
+
+static uint8_t old_image[MAX_FLASH], new_image[MAX_FLASH];
+
+static void put_record(FILE *f, unsigned int address, const uint8_t *data, unsigned int count) {
+  uint8_t sum = count + (address >> 8) + (address & 0xff);
+  fprintf(f, ":%02X%04X00", count, address);
+  for(unsigned int i = 0; i < count; i++) {
+    fprintf(f, "%02X", data[i]);
+    sum += data[i];
+  }
+  fprintf(f, "%02X\n", (uint8_t)-sum);
+}
+
+// Ask the chip which build it has.
+static int read_build(const char *command, long flash_size, uint32_t *id) {
+  char shell[1024];
+  uint8_t trailer[BUILD_TRAILER_SIZE];
+  snprintf(shell, sizeof(shell), "echo 'dump flash %ld %d' | %s -t",
+    flash_size - BUILD_TRAILER_SIZE, BUILD_TRAILER_SIZE, command);
+  FILE *f = popen(shell, "r");
+  if (f == NULL) return 0;
+  int ok = build_read_dump(f, flash_size - BUILD_TRAILER_SIZE, BUILD_TRAILER_SIZE, trailer);
+  if (pclose(f) != 0) ok = 0;
+  *id = build_get32(trailer);
+  return ok;
+}
+
+static int program(const char *command, const char *options, const char *file) {
+  char shell[1024];
+  fflush(stdout);
+  snprintf(shell, sizeof(shell), "%s %s -U flash:w:%s:i", command, options, file);
+  return system(shell) != 0;
+}
+
+int main(int argc, char **argv) {
+  long flash_size = 4096, page_size = 64;
+  const char *archive = "builds", *command = NULL;
+  int page_erase = 0;
+  int c;
+
+  while((c = getopt(argc, argv, "s:g:a:ec:")) != -1) {
+    switch(c) {
+      case 's': flash_size = strtol(optarg, NULL, 0); break;
+      case 'g': page_size = strtol(optarg, NULL, 0); break;
+      case 'a': archive = optarg; break;
+      case 'e': page_erase = 1; break;
+      case 'c': command = optarg; break;
+      default: goto usage;
+    }
+  }
+  if (argc - optind != 1 || command == NULL || flash_size <= BUILD_TRAILER_SIZE
+      || flash_size > MAX_FLASH || page_size <= 0 || flash_size % page_size != 0) goto usage;
+  const char *new_path = argv[optind];
+
+  memset(new_image, 0xff, sizeof(new_image));
+  if (build_read_hex(new_path, new_image, NULL, flash_size) < 0) return 1;
+  uint32_t new_id = build_get32(new_image + flash_size - BUILD_TRAILER_SIZE);
+
+  uint32_t old_id;
+  if (!read_build(command, flash_size, &old_id)) {
+    fprintf(stderr, "can't read the build ID from the chip\n");
+    return 1;
+  }
+  if (old_id == new_id) {
+    printf("chip already has build %08lx\n", (unsigned long)new_id);
+    return 0;
+  }
+
+  char old_path[512];
+  snprintf(old_path, sizeof(old_path), "%s/%08lx.hex", archive, (unsigned long)old_id);
+  memset(old_image, 0xff, sizeof(old_image));
+  int have_old = access(old_path, R_OK) == 0 && build_read_hex(old_path, old_image, NULL, flash_size) >= 0
+    && build_get32(old_image + flash_size - BUILD_TRAILER_SIZE) == old_id;
+  if (!have_old) {
+    printf("build %08lx isn't in %s, so writing all of %s\n", (unsigned long)old_id, archive, new_path);
+    return program(command, "-V", new_path);
+  }
+
+  long pages = flash_size / page_size, changed = 0;
+  for(long p = 0; p < pages; p++)
+    changed += memcmp(old_image + p * page_size, new_image + p * page_size, page_size) != 0;
+
+  if (!page_erase) {
+    printf("build %08lx -> %08lx: %ld of %ld pages changed, but the build ID needs erasing, so writing all of %s\n",
+      (unsigned long)old_id, (unsigned long)new_id, changed, pages, new_path);
+    return program(command, "-V", new_path);
+  }
+  printf("build %08lx -> %08lx: writing the %ld of %ld pages that changed\n",
+    (unsigned long)old_id, (unsigned long)new_id, changed, pages);
+
+  // Just the changed pages, whole, in a file of their own. The build ID is
+  // at the end of the flash, and avrdude writes in address order, so that
+  // goes last.
+  char diff_path[] = "/tmp/reflashXXXXXX";
+  int fd = mkstemp(diff_path);
+  FILE *f = (fd >= 0) ? fdopen(fd, "w") : NULL;
+  if (f == NULL) {
+    perror("can't make a temporary file");
+    return 1;
+  }
+  for(long p = 0; p < pages; p++) {
+    const uint8_t *n = new_image + p * page_size;
+    if (memcmp(old_image + p * page_size, n, page_size) == 0) continue;
+    for(long i = 0; i < page_size; i += 16)
+      put_record(f, p * page_size + i, n + i, page_size - i < 16 ? page_size - i : 16);
+  }
+  fputs(":00000001FF\n", f);
+  fclose(f);
+  int failed = program(command, "-V -D", diff_path);
+  unlink(diff_path);
+  return failed;
+
+usage:
+  fprintf(stderr, "usage: %s [-s flash_size] [-g page_size] [-a dir] [-e] -c command new.hex\n", argv[0]);
+  return 1;
+}
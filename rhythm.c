@@ -41,9 +41,15 @@
 #include "base.h"
 #include <avr/eeprom.h>
 
+// Out of the stack, which is short of room for it on the second movement of
+// a dual pair.
+OVERLAY(
+  struct { unsigned char sleep[MAX_SLEEPS]; } run;
+);
+
 void loop() {
 
-  unsigned char sleep[MAX_SLEEPS];
+  unsigned char *sleep = overlay.run.sleep;
   unsigned char i;
   unsigned int j;
 
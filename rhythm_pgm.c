@@ -54,7 +54,7 @@ void loop() {
   while(1) {
     for(i = 0; i < sizeof(sleep); i++) {
       doTick();
-      for(j = 1; j < pgm_read_byte(sleep[i]); j++)
+      for(j = 1; j < pgm_read_byte(sleep + i); j++)
         doSleep();
     }
     doTick();
@@ -0,0 +1,240 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * The host simulator. See sim.h.
+ *
+ * loop() never returns, so when the run reaches its horizon we longjmp()
+ * back out of it from inside doSleep().
+ */
+
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdlib.h>
+#ifdef DUAL_MOVEMENT
+#include <ucontext.h>
+#endif
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "base.h"
+#include "sim.h"
+
+static struct sim_run *current;
+static jmp_buf done;
+// The counters live out here rather than in *current, so that once these
+// are inlined into loop() (see 'make bench'), they can stay in registers.
+static unsigned long long slot, horizon, ticks, draws;
+static unsigned long slot_draws, max_draws;
+
+// The wheel counts with slot. There's RAM to spare here, and the fewer
+// cascades the better. FIRMWARE_WHEEL keeps base.c's sizes instead, for
+// checking what timers longer than its reach do there.
+#define WHEEL_NOW slot
+#ifndef FIRMWARE_WHEEL
+#define WHEEL_BITS (5)
+#define WHEEL_LEVELS (4)
+#endif
+#include "wheel.h"
+
+// This is the same generator as base.c. A long is 32 bits on the AVR, and
+// the arithmetic can wrap there, so do it explicitly in 32 bits here.
+static int32_t seed;
+#define M (0x7fffffffL)
+
+unsigned long q_random() {
+  seed = (int32_t)((uint32_t)(seed >> 16) + (((uint32_t)seed << 15) & M)
+    - (uint32_t)(seed >> 21) - (((uint32_t)seed << 10) & M));
+  if (seed < 0) seed += M;
+  draws++;
+  slot_draws++;
+  return (unsigned long) seed;
+}
+
+#ifdef DUAL_MOVEMENT
+// Just like base.c: the first movement goes, then the second, then the
+// slot is over. The second one gets its own stack, set up with a ucontext.
+// After that, hand-offs are _setjmp()/_longjmp(), which don't make system
+// calls the way swapcontext() does.
+static ucontext_t start_context, second_context;
+static jmp_buf context[2];
+static unsigned char running;
+static unsigned char slot_pulses;
+static unsigned long long ticks_second, both_ticked;
+static unsigned long max_cycles, behind, max_behind;
+
+static void yield() {
+  if (_setjmp(context[running]) == 0) {
+    running ^= 1;
+    _longjmp(context[running], 1);
+  }
+}
+
+extern void loop_second();
+
+static void second() {
+  if (_setjmp(context[1]) == 0) swapcontext(&second_context, &start_context);
+  while(1) loop_second();
+}
+
+void doSleep() {
+  if (running == 0) {
+    yield();
+    return;
+  }
+  if (slot_draws > max_draws) max_draws = slot_draws;
+  unsigned long cycles = current->overhead_cycles + slot_pulses * current->tick_cycles
+    + slot_draws * current->draw_cycles;
+  if (cycles > max_cycles) max_cycles = cycles;
+  behind = (behind + cycles > SIM_SLOT_CYCLES) ? behind + cycles - SIM_SLOT_CYCLES : 0;
+  if (behind > max_behind) max_behind = behind;
+  if (slot_pulses == 2) both_ticked++;
+  slot_draws = 0;
+  slot_pulses = 0;
+  wheel_tick(); // this counts the slot
+  if (slot >= horizon) longjmp(done, 1);
+  yield();
+}
+
+void doTick() {
+  slot_pulses++;
+  if (running == 0) {
+    ticks++;
+    if (current->tick != NULL) current->tick(slot, current->arg);
+  } else {
+    ticks_second++;
+    if (current->tick_second != NULL) current->tick_second(slot, current->arg_second);
+  }
+  doSleep();
+}
+#else
+void doSleep() {
+  if (slot_draws > max_draws) max_draws = slot_draws;
+  slot_draws = 0;
+  wheel_tick(); // this counts the slot
+  if (slot >= horizon) longjmp(done, 1);
+}
+
+void doTick() {
+  ticks++;
+  if (current->tick != NULL) current->tick(slot, current->arg);
+  doSleep();
+}
+#endif
+
+extern void loop();
+
+void sim_run(struct sim_run *run) {
+  current = run;
+  slot = 0;
+  horizon = run->slots;
+  ticks = 0;
+
+  // Same as main() in base.c. The seed is stored as 32 bits, but is a
+  // 31 bit generator, and it can't be all 0 or all 1.
+  seed = (int32_t)(uint32_t)run->seed;
+  if (seed == 0 || ((seed & M) == M)) seed = 0x12345678L;
+  q_random();
+  draws = 0;
+  slot_draws = 0;
+  max_draws = 0;
+
+#ifdef DUAL_MOVEMENT
+  static char stack[1 << 16];
+  running = 0;
+  slot_pulses = 0;
+  ticks_second = both_ticked = 0;
+  max_cycles = behind = max_behind = 0;
+  getcontext(&second_context);
+  second_context.uc_stack.ss_sp = stack;
+  second_context.uc_stack.ss_size = sizeof(stack);
+  second_context.uc_link = NULL;
+  makecontext(&second_context, second, 0);
+  swapcontext(&start_context, &second_context);
+#endif
+  if (horizon != 0 && setjmp(done) == 0)
+    while(1) loop();
+  run->ticks = ticks;
+  run->draws = draws;
+  run->max_draws = max_draws;
+#ifdef DUAL_MOVEMENT
+  run->ticks_second = ticks_second;
+  run->both_ticked = both_ticked;
+  run->max_cycles = max_cycles;
+  run->max_behind = max_behind;
+#endif
+}
+
+int sim_parallel(unsigned int count, unsigned int jobs, unsigned long size,
+  sim_work_fn work, sim_work_fn done, void *arg) {
+  if (jobs == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    jobs = cpus > 0 ? (unsigned int)cpus : 1;
+  }
+  if (jobs > count) jobs = count;
+  if (jobs == 0) return 0;
+
+  // Each running child gets a slot of shared memory for its result.
+  unsigned char *shared = mmap(NULL, (size_t)size * jobs, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) return 1;
+  pid_t *pids = calloc(jobs, sizeof(pid_t));
+  unsigned int *which = calloc(jobs, sizeof(unsigned int));
+  unsigned int next = 0, running = 0;
+  int failed = 0;
+
+  while(next < count || running > 0) {
+    if (next < count && running < jobs) {
+      unsigned int j = 0;
+      while(pids[j] != 0) j++;
+      pid_t pid = fork();
+      if (pid < 0) {
+        failed = 1;
+        next = count; // stop starting new ones
+        continue;
+      }
+      if (pid == 0) {
+        work(next, shared + (size_t)size * j, arg);
+        _exit(0);
+      }
+      pids[j] = pid;
+      which[j] = next++;
+      running++;
+      continue;
+    }
+    int status;
+    pid_t pid = wait(&status);
+    if (pid < 0) break;
+    for(unsigned int j = 0; j < jobs; j++) {
+      if (pids[j] != pid) continue;
+      if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+        done(which[j], shared + (size_t)size * j, arg);
+      else
+        failed = 1;
+      pids[j] = 0;
+      running--;
+    }
+  }
+  free(pids);
+  free(which);
+  munmap(shared, (size_t)size * jobs);
+  return failed;
+}
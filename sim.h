@@ -0,0 +1,79 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * This is the fast host simulator. Like test.c, it stands in for base.c
+ * so that a clock's loop() can be run on a *nix system. But rather than
+ * printing a line for every tenth-of-a-second, it counts the slots and
+ * hands each tick to a callback, which is a whole lot faster.
+ *
+ * q_random() is the same generator that base.c uses, seeded the same way,
+ * so a given seed produces the same tick stream the hardware would.
+ *
+ * Because the clocks keep their state in statics and in the stack frame
+ * of a loop() that never returns, only one run can be made per process.
+ * Tools that want more than one fork() first.
+ */
+
+// This is called with the slot number (in tenths-of-a-second since start)
+// of every tick.
+typedef void (*sim_tick_fn)(unsigned long long slot, void *arg);
+
+struct sim_run {
+  // These are filled in by the caller.
+  unsigned long long slots; // how long to run, in tenths-of-a-second
+  unsigned long seed; // the EEPROM seed, as 'make seed' would store it
+  sim_tick_fn tick;
+  void *arg;
+  // Built with DUAL_MOVEMENT (see base.c), loop_second() runs alongside
+  // loop(), and its ticks go here. The CPU cost of a slot is estimated as
+  // overhead_cycles, plus tick_cycles for each tick pulse in it, plus
+  // draw_cycles for each q_random() call.
+  sim_tick_fn tick_second;
+  void *arg_second;
+  unsigned long tick_cycles, draw_cycles, overhead_cycles;
+
+  // These are filled in by sim_run().
+  unsigned long long ticks;
+  unsigned long long draws; // total q_random() calls
+  unsigned long max_draws; // most q_random() calls made within any one slot
+  // DUAL_MOVEMENT only
+  unsigned long long ticks_second;
+  unsigned long long both_ticked; // slots where both movements ticked
+  unsigned long max_cycles; // the most costly slot
+  // A slot that runs long eats into the next one (base.c catches up by not
+  // sleeping). This is the furthest behind the CPU ever got, in cycles.
+  unsigned long max_behind;
+};
+
+// CPU cycles in a slot: 32.768 kHz / 10 Hz
+#define SIM_SLOT_CYCLES (3277)
+
+void sim_run(struct sim_run *run);
+
+// Since each run needs its own process anyway, this is how tools spread
+// runs across all of the cores. It calls work(i, out, arg) for each i from
+// 0 to count - 1, each in a fork()ed child, with no more than jobs of them
+// at once (0 means one per core). Each child leaves size bytes of result
+// in out, and the parent hands them to done(i, out, arg) as they finish.
+// Returns non-zero if any child failed.
+typedef void (*sim_work_fn)(unsigned int i, void *out, void *arg);
+int sim_parallel(unsigned int count, unsigned int jobs, unsigned long size,
+  sim_work_fn work, sim_work_fn done, void *arg);
@@ -0,0 +1,110 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Measures how fast a clock runs on the host, in slots (tenths-of-a-second)
+ * per second of one core. 'make bench' builds it for each clock in
+ * BENCH_TYPES, both the old way (every module compiled on its own) and the
+ * way the sim targets do it now (-O3 -flto, so that doSleep(), doTick() and
+ * q_random() are inlined right into the clock's loop()), and compares them
+ * with test.c.
+ *
+ * simbench [-n slots] [-t test-binary]
+ *
+ * -t also times a test.c build of the same clock over the same number of
+ * slots, reading its output through a pipe the way it's meant to be used.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "sim.h"
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Reads slots lines of test.c output.
+static double time_test(const char *binary, unsigned long long slots) {
+  int fds[2];
+  if (pipe(fds) != 0) return -1;
+  double start = now();
+  pid_t pid = fork();
+  if (pid < 0) return -1;
+  if (pid == 0) {
+    dup2(fds[1], 1);
+    close(fds[0]);
+    close(fds[1]);
+    execl(binary, binary, (char *)NULL);
+    _exit(1);
+  }
+  close(fds[1]);
+  FILE *f = fdopen(fds[0], "r");
+  char line[16];
+  unsigned long long lines = 0;
+  while(lines < slots && fgets(line, sizeof(line), f) != NULL) lines++;
+  double elapsed = now() - start;
+  kill(pid, SIGTERM);
+  fclose(f);
+  waitpid(pid, NULL, 0);
+  return lines == slots ? elapsed : -1;
+}
+
+int main(int argc, char **argv) {
+  unsigned long long slots = 100000000ULL;
+  const char *test = NULL;
+  int c;
+
+  while((c = getopt(argc, argv, "n:t:")) != -1) {
+    switch(c) {
+      case 'n': slots = strtoull(optarg, NULL, 0); break;
+      case 't': test = optarg; break;
+      default:
+        fprintf(stderr, "usage: %s [-n slots] [-t test-binary]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  struct sim_run run;
+  memset(&run, 0, sizeof(run));
+  run.slots = slots;
+  run.seed = 1;
+  double start = now();
+  sim_run(&run);
+  double elapsed = now() - start;
+  printf("sim=%.3g", slots / elapsed);
+  if (test != NULL) {
+    // test.c is a lot slower. A tenth as many slots is plenty.
+    double t = time_test(test, slots / 10);
+    if (t > 0)
+      printf(" test=%.3g speedup=%.0f", slots / 10 / t, (slots / elapsed) / (slots / 10 / t));
+  }
+  printf("\n");
+  return 0;
+}
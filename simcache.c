@@ -0,0 +1,277 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * The simulator's result cache. See simcache.h.
+ *
+ * An entry is a file named by its hash, which is
+ *
+ *   "simcache"       magic
+ *   8 bytes          the hash of the simulator binary
+ *   8 bytes          the key's length, then the key
+ *   8 bytes          the data's length, before squeezing
+ *   the data, as a series of runs: a varint count of zero bytes, a varint
+ *   count of other bytes, and then those bytes.
+ *
+ * All in the host's byte order, since it's only ever read back by the same
+ * binary. Entries are written to a temporary name and renamed into place,
+ * so several simulations can share a cache at once. Using one touches its
+ * file, which is what makes the oldest one the least recently used.
+ */
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+
+#include "simcache.h"
+
+#define MAGIC "simcache"
+#define MAGIC_SIZE (8)
+#define NAME_LENGTH (16)
+// A run of zeros has to be at least this long to be worth breaking up a
+// run of other bytes for.
+#define MIN_ZEROS (4)
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size) {
+  const unsigned char *p = (const unsigned char *)data;
+  for(size_t i = 0; i < size; i++) {
+    hash ^= p[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+#define FNV_START (0xcbf29ce484222325ULL)
+
+// The hash of whichever file this code was loaded from, found by looking
+// for the mapping that has this function in it.
+static int image_hash(uint64_t *hash) {
+  static int known = -1;
+  static uint64_t image;
+  if (known >= 0) {
+    *hash = image;
+    return known;
+  }
+  known = 0;
+  FILE *maps = fopen("/proc/self/maps", "r");
+  if (maps == NULL) return 0;
+  char line[4096], path[4096];
+  uintptr_t here = (uintptr_t)image_hash;
+  path[0] = '\0';
+  while(fgets(line, sizeof(line), maps) != NULL) {
+    unsigned long long start, end;
+    int used;
+    if (sscanf(line, "%llx-%llx %*s %*s %*s %*s %n", &start, &end, &used) < 2) continue;
+    if (here < start || here >= end) continue;
+    snprintf(path, sizeof(path), "%s", line + used);
+    path[strcspn(path, "\n")] = '\0';
+    break;
+  }
+  fclose(maps);
+  FILE *f = path[0] == '/' ? fopen(path, "rb") : NULL;
+  if (f == NULL) return 0;
+  unsigned char buf[65536];
+  size_t got;
+  image = FNV_START;
+  while((got = fread(buf, 1, sizeof(buf), f)) > 0) image = fnv1a(image, buf, got);
+  fclose(f);
+  *hash = image;
+  known = 1;
+  return 1;
+}
+
+// Where the entry for key goes. Returns 0 if the cache is off.
+static int entry_path(const void *key, size_t key_size, uint64_t *image, char *path, size_t path_size) {
+  const char *dir = getenv("SIM_CACHE");
+  if (dir == NULL || dir[0] == '\0' || !image_hash(image)) return 0;
+  mkdir(dir, 0777); // it's fine if it's already there
+  uint64_t hash = fnv1a(FNV_START, image, sizeof(*image));
+  hash = fnv1a(hash, key, key_size);
+  snprintf(path, path_size, "%s/%016llx", dir, (unsigned long long)hash);
+  return 1;
+}
+
+static void put_varint(FILE *f, uint64_t value) {
+  while(value >= 0x80) {
+    putc((int)(value & 0x7f) | 0x80, f);
+    value >>= 7;
+  }
+  putc((int)value, f);
+}
+
+static int get_varint(const unsigned char **p, const unsigned char *end, uint64_t *value) {
+  *value = 0;
+  for(unsigned int shift = 0; *p < end && shift < 64; shift += 7) {
+    unsigned char byte = *(*p)++;
+    *value |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) return 1;
+  }
+  return 0;
+}
+
+void *simcache_get(const void *key, size_t key_size, size_t *size) {
+  char path[4096];
+  uint64_t image;
+  if (!entry_path(key, key_size, &image, path, sizeof(path))) return NULL;
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) return NULL;
+  struct stat st;
+  unsigned char *file = NULL, *data = NULL;
+  if (fstat(fileno(f), &st) != 0 || (file = malloc(st.st_size + 1)) == NULL
+      || fread(file, 1, st.st_size, f) != (size_t)st.st_size) {
+    fclose(f);
+    free(file);
+    return NULL;
+  }
+  fclose(f);
+
+  const unsigned char *p = file, *end = file + st.st_size;
+  uint64_t stored_image, stored_key_size, length;
+  if (end - p < MAGIC_SIZE + 16 || memcmp(p, MAGIC, MAGIC_SIZE) != 0) goto miss;
+  memcpy(&stored_image, p + MAGIC_SIZE, 8);
+  memcpy(&stored_key_size, p + MAGIC_SIZE + 8, 8);
+  p += MAGIC_SIZE + 16;
+  if (stored_image != image || stored_key_size != key_size || (size_t)(end - p) < key_size + 8
+      || memcmp(p, key, key_size) != 0) goto miss;
+  p += key_size;
+  memcpy(&length, p, 8);
+  p += 8;
+  if ((data = malloc(length + 1)) == NULL) goto miss;
+  uint64_t at = 0;
+  while(at < length) {
+    uint64_t zeros, others;
+    if (!get_varint(&p, end, &zeros) || !get_varint(&p, end, &others)
+        || zeros > length - at || others > length - at - zeros || others > (uint64_t)(end - p))
+      goto miss;
+    memset(data + at, 0, zeros);
+    at += zeros;
+    memcpy(data + at, p, others);
+    at += others;
+    p += others;
+  }
+  if (p != end) goto miss;
+  free(file);
+  utime(path, NULL); // it's been used
+  *size = length;
+  return data;
+
+miss:
+  free(file);
+  free(data);
+  return NULL;
+}
+
+int simcache_put(const void *key, size_t key_size, const void *data, size_t size) {
+  char path[4096], temp[4200];
+  uint64_t image;
+  if (!entry_path(key, key_size, &image, path, sizeof(path))) return 1;
+  snprintf(temp, sizeof(temp), "%s.%d", path, (int)getpid());
+  FILE *f = fopen(temp, "wb");
+  if (f == NULL) return 1;
+  uint64_t header[3] = { image, key_size, size };
+  fwrite(MAGIC, 1, MAGIC_SIZE, f);
+  fwrite(&header[0], 8, 2, f);
+  fwrite(key, 1, key_size, f);
+  fwrite(&header[2], 8, 1, f);
+  const unsigned char *p = (const unsigned char *)data;
+  size_t at = 0;
+  while(at < size) {
+    size_t zeros = 0;
+    while(at + zeros < size && p[at + zeros] == 0) zeros++;
+    at += zeros;
+    // The other bytes go on up to the next run of zeros worth stopping for.
+    size_t others = 0, run = 0;
+    while(at + others + run < size && run < MIN_ZEROS) {
+      if (p[at + others + run] == 0)
+        run++;
+      else {
+        others += run + 1;
+        run = 0;
+      }
+    }
+    if (at + others + run >= size && run < MIN_ZEROS) others += run;
+    put_varint(f, zeros);
+    put_varint(f, others);
+    fwrite(p + at, 1, others, f);
+    at += others;
+  }
+  if (fclose(f) != 0 || rename(temp, path) != 0) {
+    unlink(temp);
+    return 1;
+  }
+  return 0;
+}
+
+struct entry {
+  char name[NAME_LENGTH + 1];
+  time_t used;
+  off_t size;
+};
+
+static int oldest_first(const void *a, const void *b) {
+  time_t x = ((const struct entry *)a)->used, y = ((const struct entry *)b)->used;
+  return (x > y) - (x < y);
+}
+
+void simcache_trim() {
+  const char *dir = getenv("SIM_CACHE");
+  if (dir == NULL || dir[0] == '\0') return;
+  const char *mb = getenv("SIM_CACHE_MB");
+  off_t limit = (off_t)(((mb != NULL && mb[0] != '\0') ? atof(mb) : 256) * 1024 * 1024);
+  DIR *d = opendir(dir);
+  if (d == NULL) return;
+  struct entry *entries = NULL;
+  size_t count = 0, room = 0;
+  off_t total = 0;
+  struct dirent *de;
+  char path[4096];
+  while((de = readdir(d)) != NULL) {
+    // Only whole entries. Half-written ones have a .pid on the end.
+    if (strlen(de->d_name) != NAME_LENGTH || strspn(de->d_name, "0123456789abcdef") != NAME_LENGTH)
+      continue;
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+    if (count == room) {
+      room = room ? room * 2 : 256;
+      struct entry *more = realloc(entries, room * sizeof(*entries));
+      if (more == NULL) break;
+      entries = more;
+    }
+    memcpy(entries[count].name, de->d_name, NAME_LENGTH + 1);
+    entries[count].used = st.st_mtime;
+    entries[count].size = st.st_size;
+    total += st.st_size;
+    count++;
+  }
+  closedir(d);
+  if (total > limit) {
+    qsort(entries, count, sizeof(*entries), oldest_first);
+    for(size_t i = 0; i < count && total > limit; i++) {
+      snprintf(path, sizeof(path), "%s/%s", dir, entries[i].name);
+      if (unlink(path) == 0) total -= entries[i].size;
+    }
+  }
+  free(entries);
+}
@@ -0,0 +1,52 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * A cache of simulator results on disk, so that rerunning the same
+ * simulation (the same build of the same clock, the same seed and the same
+ * length) just reads back what it got last time. It's off unless SIM_CACHE
+ * is set in the environment to the directory to keep it in. SIM_CACHE_MB
+ * (256 by default) is how big the directory can get before the entries that
+ * were used longest ago are thrown out.
+ *
+ * Entries are found by a hash of the key the caller gives, plus a hash of
+ * the simulator binary itself (the executable or the .so that this is
+ * linked into). The binary has the clock and all of its compile-time knobs
+ * in it, so a rebuild with anything different gets its own entries, and a
+ * rebuild of exactly the same thing gets the old ones. Each entry keeps its
+ * whole key, which is checked on the way out, so a hash collision is just a
+ * miss. Runs of zero bytes are squeezed out on the way in.
+ *
+ * The key has to be the same bytes for the same inputs, so memset() any
+ * struct used as one before filling it in.
+ */
+
+#include <stddef.h>
+
+// Returns what was stored under key, in a buffer to free(), with its
+// length in *size. Or NULL if it isn't there (or the cache is off).
+void *simcache_get(const void *key, size_t key_size, size_t *size);
+
+// Stores size bytes of data under key. Returns 0 if it worked.
+int simcache_put(const void *key, size_t key_size, const void *data, size_t size);
+
+// Throws out the least recently used entries until the cache fits in
+// SIM_CACHE_MB. Call it once after a batch of puts.
+void simcache_trim();
@@ -0,0 +1,190 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * The simulator's C API. See simlib.h.
+ *
+ * With SIM_CACHE set, the tick slots of every run are kept in the cache (see
+ * simcache.h) as varints of the gaps between them, which is a byte a tick
+ * for any clock that ticks at least every 12.7 seconds. The trim only
+ * changes the phases, which are worked out again from the slots, so a run
+ * is cached for every trim at once.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "base.h"
+#include "sim.h"
+#include "simlib.h"
+#include "simcache.h"
+
+struct header {
+  uint64_t ticks;
+  int ok;
+};
+
+// Same as base.c: a clock that doesn't tick once a second (see drift.h)
+// says how fast it does with TICK_RATE(), and the rest get this.
+const unsigned long tick_rate[2] __attribute__((weak)) = { 1, IRQS_PER_SECOND };
+
+struct recorder {
+  struct header *header;
+  uint32_t *tick_slot;
+  float *phase;
+  double slot_ticks; // how many ticks a slot is worth, trim and all
+};
+
+static void record(unsigned long long slot, void *arg) {
+  struct recorder *r = (struct recorder *)arg;
+  uint64_t i = r->header->ticks++;
+  r->tick_slot[i] = (uint32_t)slot;
+  r->phase[i] = (float)((double)(i + 1) - slot * r->slot_ticks);
+}
+
+// What a run's ticks are cached under.
+struct key {
+  char kind[8];
+  uint64_t slots;
+  uint32_t seed;
+};
+
+static void make_key(struct key *k, uint64_t slots, uint32_t seed) {
+  memset(k, 0, sizeof(*k));
+  strcpy(k->kind, "trace");
+  k->slots = slots;
+  k->seed = seed;
+}
+
+// Fill in the ticks from the cache, if they're there.
+static int from_cache(const struct key *k, struct recorder *r, uint64_t slots) {
+  size_t size;
+  unsigned char *data = simcache_get(k, sizeof(*k), &size);
+  if (data == NULL) return 0;
+  uint64_t slot = 0;
+  int ok = 1;
+  r->header->ticks = 0;
+  for(size_t at = 0; at < size && ok; ) {
+    uint32_t gap = 0;
+    for(unsigned int shift = 0; ; shift += 7) {
+      if (at >= size || shift > 28) {
+        ok = 0;
+        break;
+      }
+      gap |= (uint32_t)(data[at] & 0x7f) << shift;
+      if (!(data[at++] & 0x80)) break;
+    }
+    slot += gap;
+    if (!ok || slot >= slots || r->header->ticks >= slots) {
+      ok = 0;
+      break;
+    }
+    record(slot, r);
+  }
+  free(data);
+  if (!ok) r->header->ticks = 0;
+  return ok;
+}
+
+static void to_cache(const struct key *k, const struct recorder *r) {
+  uint64_t ticks = r->header->ticks;
+  unsigned char *data = malloc(ticks * 5 + 1);
+  if (data == NULL) return;
+  size_t size = 0;
+  uint32_t last = 0;
+  for(uint64_t i = 0; i < ticks; i++) {
+    uint32_t gap = r->tick_slot[i] - last;
+    last = r->tick_slot[i];
+    while(gap >= 0x80) {
+      data[size++] = (gap & 0x7f) | 0x80;
+      gap >>= 7;
+    }
+    data[size++] = gap;
+  }
+  simcache_put(k, sizeof(*k), data, size);
+  free(data);
+  simcache_trim();
+}
+
+int simlib_run(uint64_t slots, uint32_t seed, int trim, struct simlib_result *result) {
+  memset(result, 0, sizeof(*result));
+  if (slots == 0 || slots > 0xffffffffULL) return -1;
+
+  // There can't be more ticks than slots. Only the pages that get written
+  // are ever really allocated.
+  size_t header_size = 4096;
+  size_t size = header_size + slots * (sizeof(uint32_t) + sizeof(float));
+  void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (mapping == MAP_FAILED) return -1;
+
+  struct recorder r;
+  r.header = (struct header *)mapping;
+  r.tick_slot = (uint32_t *)((char *)mapping + header_size);
+  r.phase = (float *)(r.tick_slot + slots);
+  r.slot_ticks = (double)tick_rate[0] / tick_rate[1] * (1 + trim / 1e7);
+
+  struct key k;
+  make_key(&k, slots, seed);
+  if (from_cache(&k, &r, slots)) goto ran;
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    munmap(mapping, size);
+    return -1;
+  }
+  if (pid == 0) {
+    struct sim_run run;
+    memset(&run, 0, sizeof(run));
+    run.slots = slots;
+    run.seed = seed;
+    run.tick = record;
+    run.arg = &r;
+    sim_run(&run);
+    r.header->ok = 1;
+    _exit(0);
+  }
+  int status;
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0
+      || !r.header->ok) {
+    munmap(mapping, size);
+    return -1;
+  }
+  to_cache(&k, &r);
+
+ran:
+  result->slots = slots;
+  result->ticks = r.header->ticks;
+  result->tick_slot = r.tick_slot;
+  result->phase = r.phase;
+  result->mapping = mapping;
+  result->mapped = size;
+  return 0;
+}
+
+void simlib_free(struct simlib_result *result) {
+  if (result->mapping != NULL) munmap(result->mapping, result->mapped);
+  memset(result, 0, sizeof(*result));
+}
@@ -0,0 +1,58 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * A C API around the host simulator, built as a shared library with
+ * 'make pysim TYPE={clock}' for clocksim.py (or anything else that can call C).
+ *
+ * Each run is made in a fork()ed child (see sim.h for why), which writes the
+ * results straight into shared memory. The caller gets pointers to those
+ * buffers - nothing is copied and nothing is printed.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct simlib_result {
+  uint64_t slots; // how long the run was, in tenths-of-a-second
+  uint64_t ticks; // how many entries are in each array
+
+  // The slot each tick happened in.
+  uint32_t *tick_slot;
+  // How far ahead of true time the hands were just after each tick, in
+  // ticks, which are seconds of the clock's own time (sidereal seconds,
+  // say - see TICK_RATE in base.h). A perfect clock is 1 tick ahead there,
+  // since the hands move on at the start of each one.
+  float *phase;
+
+  // simlib's own bookkeeping.
+  void *mapping;
+  size_t mapped;
+};
+
+// Runs the clock for slots tenths-of-a-second from the given EEPROM seed. trim
+// is the EEPROM trim value in tenths of a ppm: positive makes each tenth-of-a-
+// second that much longer, as it does on the hardware. Returns 0 on success.
+// slots can be up to 2^32 - 1 (about 13 years).
+int simlib_run(uint64_t slots, uint32_t seed, int trim, struct simlib_result *result);
+
+// Releases the buffers from simlib_run().
+void simlib_free(struct simlib_result *result);
@@ -0,0 +1,250 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Runs one clock through the fast simulator for a range of seeds and prints
+ * the metrics for all of them combined on a single line. Build it with
+ * 'make sim TYPE={the kind of clock}'.
+ *
+ * -n slots      how long each run is, in tenths-of-a-second (default 10 days)
+ * -s seed       the first seed (default 1)
+ * -k count      how many seeds to run (default 1)
+ * -r num/den    the promised tick rate, in ticks per slot (default 1/10)
+ * -j jobs       how many to run at once (default one per core)
+ * -b file       compare against an earlier simstat line saved in file, and
+ *               fail if this stream is any more predictable than that one
+ * -t fraction   how much worse counts as "more predictable" (default 0.02)
+ * -m seconds    fail if the hands ever get further behind than this
+ * -M seconds    fail if the hands ever get further ahead than this
+ * -w prefix     also keep each seed's ticks in a tick archive (see tickarc.h),
+ *               prefix-{seed}.tka
+ *
+ * The drift is measured just before and just after every tick, so even a
+ * perfect clock is up to one second "ahead" right after it ticks.
+ *
+ * With SIM_CACHE set, each seed's metrics are kept in the cache (see
+ * simcache.h), and only the seeds that aren't there already get simulated.
+ * With -w, they all are, so that each one gets its archive.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "metrics.h"
+#include "simcache.h"
+#include "tickarc.h"
+
+struct options {
+  unsigned long long slots;
+  unsigned long seed;
+  unsigned long rate_num, rate_den;
+  struct metrics total;
+  int have_total;
+  unsigned int *todo; // the seeds (counting from seed) that aren't cached
+  const char *archive; // -w
+};
+
+// Each tick goes to both of these, with -w.
+struct both {
+  struct metrics *m;
+  struct tickarc_writer *w;
+};
+
+static void tick_both(unsigned long long slot, void *arg) {
+  struct both *b = (struct both *)arg;
+  metrics_tick(slot, b->m);
+  tickarc_add(b->w, slot);
+}
+
+// What a seed's metrics are cached under.
+struct key {
+  char kind[8];
+  unsigned long long slots;
+  unsigned long seed, rate_num, rate_den;
+};
+
+static void make_key(struct key *k, const struct options *opt, unsigned long seed) {
+  memset(k, 0, sizeof(*k));
+  strcpy(k->kind, "metrics");
+  k->slots = opt->slots;
+  k->seed = seed;
+  k->rate_num = opt->rate_num;
+  k->rate_den = opt->rate_den;
+}
+
+static void work(unsigned int i, void *out, void *arg) {
+  struct options *opt = (struct options *)arg;
+  struct metrics *m = (struct metrics *)out;
+  struct sim_run run;
+
+  metrics_init(m, opt->rate_num, opt->rate_den);
+  memset(&run, 0, sizeof(run));
+  run.slots = opt->slots;
+  run.seed = opt->seed + opt->todo[i];
+  run.tick = metrics_tick;
+  run.arg = m;
+  struct both b = { m, NULL };
+  if (opt->archive != NULL) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s-%lu.tka", opt->archive, run.seed);
+    b.w = tickarc_create(path);
+    if (b.w == NULL) _exit(1);
+    run.tick = tick_both;
+    run.arg = &b;
+  }
+  sim_run(&run);
+  if (b.w != NULL && tickarc_close(b.w, run.slots)) {
+    fprintf(stderr, "couldn't write the archive for seed %lu\n", run.seed);
+    _exit(1);
+  }
+  metrics_finish(m, run.slots);
+  m->draws = run.draws;
+  m->max_draws = run.max_draws;
+}
+
+static double field(const char *line, const char *key) {
+  char pattern[64];
+  snprintf(pattern, sizeof(pattern), " %s=", key);
+  const char *where = strstr(line, pattern);
+  if (where != NULL) return atof(where + strlen(pattern));
+  size_t keylen = strlen(key);
+  if (strncmp(line, key, keylen) == 0 && line[keylen] == '=') return atof(line + keylen + 1);
+  return 0;
+}
+
+// Each of the unpredictability counts must be no worse than the baseline's,
+// give or take the tolerance.
+static int compare(const char *path, const struct metrics *m, double tolerance) {
+  char line[1024];
+  FILE *f = fopen(path, "r");
+  if (f == NULL || fgets(line, sizeof(line), f) == NULL) {
+    fprintf(stderr, "can't read baseline %s\n", path);
+    if (f != NULL) fclose(f);
+    return 1;
+  }
+  fclose(f);
+
+  struct {
+    const char *name;
+    double now, was;
+  } counts[] = {
+    { "entropy", metrics_entropy_rate(m), field(line, "entropy") },
+    { "lz", metrics_lz_rate(m), field(line, "lz") },
+    { "score", metrics_score(m), field(line, "score") },
+  };
+  int failed = 0;
+  for(unsigned int i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    int worse = counts[i].now < counts[i].was * (1 - tolerance);
+    fprintf(stderr, "%-8s %.4f vs %.4f%s\n", counts[i].name, counts[i].now, counts[i].was,
+      worse ? "  MORE PREDICTABLE" : "");
+    failed |= worse;
+  }
+  return failed;
+}
+
+static void merge(struct options *opt, const void *out) {
+  if (!opt->have_total) {
+    memcpy(&opt->total, out, sizeof(opt->total));
+    opt->have_total = 1;
+  } else
+    metrics_merge(&opt->total, (const struct metrics *)out);
+}
+
+static void done(unsigned int i, void *out, void *arg) {
+  struct options *opt = (struct options *)arg;
+  struct key k;
+  make_key(&k, opt, opt->seed + opt->todo[i]);
+  simcache_put(&k, sizeof(k), out, sizeof(struct metrics));
+  merge(opt, out);
+}
+
+int main(int argc, char **argv) {
+  static struct options opt;
+  unsigned int count = 1, jobs = 0;
+  const char *baseline = NULL;
+  double tolerance = 0.02;
+  double drift_min = 0, drift_max = 0;
+  int check_min = 0, check_max = 0;
+  int c;
+
+  opt.slots = 864000ULL * 10;
+  opt.seed = 1;
+  opt.rate_num = 1;
+  opt.rate_den = 10;
+  while((c = getopt(argc, argv, "n:s:k:r:j:b:t:m:M:w:")) != -1) {
+    switch(c) {
+      case 'n': opt.slots = strtoull(optarg, NULL, 0); break;
+      case 's': opt.seed = strtoul(optarg, NULL, 0); break;
+      case 'k': count = (unsigned int)strtoul(optarg, NULL, 0); break;
+      case 'r':
+        if (sscanf(optarg, "%lu/%lu", &opt.rate_num, &opt.rate_den) != 2 || opt.rate_den == 0) {
+          fprintf(stderr, "bad rate %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 'j': jobs = (unsigned int)strtoul(optarg, NULL, 0); break;
+      case 'b': baseline = optarg; break;
+      case 't': tolerance = atof(optarg); break;
+      case 'm': drift_min = atof(optarg); check_min = 1; break;
+      case 'M': drift_max = atof(optarg); check_max = 1; break;
+      case 'w': opt.archive = optarg; break;
+      default:
+        fprintf(stderr, "usage: %s [-n slots] [-s seed] [-k count] [-r num/den] [-j jobs] [-b baseline [-t tolerance]] [-m min] [-M max] [-w prefix]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  opt.todo = calloc(count ? count : 1, sizeof(*opt.todo));
+  unsigned int todo = 0;
+  for(unsigned int i = 0; i < count; i++) {
+    struct key k;
+    size_t size;
+    make_key(&k, &opt, opt.seed + i);
+    void *cached = (opt.archive == NULL) ? simcache_get(&k, sizeof(k), &size) : NULL;
+    if (cached != NULL && size == sizeof(struct metrics))
+      merge(&opt, cached);
+    else
+      opt.todo[todo++] = i;
+    free(cached);
+  }
+  if (getenv("SIM_CACHE") != NULL)
+    fprintf(stderr, "%u of %u seeds from the cache\n", count - todo, count);
+
+  int failed = sim_parallel(todo, jobs, sizeof(struct metrics), work, done, &opt);
+  simcache_trim();
+  if (failed || !opt.have_total) {
+    fprintf(stderr, "simulation failed\n");
+    return 1;
+  }
+  metrics_print(stdout, &opt.total);
+  if (check_min && opt.total.drift_min < drift_min) {
+    fprintf(stderr, "drift %.1f is behind the %.1f limit\n", opt.total.drift_min, drift_min);
+    failed = 1;
+  }
+  if (check_max && opt.total.drift_max > drift_max) {
+    fprintf(stderr, "drift %.1f is ahead of the %.1f limit\n", opt.total.drift_max, drift_max);
+    failed = 1;
+  }
+  if (baseline != NULL) failed |= compare(baseline, &opt.total, tolerance);
+  return failed;
+}
@@ -0,0 +1,49 @@
+/*
+
+ Sundial Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+ 
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * This clock keeps apparent solar time - sundial time - rather than mean time.
+ * Over the year, the two come apart by as much as a quarter of an hour:
+ * the sun is 16 minutes ahead of the clock in early November and 14 minutes
+ * behind it in mid February. That difference is the equation of time, and
+ * this clock follows it, running up to 30 seconds a day fast or slow.
+ *
+ * Set it to sundial time (not the time on your phone!) and then
+ * 'make phase TYPE=sundial' to tell it where in the year it is.
+ *
+ * The series is the rate of change of the equation of time, fitted to the
+ * Meeus solar coordinates in eot.ref for 2024 through 2027. The fit is
+ * good to a second and a half, and 'make astrocheck' checks it.
+ */
+
+#include "base.h"
+
+// Over a whole year, sundial time and mean time come out even.
+#define HARMONIC_MEAN (0)
+// The fundamental is the mean longitude of the sun, which is 0 at midnight
+// UTC on 2024-01-01 (unix time 1704067200). Once around every 31557438
+// seconds - the tropical year, as near as 2^32 will go.
+#define HARMONIC_STEP (8166)
+#define HARMONIC_SHIFT (0)
+#define HARMONIC_MULTIPLES { 1, 2, 3, 4 }
+#define HARMONIC_PHASES { 31973, 36432, 35656, 39982 }
+#define HARMONIC_COEFFICIENTS { 1475, 3977, 191, 176 }
+
+#include "harmonic.h"
@@ -51,18 +51,23 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#include "base.h"
+#include "wheel.h"
+
 extern void loop();
 
-unsigned int q_random() {
+unsigned long q_random() {
   return random();
 }
 
 void doSleep() {
   printf("Sleep\n");
+  wheel_tick();
 }
 
 void doTick() {
   printf("Tick\n");
+  wheel_tick();
 }
 
 int main(int argc, char **argv) {
@@ -0,0 +1,253 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * The tick archive. See tickarc.h.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tickarc.h"
+
+// Room for gaps in a block.
+#define ROOM (TICKARC_BLOCK - sizeof(struct tickarc_block))
+
+static unsigned int varint_size(unsigned long long v) {
+  unsigned int n = 1;
+  for(; v >= 0x80; v >>= 7) n++;
+  return n;
+}
+
+// The writer
+
+static void put_varint(struct tickarc_writer *w, unsigned long long v) {
+  unsigned char *p = w->block + sizeof(struct tickarc_block) + w->head->used;
+  for(; v >= 0x80; v >>= 7) *p++ = (v & 0x7f) | 0x80;
+  *p++ = v;
+  w->head->used = p - (w->block + sizeof(struct tickarc_block));
+}
+
+static void put_repeats(struct tickarc_writer *w) {
+  if (w->repeats == 0) return;
+  put_varint(w, w->repeats * 2 + 1);
+  w->repeats = 0;
+}
+
+static void put_block(struct tickarc_writer *w) {
+  put_repeats(w); // there's always room left for them
+  memset(w->block + sizeof(struct tickarc_block) + w->head->used, 0, ROOM - w->head->used);
+  fwrite(w->block, 1, TICKARC_BLOCK, w->f);
+  w->header.blocks++;
+  w->head->ticks = 0;
+}
+
+struct tickarc_writer *tickarc_create(const char *path) {
+  struct tickarc_writer *w = calloc(1, sizeof(*w));
+  if (w == NULL) return NULL;
+  w->f = fopen(path, "wb");
+  if (w->f == NULL) {
+    perror(path);
+    free(w);
+    return NULL;
+  }
+  w->head = (struct tickarc_block *)w->block;
+  // The header's written over this at the end.
+  fwrite(w->block, 1, TICKARC_BLOCK, w->f);
+  return w;
+}
+
+void tickarc_add(struct tickarc_writer *w, unsigned long long slot) {
+  struct tickarc_block *h = w->head;
+  if (h->ticks != 0) {
+    unsigned long long gap = slot - w->last;
+    unsigned int room = ROOM - h->used;
+    if (w->has_gap && gap == w->gap) {
+      if (varint_size((w->repeats + 1) * 2 + 1) <= room) {
+        w->repeats++;
+        goto added;
+      }
+    } else if (varint_size(gap * 2) + (w->repeats ? varint_size(w->repeats * 2 + 1) : 0) <= room) {
+      put_repeats(w);
+      put_varint(w, gap * 2);
+      w->gap = gap;
+      w->has_gap = 1;
+      goto added;
+    }
+    put_block(w);
+  }
+  // This one starts a new block.
+  h->first = slot;
+  h->used = 0;
+  w->has_gap = 0;
+  w->repeats = 0;
+
+added:
+  h->ticks++;
+  w->last = slot;
+  w->header.ticks++;
+}
+
+void tickarc_tick(unsigned long long slot, void *arg) {
+  tickarc_add((struct tickarc_writer *)arg, slot);
+}
+
+int tickarc_close(struct tickarc_writer *w, unsigned long long slots) {
+  if (w->head->ticks != 0) put_block(w);
+  memset(w->block, 0, TICKARC_BLOCK);
+  memcpy(w->header.magic, TICKARC_MAGIC, sizeof(w->header.magic));
+  w->header.block_size = TICKARC_BLOCK;
+  w->header.slots = slots;
+  memcpy(w->block, &w->header, sizeof(w->header));
+  int failed = fseek(w->f, 0, SEEK_SET) != 0 || fwrite(w->block, 1, TICKARC_BLOCK, w->f) != TICKARC_BLOCK;
+  failed |= ferror(w->f);
+  failed |= fclose(w->f) != 0;
+  free(w);
+  return failed;
+}
+
+// The reader
+
+static const struct tickarc_block *block_at(const struct tickarc *a, unsigned long long i) {
+  return (const struct tickarc_block *)(a->map + (i + 1) * TICKARC_BLOCK);
+}
+
+int tickarc_open(const char *path, struct tickarc *a) {
+  memset(a, 0, sizeof(*a));
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    perror(path);
+    if (fd >= 0) close(fd);
+    return 1;
+  }
+  if (st.st_size < TICKARC_BLOCK) {
+    fprintf(stderr, "%s isn't a tick archive\n", path);
+    close(fd);
+    return 1;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    perror(path);
+    return 1;
+  }
+  a->map = (const unsigned char *)map;
+  a->size = st.st_size;
+  a->header = (const struct tickarc_header *)map;
+  if (memcmp(a->header->magic, TICKARC_MAGIC, sizeof(a->header->magic)) != 0
+      || a->header->block_size != TICKARC_BLOCK
+      || a->size != (a->header->blocks + 1) * TICKARC_BLOCK) {
+    fprintf(stderr, "%s isn't a whole tick archive\n", path);
+    tickarc_free(a);
+    return 1;
+  }
+  return 0;
+}
+
+void tickarc_free(struct tickarc *a) {
+  if (a->map != NULL) munmap((void *)a->map, a->size);
+  a->map = NULL;
+}
+
+static void load_block(struct tickarc_cursor *c, unsigned long long i) {
+  const struct tickarc_block *h = block_at(c->a, i);
+  c->block = i;
+  c->at = (const unsigned char *)(h + 1);
+  c->end = c->at + (h->used <= ROOM ? h->used : ROOM);
+  c->slot = h->first;
+  c->ticks_left = h->ticks;
+  c->gap = c->repeats = 0;
+}
+
+// On to the next tick in this block, if there is one.
+static void step(struct tickarc_cursor *c) {
+  if (--c->ticks_left == 0) return;
+  if (c->repeats != 0) {
+    c->repeats--;
+    c->slot += c->gap;
+    return;
+  }
+  unsigned long long v = 0;
+  unsigned int shift = 0;
+  unsigned char byte;
+  do {
+    if (c->at == c->end || shift > 63) {
+      c->ticks_left = 0; // it's short
+      return;
+    }
+    byte = *c->at++;
+    v |= (unsigned long long)(byte & 0x7f) << shift;
+    shift += 7;
+  } while(byte & 0x80);
+  if (v & 1)
+    c->repeats = (v >> 1) - 1;
+  else
+    c->gap = v >> 1;
+  c->slot += c->gap;
+}
+
+int tickarc_seek(const struct tickarc *a, unsigned long long slot, struct tickarc_cursor *c) {
+  unsigned long long lo = 0, hi = a->header->blocks;
+  memset(c, 0, sizeof(*c));
+  c->a = a;
+  if (hi == 0) return 1;
+  // The last block that starts at or before slot.
+  while(lo < hi) {
+    unsigned long long mid = lo + (hi - lo) / 2;
+    if (block_at(a, mid)->first <= slot)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  load_block(c, lo ? lo - 1 : 0);
+  while(c->ticks_left != 0 && c->slot < slot) {
+    if (c->repeats != 0) {
+      // Skip as many of the same gap as it takes, all at once.
+      unsigned long long k = c->repeats;
+      if (c->gap != 0 && (slot - c->slot + c->gap - 1) / c->gap < k)
+        k = (slot - c->slot + c->gap - 1) / c->gap;
+      if (k >= c->ticks_left) k = c->ticks_left - 1;
+      c->slot += k * c->gap;
+      c->repeats -= k;
+      c->ticks_left -= k;
+      if (c->slot >= slot) break;
+    }
+    step(c);
+  }
+  // Everything in that block was before slot, so it's the next block's first.
+  if (c->ticks_left == 0 && c->block + 1 < a->header->blocks) load_block(c, c->block + 1);
+  return c->ticks_left == 0;
+}
+
+int tickarc_next(struct tickarc_cursor *c, unsigned long long *slot) {
+  while(c->ticks_left == 0) {
+    if (c->block + 1 >= c->a->header->blocks) return 1;
+    load_block(c, c->block + 1);
+  }
+  *slot = c->slot;
+  step(c);
+  return 0;
+}
@@ -0,0 +1,118 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * An archive of a tick stream, small enough to keep years of it, that can
+ * still go straight to any slot in it. simstat -w writes one for each seed
+ * as it runs, and tickcat reads them.
+ *
+ * The file is cut into TICKARC_BLOCK byte blocks. The first one is the
+ * file's header: the magic, the block size, how long the run was, and how
+ * many ticks and blocks there are after it. Each block after that starts
+ * with the slot of its first tick and how many ticks it has, and the rest
+ * of the ticks follow that as gaps, each from the tick before it. A gap is
+ * a varint (7 bits a byte, low bits first, with the top bit set on every
+ * byte but the last) of the gap times 2. A varint of n times 2, plus 1,
+ * is n more gaps the same as the last one, which is all a clock that keeps
+ * proper time ever has. So a tick costs a byte or two, or nothing at all,
+ * and nothing in one block depends on another.
+ *
+ * To find a slot, a binary search on the blocks' first slots finds the
+ * block it's in, and that's the only block that has to be decoded. The
+ * reader maps the file, so that's only a handful of pages read, however
+ * long the run was.
+ *
+ * The numbers are in the host's own byte order, like simcache.c's.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define TICKARC_MAGIC "TICKARC1"
+#define TICKARC_BLOCK (4096)
+
+// What's at the start of each block.
+struct tickarc_block {
+  uint64_t first; // the slot of the first tick
+  uint64_t ticks; // how many ticks, that one included
+  uint32_t used; // bytes of gaps after this
+  uint32_t unused;
+};
+
+struct tickarc_header {
+  char magic[8];
+  uint32_t block_size;
+  uint32_t unused;
+  uint64_t slots; // how long the run was
+  uint64_t ticks;
+  uint64_t blocks; // not counting this one
+};
+
+struct tickarc_writer {
+  FILE *f;
+  struct tickarc_header header;
+  unsigned char block[TICKARC_BLOCK];
+  struct tickarc_block *head; // at the start of block
+  unsigned long long last; // the last tick's slot
+  unsigned long long gap; // and the gap before it, if has_gap
+  unsigned long long repeats; // how many more of gap there have been, not yet written
+  int has_gap; // there's been a gap in this block
+};
+
+// Starts a new archive in path. Returns NULL (having said why) if it can't.
+struct tickarc_writer *tickarc_create(const char *path);
+
+// Adds the next tick. slot can't be any earlier than the last one.
+void tickarc_add(struct tickarc_writer *w, unsigned long long slot);
+
+// A sim_tick_fn (see sim.h), for an arg that's a writer.
+void tickarc_tick(unsigned long long slot, void *arg);
+
+// Finishes the archive for a run that was slots long, and frees the
+// writer. Returns 0 if it was all written.
+int tickarc_close(struct tickarc_writer *w, unsigned long long slots);
+
+struct tickarc {
+  const unsigned char *map;
+  size_t size;
+  const struct tickarc_header *header;
+};
+
+// Where a reader is.
+struct tickarc_cursor {
+  const struct tickarc *a;
+  unsigned long long block; // counting from 0, after the header
+  const unsigned char *at, *end; // in its gaps
+  unsigned long long slot; // the tick that's next, if ticks_left
+  unsigned long long gap, repeats; // repeats of gap still to come after it
+  unsigned long long ticks_left; // in this block, that one included
+};
+
+// Maps the archive in path. Returns 0 if it's there and it's whole.
+int tickarc_open(const char *path, struct tickarc *a);
+void tickarc_free(struct tickarc *a);
+
+// Puts c at the first tick at or after slot. Returns 0 if there is one.
+int tickarc_seek(const struct tickarc *a, unsigned long long slot, struct tickarc_cursor *c);
+
+// The tick c is at, in *slot, moving on to the next one. Returns 0 if
+// there was one.
+int tickarc_next(struct tickarc_cursor *c, unsigned long long *slot);
@@ -0,0 +1,174 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Writes made-up tick streams to tick archives (see tickarc.h) and reads
+ * them back, for 'make tickarccheck'.
+ *
+ * tickarccheck [-n ticks] [-s seed] [-k seeks] [-f file]
+ *
+ * The streams are
+ *
+ *   steady  a tick every second, which is one long repeat.
+ *   crazy   gaps of anything from 1 to 40 tenths.
+ *   mixed   runs of the same gap, ticks in the same slot, and gaps of up
+ *           to days or years, which take more than one byte.
+ *
+ * Each one is n ticks long (default 1000000). Reading one back has to give
+ * every tick, in order, and each of the seeks (default 100000, to random
+ * slots, the ones with ticks, and either side of those, and past the
+ * ends) has to land on the first tick at or after the slot it's given.
+ * It prints how big each archive was, in bytes a tick.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tickarc.h"
+
+static unsigned long long gap(const char *kind, unsigned long long *run, unsigned long long *same) {
+  if (strcmp(kind, "steady") == 0) return 10;
+  if (strcmp(kind, "crazy") == 0) return 1 + random() % 40;
+  if (*run != 0) {
+    (*run)--;
+    return *same;
+  }
+  switch(random() % 8) {
+    case 0:
+      *run = random() % 200;
+      *same = random() % 30;
+      return *same;
+    case 1: return 0;
+    case 2: return random() % 100000;
+    case 3: return ((unsigned long long)random() << 16) % (1ULL << 40);
+    default: return 1 + random() % 20;
+  }
+}
+
+// The first of ticks at or after slot, or count if there isn't one.
+static unsigned long long lower_bound(const unsigned long long *ticks, unsigned long long count,
+    unsigned long long slot) {
+  unsigned long long lo = 0, hi = count;
+  while(lo < hi) {
+    unsigned long long mid = lo + (hi - lo) / 2;
+    if (ticks[mid] < slot)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static int check(const char *kind, unsigned long long count, unsigned long seeks, const char *path) {
+  unsigned long long *ticks = malloc(count * sizeof(*ticks));
+  unsigned long long slot = random() % 1000, run = 0, same = 0;
+  if (ticks == NULL) return 1;
+  for(unsigned long long i = 0; i < count; i++) {
+    if (i != 0) slot += gap(kind, &run, &same);
+    ticks[i] = slot;
+  }
+  unsigned long long slots = slot + 1 + random() % 100;
+
+  struct tickarc_writer *w = tickarc_create(path);
+  if (w == NULL) return 1;
+  for(unsigned long long i = 0; i < count; i++) tickarc_add(w, ticks[i]);
+  if (tickarc_close(w, slots)) {
+    fprintf(stderr, "%s: couldn't write %s\n", kind, path);
+    return 1;
+  }
+
+  struct tickarc a;
+  struct tickarc_cursor c;
+  if (tickarc_open(path, &a)) return 1;
+  int failed = a.header->ticks != count || a.header->slots != slots;
+  unsigned long long i = 0, got;
+  tickarc_seek(&a, 0, &c);
+  for(; !failed && tickarc_next(&c, &got) == 0; i++)
+    if (i >= count || got != ticks[i]) {
+      printf("%s: tick %llu is %llu, not %llu\n", kind, i, got, i < count ? ticks[i] : 0);
+      failed = 1;
+    }
+  if (!failed && i != count) {
+    printf("%s: %llu ticks, not %llu\n", kind, i, count);
+    failed = 1;
+  }
+
+  for(unsigned long k = 0; !failed && k < seeks; k++) {
+    unsigned long long at;
+    switch(k % 4) {
+      case 0: at = ((unsigned long long)random() << 31 | random()) % (slots + 100); break;
+      case 1: at = ticks[random() % count]; break;
+      case 2: at = ticks[random() % count] + 1; break;
+      default: at = ticks[random() % count] - 1; break;
+    }
+    if (k == 0) at = 0;
+    if (k == 1) at = ticks[count - 1] + 1;
+    unsigned long long want = lower_bound(ticks, count, at);
+    int none = tickarc_seek(&a, at, &c);
+    if (none != (want == count) || (!none && (tickarc_next(&c, &got) != 0 || got != ticks[want]))) {
+      printf("%s: seek to %llu gave %llu, not %llu\n", kind, at, none ? 0 : got,
+        want < count ? ticks[want] : 0);
+      failed = 1;
+    }
+    // And the one after it, across the end of a block if it's there.
+    if (!failed && want + 1 < count && (tickarc_next(&c, &got) != 0 || got != ticks[want + 1])) {
+      printf("%s: after a seek to %llu, the next was %llu, not %llu\n", kind, at, got, ticks[want + 1]);
+      failed = 1;
+    }
+  }
+
+  printf("%s: ticks=%llu blocks=%llu bytes/tick=%.3f%s\n", kind, count,
+    (unsigned long long)a.header->blocks, (double)a.size / count, failed ? " FAILED" : "");
+  tickarc_free(&a);
+  free(ticks);
+  unlink(path);
+  return failed;
+}
+
+int main(int argc, char **argv) {
+  unsigned long long count = 1000000;
+  unsigned long seed = 1, seeks = 100000;
+  const char *path = "tickarccheck.tka";
+  int c;
+
+  while((c = getopt(argc, argv, "n:s:k:f:")) != -1) {
+    switch(c) {
+      case 'n': count = strtoull(optarg, NULL, 0); break;
+      case 's': seed = strtoul(optarg, NULL, 0); break;
+      case 'k': seeks = strtoul(optarg, NULL, 0); break;
+      case 'f': path = optarg; break;
+      default: goto usage;
+    }
+  }
+  if (optind != argc || count < 2) goto usage;
+  srandom(seed);
+
+  static const char *kinds[] = { "steady", "crazy", "mixed" };
+  int failed = 0;
+  for(unsigned int i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++)
+    failed |= check(kinds[i], count, seeks, path);
+  return failed;
+
+usage:
+  fprintf(stderr, "usage: %s [-n ticks] [-s seed] [-k seeks] [-f file]\n", argv[0]);
+  return 1;
+}
@@ -0,0 +1,101 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Prints the ticks in a tick archive (see tickarc.h), from anywhere in it.
+ * 'make tickcat' builds it.
+ *
+ * tickcat [-i] [-a when] [-u when] [-c count] file.tka
+ *
+ * -a is where to start (the beginning by default), and -u where to stop
+ * (not including it), either as a slot or as day/hh:mm[:ss[.t]], counting
+ * from day 0 at the start of the run. -c stops after that many ticks.
+ * Each tick is a line with its slot and when that is, the same way.
+ *
+ * -i just prints what's in the archive:
+ *   slots=... ticks=... blocks=... bytes=... bytes/tick=...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "tickarc.h"
+
+#define SLOTS_PER_DAY (864000ULL)
+
+// A slot, or day/hh:mm[:ss[.t]]. Returns 0 if it's one of those.
+static int parse_when(const char *s, unsigned long long *slot) {
+  unsigned long long day;
+  unsigned int h, m, sec = 0, tenth = 0;
+  char tail;
+  int got = sscanf(s, "%llu/%u:%u:%u.%u%c", &day, &h, &m, &sec, &tenth, &tail);
+  if (got >= 3 && got <= 5 && h < 24 && m < 60 && sec < 60 && tenth < 10) {
+    *slot = day * SLOTS_PER_DAY + ((h * 60 + m) * 60 + sec) * 10ULL + tenth;
+    return 0;
+  }
+  return sscanf(s, "%llu%c", slot, &tail) != 1;
+}
+
+static void print_when(unsigned long long slot) {
+  unsigned long long day = slot / SLOTS_PER_DAY;
+  unsigned long t = slot % SLOTS_PER_DAY;
+  printf("%llu %llu/%02lu:%02lu:%02lu.%lu\n", slot, day, t / 36000, t / 600 % 60, t / 10 % 60, t % 10);
+}
+
+int main(int argc, char **argv) {
+  unsigned long long from = 0, until = ~0ULL, count = ~0ULL;
+  int info = 0;
+  int c;
+
+  while((c = getopt(argc, argv, "ia:u:c:")) != -1) {
+    switch(c) {
+      case 'i': info = 1; break;
+      case 'a': if (parse_when(optarg, &from)) goto usage; break;
+      case 'u': if (parse_when(optarg, &until)) goto usage; break;
+      case 'c': count = strtoull(optarg, NULL, 0); break;
+      default: goto usage;
+    }
+  }
+  if (argc - optind != 1) goto usage;
+
+  struct tickarc a;
+  if (tickarc_open(argv[optind], &a)) return 1;
+  if (info) {
+    const struct tickarc_header *h = a.header;
+    printf("slots=%llu ticks=%llu blocks=%llu bytes=%lu bytes/tick=%.3f\n",
+      (unsigned long long)h->slots, (unsigned long long)h->ticks, (unsigned long long)h->blocks,
+      (unsigned long)a.size, h->ticks == 0 ? 0 : (double)a.size / h->ticks);
+    tickarc_free(&a);
+    return 0;
+  }
+
+  struct tickarc_cursor cursor;
+  unsigned long long slot;
+  if (tickarc_seek(&a, from, &cursor) == 0)
+    for(; count != 0 && tickarc_next(&cursor, &slot) == 0 && slot < until; count--)
+      print_when(slot);
+  tickarc_free(&a);
+  return 0;
+
+usage:
+  fprintf(stderr, "usage: %s [-i] [-a when] [-u when] [-c count] file.tka\n", argv[0]);
+  return 1;
+}
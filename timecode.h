@@ -0,0 +1,145 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * The DCF77 decoder behind TIME_CODE (see base.c), and what to do about
+ * the hands once it knows the time. It's included by base.c, and by
+ * timecodecheck.c, which tries it out against a made-up signal.
+ *
+ * The receiver's output is high while the carrier is cut back, which it is
+ * at the start of every second but the last of each minute: for 100 msec
+ * for a 0, and 200 msec for a 1. The missing pulse marks the minute, and
+ * the 59 bits before it give the time of the minute that starts with the
+ * next pulse. For hands that go round every 12 hours, only the minutes
+ * (bits 21-27, BCD, with even parity in 28) and hours (29-34, parity in 35)
+ * matter. But the rest is checked as well as it can be without keeping it:
+ * bit 20 is always 1, one of bits 17 and 18 is (summer time, or not), and
+ * the date (36-57) has even parity in 58.
+ *
+ * Times are counts of Timer0, at TIMECODE_HZ, in 16 bits. They wrap every
+ * two minutes, which is far longer than anything that's measured with
+ * them. Anything that doesn't look right - a pulse that's too short or too
+ * long, a second that isn't one, a missed edge - spoils the minute. Parity
+ * is only one bit, so a frame is only believed if the one before it was
+ * good too, and was for the minute before.
+ */
+
+#define TIMECODE_HZ (512)
+#define TIMECODE_MS(ms) ((unsigned int)((ms) * (long)TIMECODE_HZ / 1000))
+// Seconds on a 12 hour dial.
+#define TIMECODE_DIAL (43200U)
+// count, for a minute that's been spoiled
+#define TIMECODE_BAD (0xff)
+
+struct timecode {
+  unsigned int rise; // when the last pulse started
+  unsigned int bits; // bits 20-35 of this minute, bit 20 in bit 0
+  unsigned char check; // bits 17 and 18, and the date's parity, all xored
+  unsigned char count; // how many bits of this minute so far
+  unsigned char high; // the level after the last edge
+  unsigned char mark; // the pulse that's under way came after a minute mark
+  unsigned int last; // the minute of the last good frame, plus 1 (0 for none)
+};
+
+static unsigned char timecode_parity(unsigned int x) {
+  unsigned char p = 0;
+  for(; x != 0; x >>= 1) p ^= x & 1;
+  return p;
+}
+
+static unsigned char timecode_bcd(unsigned char x) {
+  return (x & 0xf) + 10 * (x >> 4);
+}
+
+// A minute mark's just gone by after all 59 bits. Returns the minute (into
+// 12 hours) that's starting, if that's believable, or -1.
+static int timecode_frame(struct timecode *c) {
+  unsigned int b = c->bits;
+  unsigned char minutes = timecode_bcd((b >> 1) & 0x7f), hours = timecode_bcd((b >> 9) & 0x3f);
+  if (!(b & 1) || c->check != 1 || timecode_parity((b >> 1) & 0xff) || timecode_parity((b >> 9) & 0x7f)
+      || ((b >> 1) & 0x0f) > 9 || ((b >> 9) & 0x0f) > 9 || minutes > 59 || hours > 23) {
+    c->last = 0;
+    return -1;
+  }
+  unsigned int minute = (hours % 12) * 60 + minutes;
+  unsigned char agreed = c->last != 0 && c->last % 720 == minute;
+  c->last = minute + 1;
+  return agreed ? (int)minute : -1;
+}
+
+// The receiver's output went to level (1 for high) at now. Returns the
+// minute (into 12 hours) that started with the pulse that's just ended, if
+// it's known, or -1. That's not until the pulse has ended, so that a glitch
+// late in the minute mark's second isn't taken for the minute.
+static int timecode_edge(struct timecode *c, unsigned char level, unsigned int now) {
+  int minute = -1;
+  if (level == c->high) {
+    c->count = TIMECODE_BAD; // an edge went missing
+    return -1;
+  }
+  c->high = level;
+  if (level) {
+    unsigned int gap = now - c->rise;
+    c->rise = now;
+    c->mark = gap >= TIMECODE_MS(1500);
+    if (!c->mark && (gap < TIMECODE_MS(900) || gap > TIMECODE_MS(1100)))
+      c->count = TIMECODE_BAD;
+    return -1;
+  }
+  unsigned int width = now - c->rise;
+  unsigned char good = width >= TIMECODE_MS(40) && width <= TIMECODE_MS(260);
+  if (c->mark) {
+    c->mark = 0;
+    if (good && c->count == 59) minute = timecode_frame(c);
+    else c->last = 0;
+    c->count = 0;
+    c->bits = 0;
+    c->check = 0;
+  }
+  if (!good || c->count >= 59) // the last is a pulse where the minute mark should be
+    c->count = TIMECODE_BAD;
+  else {
+    if (width >= TIMECODE_MS(150)) {
+      if (c->count >= 20 && c->count <= 35)
+        c->bits |= 1U << (c->count - 20);
+      else if (c->count == 17 || c->count == 18 || c->count >= 36)
+        c->check ^= 1;
+    }
+    c->count++;
+  }
+  return minute;
+}
+
+// The hands are at second at of the dial, and should be at want. Catching
+// up takes gain extra ticks a second; hands that are ahead can only wait.
+// Sets how many ticks to add or to hold back, whichever is over sooner. A
+// second either way is left alone, since that's just where in the second
+// the clock ticks.
+static void timecode_correct(unsigned int at, unsigned int want, unsigned char gain,
+    unsigned int *owed, unsigned int *held) {
+  unsigned int behind = (want >= at) ? want - at : want + (TIMECODE_DIAL - at);
+  unsigned int ahead = TIMECODE_DIAL - behind;
+  *owed = *held = 0;
+  if (behind <= 1 || ahead <= 1) return;
+  if (behind / gain <= ahead)
+    *owed = behind;
+  else
+    *held = ahead;
+}
@@ -0,0 +1,285 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Tries the TIME_CODE decoder (timecode.h) against a made-up DCF77 signal,
+ * for 'make timecodecheck'.
+ *
+ * timecodecheck [-m minutes] [-s seed]
+ *
+ * Each run starts at a random time of day (or just before the hour, or
+ * noon, or midnight, where the hours wrap) and goes on for minutes (default
+ * 600), with the receiver's edges timed by a Timer0 that's off by up to 100
+ * ppm, and fed to timecode_edge() the way the pin change interrupt in
+ * base.c does it, including leaving a noisy tenth alone after
+ * TIME_CODE_EDGES. The runs are
+ *
+ *   clean   pulses up to 10 msec early or late. Every minute mark but the
+ *           first two (after a minute that came in part way through, then
+ *           after one with no minute before it to agree with) has to give
+ *           the time.
+ *   noisy   the same, and then 0.5% of the pulses missing, 0.5% of the
+ *           bits the wrong way round, and a glitch in 0.5% of the seconds.
+ *   flips   2% of the bits the wrong way round, which is plenty of them
+ *           that parity doesn't catch.
+ *   static  a burst of hundreds of edges in 1% of the seconds.
+ *
+ * None of them should ever come out with the wrong time. It prints how many
+ * minutes came out, and how many wake-ups there were a second, on average
+ * and at the most.
+ *
+ * Then it checks that a frame with a units digit past 9 is thrown out, even
+ * with the parity right and the minute before it agreeing. Last, it checks
+ * timecode_correct() all around the dial: the hands always end up where
+ * they should, and by whichever way is sooner.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "timecode.h"
+
+// The same as base.c's.
+#define IRQS_PER_SECOND (10)
+#define TIME_CODE_GAP (2)
+#define TIME_CODE_GAIN (IRQS_PER_SECOND / TIME_CODE_GAP - 1)
+#define TIME_CODE_EDGES (4)
+
+struct noise {
+  const char *name;
+  double drop, flip, glitch, burst;
+  int must_all; // every minute mark but the first two has to give the time
+};
+
+struct run {
+  struct timecode code;
+  double ppm;
+  long slot; // the tenth the last edge was in
+  unsigned int edges; // in that tenth
+  unsigned int wakeups, wakeups_max, wakeups_second;
+  long second;
+  unsigned long accepted, wrong;
+};
+
+static double uniform(double lo, double hi) {
+  return lo + (hi - lo) * (random() / (double)RAND_MAX);
+}
+
+static int chance(double p) {
+  return random() < p * RAND_MAX;
+}
+
+// One edge, at t seconds, through the interrupt.
+static void edge(struct run *r, double t, unsigned char level, int minute) {
+  long slot = (long)(t * IRQS_PER_SECOND);
+  long second = (long)t;
+  if (second != r->second) {
+    if (r->wakeups_second > r->wakeups_max) r->wakeups_max = r->wakeups_second;
+    r->wakeups_second = 0;
+    r->second = second;
+  }
+  if (slot != r->slot) {
+    r->slot = slot;
+    r->edges = 0;
+  }
+  // Left off for the rest of a noisy tenth, so it doesn't wake us up.
+  if (r->edges > TIME_CODE_EDGES) return;
+  r->wakeups++;
+  r->wakeups_second++;
+  if (++r->edges > TIME_CODE_EDGES) {
+    r->code.count = TIMECODE_BAD;
+    return;
+  }
+  unsigned int now = (unsigned int)(unsigned long)(t * TIMECODE_HZ * (1 + r->ppm * 1e-6));
+  int got = timecode_edge(&r->code, level, now);
+  if (got < 0) return;
+  r->accepted++;
+  if (got != minute) {
+    r->wrong++;
+    printf("got %d:%02d at %d:%02d\n", got / 60, got % 60, minute / 60, minute % 60);
+  }
+}
+
+static unsigned char bcd(unsigned int x) {
+  return (x / 10) << 4 | (x % 10);
+}
+
+// The 59 bits of the frame for the given minute of the day, which is the
+// one that starts after them.
+static void frame(unsigned char *bits, unsigned int minute) {
+  for(unsigned int i = 0; i < 59; i++) bits[i] = random() & 1; // weather, date and so on
+  bits[0] = 0;
+  bits[17] = !(bits[18] = random() & 1);
+  bits[20] = 1;
+  unsigned char m = bcd(minute % 60), h = bcd(minute / 60), p = 0;
+  for(unsigned int i = 0; i < 7; i++) p ^= bits[21 + i] = (m >> i) & 1;
+  bits[28] = p;
+  p = 0;
+  for(unsigned int i = 0; i < 6; i++) p ^= bits[29 + i] = (h >> i) & 1;
+  bits[35] = p;
+  p = 0;
+  for(unsigned int i = 36; i < 58; i++) p ^= bits[i];
+  bits[58] = p;
+}
+
+static void pulse(struct run *r, double t, double width, int minute) {
+  edge(r, t, 1, minute);
+  edge(r, t + width, 0, minute);
+}
+
+static int check(const struct noise *n, unsigned int start, unsigned int minutes) {
+  struct run r;
+  memset(&r, 0, sizeof(r));
+  r.ppm = uniform(-100, 100);
+  r.slot = r.second = -1;
+  // Come in part way through a minute.
+  double t = uniform(1, 60);
+  unsigned int first = (unsigned int)t;
+  t = 100 + t; // so that nothing's before 0
+  for(unsigned int k = 0; k < minutes; k++) {
+    // This minute starts with the first pulse of this loop, and the frame
+    // that comes in during it is for the next one.
+    unsigned int now = (start + k) % 1440 % 720;
+    unsigned char bits[59];
+    frame(bits, (start + k + 1) % 1440);
+    for(unsigned int s = (k == 0) ? first : 0; s < 60; s++, t += 1) {
+      if (n->glitch > 0 && chance(n->glitch)) {
+        double at = t + uniform(0.3, 0.9);
+        pulse(&r, at, uniform(0.002, 0.03), now);
+      }
+      if (n->burst > 0 && chance(n->burst)) {
+        double at = t + uniform(0.3, 0.8);
+        for(unsigned int i = 0; i < 300; i++, at += 0.0005)
+          edge(&r, at, i & 1 ? 0 : 1, now);
+        edge(&r, at, 0, now); // and it settles back down
+      }
+      if (s == 59) continue; // the minute mark
+      if (n->drop > 0 && chance(n->drop)) continue;
+      unsigned char bit = bits[s];
+      if (n->flip > 0 && chance(n->flip)) bit ^= 1;
+      pulse(&r, t + uniform(-0.01, 0.01), (bit ? 0.2 : 0.1) + uniform(-0.01, 0.01), now);
+    }
+  }
+  double seconds = minutes * 60.0 - first;
+  printf("%s: start=%02u:%02u minutes=%u accepted=%lu wrong=%lu wakeups/s=%.2f max=%u\n",
+    n->name, start / 60, start % 60, minutes, r.accepted, r.wrong, r.wakeups / seconds,
+    r.wakeups_max);
+  if (r.wrong != 0) return 1;
+  // The last minute's frame never gets its minute mark.
+  if (n->must_all && r.accepted != minutes - 3) {
+    printf("%s: should have been %u\n", n->name, minutes - 3);
+    return 1;
+  }
+  return 0;
+}
+
+// Minutes and hours in BCD, straight into the frame's bits 20 to 35.
+static int check_bcd() {
+  static const struct {
+    unsigned char m, h;
+    int want;
+  } cases[] = {
+    { 0x34, 0x12, 34 },
+    { 0x0a, 0x05, -1 }, // 5:0a would be 5:10
+    { 0x30, 0x0c, -1 }, // 0c:30 would be 12:30
+    { 0x5f, 0x01, -1 },
+    { 0x00, 0x1b, -1 },
+  };
+  for(unsigned int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    struct timecode c;
+    memset(&c, 0, sizeof(c));
+    c.bits = 1 | cases[i].m << 1 | timecode_parity(cases[i].m) << 8
+      | cases[i].h << 9 | timecode_parity(cases[i].h) << 15;
+    c.check = 1;
+    // As if the minute before had said this was next.
+    c.last = (timecode_bcd(cases[i].h) % 12) * 60 + timecode_bcd(cases[i].m);
+    int got = timecode_frame(&c);
+    if (got != cases[i].want) {
+      printf("bcd: %02x:%02x gave %d, not %d\n", cases[i].h, cases[i].m, got, cases[i].want);
+      return 1;
+    }
+  }
+  printf("bcd: ok\n");
+  return 0;
+}
+
+// The hands at at have to get to want, by ticking gain times faster or by
+// waiting, whichever is sooner.
+static int check_correct() {
+  unsigned long tried = 0;
+  for(unsigned int at = 0; at < TIMECODE_DIAL; at += 7)
+    for(unsigned int k = 0; k < 20; k++, tried++) {
+      unsigned int want = (k < 4) ? (at + k - 2 + TIMECODE_DIAL) % TIMECODE_DIAL : random() % TIMECODE_DIAL;
+      unsigned int owed = 12345, held = 12345;
+      timecode_correct(at, want, TIME_CODE_GAIN, &owed, &held);
+      unsigned int behind = (want + TIMECODE_DIAL - at) % TIMECODE_DIAL;
+      unsigned int ahead = (TIMECODE_DIAL - behind) % TIMECODE_DIAL;
+      int ok;
+      if (behind <= 1 || ahead <= 1)
+        ok = owed == 0 && held == 0;
+      else if (owed != 0)
+        ok = held == 0 && owed == behind && behind / (double)TIME_CODE_GAIN <= ahead + 1;
+      else
+        ok = held == ahead && ahead <= behind / (double)TIME_CODE_GAIN + 1;
+      if (!ok) {
+        printf("correct: at=%u want=%u owed=%u held=%u\n", at, want, owed, held);
+        return 1;
+      }
+    }
+  printf("correct: %lu ok\n", tried);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  unsigned int minutes = 600;
+  unsigned long seed = 1;
+  int c;
+
+  while((c = getopt(argc, argv, "m:s:")) != -1) {
+    switch(c) {
+      case 'm': minutes = (unsigned int)strtoul(optarg, NULL, 0); break;
+      case 's': seed = strtoul(optarg, NULL, 0); break;
+      default: goto usage;
+    }
+  }
+  if (optind != argc || minutes < 3) goto usage;
+  srandom(seed);
+
+  static const struct noise runs[] = {
+    { "clean", 0, 0, 0, 0, 1 },
+    { "noisy", 0.005, 0.005, 0.005, 0, 0 },
+    { "flips", 0, 0.02, 0, 0, 0 },
+    { "static", 0, 0, 0, 0.01, 0 },
+  };
+  const unsigned int starts[] = { random() % 1440, 11 * 60 + 55, 23 * 60 + 55 };
+  int failed = 0;
+  for(unsigned int i = 0; i < sizeof(runs) / sizeof(runs[0]); i++)
+    for(unsigned int j = 0; j < sizeof(starts) / sizeof(starts[0]); j++)
+      failed |= check(&runs[i], starts[j], minutes);
+  failed |= check_bcd();
+  failed |= check_correct();
+  return failed;
+
+usage:
+  fprintf(stderr, "usage: %s [-m minutes] [-s seed]\n", argv[0]);
+  return 1;
+}
@@ -47,6 +47,10 @@
 // the number of elements in the table. The last element should be zero
 // to mark the end.
 
+#if defined(TUNEY_SONGS)
+// A song library from quantise.c - see 'make songs'
+#include "tuney_songs.h"
+#else
 // "Shave-and-a-haircut... two bits!"
 PROGMEM const unsigned char shave_table[] = { 27, 3, 1, 1, 3, 7, 3, 27, 0 };
 // Backbeat from "Heart Of Rock-n-Roll"
@@ -57,11 +61,17 @@ PROGMEM const unsigned char sos_table[] = { 23, 2, 2, 4, 6, 6, 8, 2, 2, 35, 0};
 PROGMEM PGM_VOID_P const song_table[] = { (PGM_VOID_P)&shave_table, (PGM_VOID_P)&backbeat_table, (PGM_VOID_P)&sos_table };
 
 #define SONG_COUNT 3
+#endif
+
+// One second in this many starts a song.
+#ifndef SONG_ODDS
+#define SONG_ODDS 30
+#endif
 
 void loop() {
   while(1) {
     // Do this about once a minute-ish.
-    if (q_random() % 30 != 0) {
+    if (q_random() % SONG_ODDS != 0) {
       // a normal second.
       doTick();
       for(int i = 0; i < IRQS_PER_SECOND - 1; i++)
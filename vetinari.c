@@ -33,12 +33,17 @@
 #define PAUSE_TICKS (0)
 #define TICKS_TO_GATHER (IRQS_PER_SECOND - PAUSE_TICKS)
 
+// One second in this many is a long one.
+#ifndef STUTTER_ODDS
+#define STUTTER_ODDS 4
+#endif
+
 void loop() {
   unsigned char ticks_needed = TICKS_TO_GATHER;
   while(1){
     doTick(); // 1
     doSleep(); // 2
-    if (q_random() % 4) {
+    if (q_random() % STUTTER_ODDS) {
       // Be normal. A "second" is 10 ticks long.
       for(unsigned char i = 0; i < IRQS_PER_SECOND - 2; i++)
         doSleep();
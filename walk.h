@@ -0,0 +1,142 @@
+/*
+
+ Wandering Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * This is a common file with the code for a clock that wanders back and
+ * forth at random, but always stays within a fixed window around the
+ * correct time. To build one, you just set the defines and include this file.
+ *
+ * The clock runs in segments. For each segment it picks a rate and a
+ * length at random from the two lists. If staying at that rate for that
+ * long would leave the window, the segment is cut short so that it ends
+ * right at the edge, and if the clock is already at that edge, it just
+ * keeps normal time for the segment instead. So the offset can never leave
+ * the window, and choosing a segment costs the same every time. The end of
+ * each segment is a wheel timer (see base.h), so there's nothing to count
+ * down along the way.
+ *
+ * The macros required are:
+ *
+ * WALK_MIN - the most the clock may be behind, in tenths of a second (negative)
+ * WALK_MAX - the most the clock may be ahead, in tenths of a second
+ * WALK_RATES - a brace-enclosed list of rates. Each is how many tenths of a second
+ *   each second of the clock lasts beyond the usual 10. Negative runs fast.
+ *   None may be IRQS_PER_SECOND negative or less.
+ * WALK_DURATIONS - a brace-enclosed list of segment lengths, in (clock) seconds.
+ *
+ * WALK_START may also be defined as the offset at power-up (the default is 0,
+ * which is to say that whoever changed the battery set it to the correct time).
+ *
+ * Built with POWER_FAIL (see base.c), it carries on from the offset it was
+ * at when the battery went instead, which is right if the hands were left
+ * where they stopped (and the battery was only out for a moment).
+ */
+
+#if defined(UNIT_TEST)
+// On *nix, there is no PROGMEM. Just make it go away and turn the
+// pgm_read operations into just pointer derefs.
+#define PROGMEM
+#define pgm_read_byte(x) *(x)
+#define pgm_read_word(x) *(x)
+#else
+#include <avr/pgmspace.h>
+#endif
+#ifdef POWER_FAIL
+#include <avr/interrupt.h>
+#endif
+
+#ifndef WALK_START
+#define WALK_START (0)
+#endif
+
+PROGMEM const signed char walk_rates[] = WALK_RATES;
+PROGMEM const unsigned int walk_durations[] = WALK_DURATIONS;
+
+#define WALK_RATE_COUNT (sizeof(walk_rates) / sizeof(walk_rates[0]))
+#define WALK_DURATION_COUNT (sizeof(walk_durations) / sizeof(walk_durations[0]))
+
+static unsigned char segment_over;
+static struct wheel_timer segment_timer;
+
+static void segmentOver(struct wheel_timer *t) {
+  segment_over = 1;
+}
+
+#ifdef POWER_FAIL
+// checkpointSave() needs these, so they can't be loop()'s own.
+static long offset = WALK_START;
+static signed char rate;
+
+// Keep how far ahead of true time we are right now (see base.h).
+void checkpointSave(unsigned char *state) {
+  long now = offset;
+  if (!segment_over) {
+    unsigned long left = wheel_left(&segment_timer) / (IRQS_PER_SECOND + rate);
+    if (left <= WALK_MAX - WALK_MIN) now += rate * (long)left; // see wheel_left()
+  }
+  for(unsigned char i = 0; i < 4; i++) state[i] = now >> (8 * i);
+}
+
+void checkpointLoad(const unsigned char *state) {
+  long now = 0;
+  for(unsigned char i = 0; i < 4; i++) now |= (long)state[i] << (8 * i);
+  if (now >= WALK_MIN && now <= WALK_MAX) offset = now;
+}
+#endif
+
+void loop() {
+#ifndef POWER_FAIL
+  long offset = WALK_START; // how far ahead of true time we'll be when this segment ends, in tenths of a second
+  signed char rate = 0;
+#endif
+  segment_timer.fire = segmentOver;
+  segment_over = 1;
+  while(1) {
+    if (segment_over) {
+      unsigned long r = q_random();
+      rate = (signed char)pgm_read_byte(walk_rates + (unsigned char)r % WALK_RATE_COUNT);
+      unsigned int length = pgm_read_word(walk_durations + (unsigned char)(r >> 8) % WALK_DURATION_COUNT);
+      if (rate != 0) {
+        // How many seconds at this rate until we hit the edge?
+        long room = (rate < 0)?((WALK_MAX - offset) / -rate):((offset - WALK_MIN) / rate);
+        if (room == 0)
+          rate = 0; // we're already there. Just be normal for a while.
+        else if (room < (long)length)
+          length = (unsigned int)room;
+      }
+#ifdef POWER_FAIL
+      cli(); // so checkpointSave() never sees half of this
+#endif
+      offset -= (long)rate * length;
+      // The timer goes off in the last tenth of the segment's last second.
+      segment_over = 0;
+      wheel_after(&segment_timer, (unsigned long)length * (IRQS_PER_SECOND + rate));
+#ifdef POWER_FAIL
+      sei();
+#endif
+    }
+    for(unsigned char i = 0; i < IRQS_PER_SECOND + rate; i++) {
+      if (i == 0)
+        doTick();
+      else
+        doSleep();
+    }
+  }
+}
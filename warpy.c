@@ -31,19 +31,50 @@
 // This is a multiple of 10% for how much swing we give
 #define CYCLE_MAGNITUDE (1)
 
+// How many tenths-of-a-second each second lasts in each direction
+#define SECOND_LENGTH(direction) (IRQS_PER_SECOND + (CYCLE_MAGNITUDE * ((direction)?-1:1)))
+
+static unsigned char cycle_direction = 0; // fast
+static struct wheel_timer cycle_timer;
+// How many seconds the first half runs for.
+static unsigned int first_half = CYCLE_LENGTH + 1;
+
+#ifdef POWER_FAIL
+// Keep which half we're in, and how much of it is left (see base.h).
+void checkpointSave(unsigned char *state) {
+  unsigned long left = wheel_left(&cycle_timer) / SECOND_LENGTH(cycle_direction);
+  if (left > CYCLE_LENGTH + 1) left = 0; // see wheel_left()
+  state[0] = cycle_direction;
+  state[1] = left;
+  state[2] = left >> 8;
+}
+
+void checkpointLoad(const unsigned char *state) {
+  unsigned int left = state[1] | (state[2] << 8);
+  if (left == 0) return; // it was just about to turn
+  cycle_direction = state[0] != 0;
+  first_half = left;
+}
+#endif
+
+// Each half runs for CYCLE_LENGTH + 1 seconds of whatever length they are.
+static void cycleTurn(struct wheel_timer *t) {
+  cycle_direction = !cycle_direction;
+  wheel_after(t, (CYCLE_LENGTH + 1) * SECOND_LENGTH(cycle_direction));
+}
+
 void loop() {
-  unsigned char cycle_direction = 0; // fast
-  unsigned long cycle_position = 0;
+  cycle_timer.fire = cycleTurn;
+  wheel_after(&cycle_timer, (unsigned long)first_half * SECOND_LENGTH(cycle_direction));
   while(1) {
-    for(unsigned char i = 0; i < IRQS_PER_SECOND + (CYCLE_MAGNITUDE * (cycle_direction?-1:1)); i++) {
+    // The timer goes off at the end of a second, so this is safe to
+    // work out just once at the start of each one.
+    unsigned char length = SECOND_LENGTH(cycle_direction);
+    for(unsigned char i = 0; i < length; i++) {
       if (i == 0)
         doTick();
       else
         doSleep();
     }
-    if (cycle_position++ >= CYCLE_LENGTH) {
-      cycle_position = 0;
-      cycle_direction = !cycle_direction;
-    }
   }
-} 
+}
@@ -0,0 +1,143 @@
+/*
+
+ Crazy Clock for Arduino
+ Copyright 2014 Nicholas W. Sayer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * This is the timer wheel behind wheel_after() and wheel_every() (see
+ * base.h). It's included by whatever supplies doSleep() - base.c, sim.c or
+ * test.c - which calls wheel_tick() once every tenth-of-a-second.
+ *
+ * It's a hierarchical wheel. Level 0 has a bucket for each of the next
+ * 2^WHEEL_BITS tenths. Level 1 has one for each of the next 2^WHEEL_BITS
+ * groups of that many, and so on up. A timer goes in the bucket for its
+ * expiry time on the lowest level that reaches that far, so adding one is
+ * a few shifts and a list insert. Each tenth, wheel_tick() just steps the
+ * level 0 index and runs whatever is in that bucket. When the index wraps,
+ * the next bucket up is emptied down into the level below. That happens
+ * a quarter of the time at most, and costs nothing if the bucket is empty.
+ * With no timers set at all, it's just the count.
+ *
+ * The wheel reaches 2^(WHEEL_BITS * WHEEL_LEVELS) tenths ahead - 6.4
+ * seconds with the defaults. A timer set for longer than that waits in the
+ * top level, and each time its bucket there comes round (once a reach), it's
+ * filed again, until it's near enough to come down. The firmware's timers
+ * are all minutes to a day long, so most of them sit up there, and each one
+ * costs a list insert every 6.4 seconds. That's nothing next to a tenth's
+ * worth of cycles. RAM is another matter: the buckets take two bytes each on
+ * the AVR, which is why there are only 12 of them.
+ */
+
+#include <stddef.h>
+
+#ifndef WHEEL_BITS
+#define WHEEL_BITS (2)
+#endif
+#ifndef WHEEL_LEVELS
+#define WHEEL_LEVELS (3)
+#endif
+
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+
+static struct wheel_timer *wheel[WHEEL_LEVELS][WHEEL_SIZE];
+// How many tenths have gone by. If whoever includes this already counts
+// them, it can define WHEEL_NOW as that counter instead.
+#ifndef WHEEL_NOW
+static unsigned long wheel_now;
+#define WHEEL_NOW wheel_now
+#endif
+static unsigned char wheel_pending; // how many timers are set
+
+static void wheel_insert(struct wheel_timer *t) {
+  unsigned long delta = t->expires - WHEEL_NOW;
+  unsigned char level = 0;
+  unsigned char shift = 0;
+  while(level < WHEEL_LEVELS - 1 && delta >= (1UL << (shift + WHEEL_BITS))) {
+    level++;
+    shift += WHEEL_BITS;
+  }
+  struct wheel_timer **bucket = &wheel[level][(t->expires >> shift) & WHEEL_MASK];
+  t->next = *bucket;
+  *bucket = t;
+}
+
+void wheel_after(struct wheel_timer *t, unsigned long slots) {
+  t->expires = WHEEL_NOW + slots;
+  t->period = 0;
+  wheel_pending++;
+  wheel_insert(t);
+}
+
+void wheel_every(struct wheel_timer *t, unsigned long slots) {
+  t->expires = WHEEL_NOW + slots;
+  t->period = slots;
+  wheel_pending++;
+  wheel_insert(t);
+}
+
+// From an interrupt, this can catch WHEEL_NOW half way through being
+// counted up, which happens for a few cycles every 256 tenths. So anything
+// that uses it there has to check that the answer makes sense.
+unsigned long wheel_left(const struct wheel_timer *t) {
+  long left = t->expires - WHEEL_NOW;
+  return (left > 0) ? left : 0;
+}
+
+// Empty this level's current bucket down into the levels below it.
+static void wheel_cascade(unsigned char level) {
+  struct wheel_timer **bucket = &wheel[level][(WHEEL_NOW >> (level * WHEEL_BITS)) & WHEEL_MASK];
+  struct wheel_timer *t = *bucket;
+  *bucket = NULL;
+  while(t != NULL) {
+    struct wheel_timer *next = t->next;
+    wheel_insert(t);
+    t = next;
+  }
+}
+
+// Cascade if it's time, and run what's due. This is the unusual case, kept
+// out of line so that wheel_tick() is cheap enough to inline.
+static void __attribute__((noinline)) wheel_run(unsigned char index) {
+  if (index == 0) {
+    // The higher levels have to come down first, so that anything due
+    // now has made it all the way to level 0.
+    unsigned char level = 1;
+    while(level < WHEEL_LEVELS - 1 && ((WHEEL_NOW >> (level * WHEEL_BITS)) & WHEEL_MASK) == 0)
+      level++;
+    while(level > 0) wheel_cascade(level--);
+  }
+  struct wheel_timer *t = wheel[0][index];
+  wheel[0][index] = NULL;
+  while(t != NULL) {
+    // The callback might set the timer again, which changes next.
+    struct wheel_timer *next = t->next;
+    if (t->period != 0) {
+      t->expires += t->period;
+      wheel_insert(t);
+    } else
+      wheel_pending--;
+    t->fire(t);
+    t = next;
+  }
+}
+
+static inline void wheel_tick() {
+  unsigned char index = ++WHEEL_NOW & WHEEL_MASK;
+  if (wheel_pending != 0 && (index == 0 || wheel[0][index] != NULL)) wheel_run(index);
+}